@@ -0,0 +1,173 @@
+#pragma once
+
+#include "Denoiser.hpp"
+#include "SharedMemory.hpp"
+#include "SharedMemoryReader.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <pthread.h>
+
+static_assert(kChannels == 1, "the worker denoises a mono ring");
+
+// In-driver denoising for MNG_PROCESSING_DRIVER mode
+//
+// The app writes the raw microphone signal into the shared ring and the
+// worker thread drains it through RNNoise into a private ring of processed
+// audio, which the IO thread reads instead of the shared one. That keeps
+// the app's frame buffering out of the path and moves RNNoise out of the
+// app, while the IO thread still never runs RNNoise itself.
+//
+// The worker consumes the shared ring and produces the private one; the IO
+// thread consumes the private ring, so both stay single-producer/consumer.
+class DenoiseWorker {
+public:
+    explicit DenoiseWorker(SharedMemoryReader& reader)
+        : reader_(reader),
+          denoiser_(kSampleRate, Denoiser::kFrameSize),
+          output_(static_cast<SharedAudioBuffer*>(
+              std::aligned_alloc(kCacheLineSize, SharedAudioBuffer::totalSize(kOutputFrames)))) {
+        mng_shm_initialize(output_, kOutputFrames, MNG_SAMPLE_FLOAT32);
+    }
+
+    ~DenoiseWorker() {
+        stop();
+        std::free(output_);
+    }
+
+    DenoiseWorker(const DenoiseWorker&) = delete;
+    DenoiseWorker& operator=(const DenoiseWorker&) = delete;
+
+    // Start and stop the thread (not on the IO thread)
+    void start() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (thread_.joinable()) return;
+
+        stopping_ = false;
+        thread_ = std::thread([this] { run(); });
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!thread_.joinable()) return;
+            stopping_ = true;
+        }
+        wakeup_.notify_all();
+        thread_.join();
+        running_.store(false);
+    }
+
+    // IO thread: the processed ring, or nullptr while the worker isn't
+    // denoising (app mode, or no producer)
+    SharedAudioBuffer* output() {
+        return running_.load(std::memory_order_acquire) ? output_ : nullptr;
+    }
+
+private:
+    // The processed ring's capacity: the largest, so it holds whatever
+    // delay the app's ring was sized for
+    static constexpr uint32_t kOutputFrames = MNG_MAX_RING_FRAMES;
+
+    // How often the worker looks for new raw audio while denoising, and
+    // while there is nothing to do
+    static constexpr std::chrono::milliseconds kActiveInterval{2};
+    static constexpr std::chrono::milliseconds kIdleInterval{50};
+
+    void run() {
+        pthread_set_qos_class_self_np(QOS_CLASS_USER_INTERACTIVE, 0);
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!stopping_) {
+            lock.unlock();
+            bool active = pass();
+            lock.lock();
+
+            wakeup_.wait_for(lock, active ? kActiveInterval : kIdleInterval,
+                             [this] { return stopping_; });
+        }
+    }
+
+    // Denoise whatever raw audio is waiting. Returns whether driver mode is on.
+    bool pass() {
+        RingLayout layout;
+        SharedAudioBuffer* shm = reader_.acquire(layout, SharedMemoryReader::kDenoiseWorker);
+
+        bool active = shm && shm->isValid(layout) && shm->active() &&
+                      mng_shm_processing_mode(shm) == MNG_PROCESSING_DRIVER;
+
+        if (active) {
+            if (!running_.load(std::memory_order_relaxed)) {
+                // Fresh start: forget RNNoise state and any raw audio that
+                // was queued before we got here
+                denoiser_.reset();
+                shm->skip(shm->fillLevel());
+                running_.store(true, std::memory_order_release);
+            }
+
+            mng_shm_set_target_latency_frames(output_, mng_shm_target_latency_frames(shm));
+
+            while (shm->availableToRead(Denoiser::kFrameSize) >= Denoiser::kFrameSize) {
+                shm->read(layout, raw_, Denoiser::kFrameSize);
+
+                size_t produced = denoiser_.process(raw_, Denoiser::kFrameSize,
+                                                    processed_, Denoiser::kFrameSize);
+                // The app owns the shared overrun counter; count ours locally
+                if (produced > 0 && !output_->writeMono(processed_, produced)) {
+                    mng_shm_note_overrun(output_);
+                }
+            }
+
+            carryTimeline(shm);
+        } else {
+            running_.store(false, std::memory_order_release);
+        }
+
+        reader_.release(SharedMemoryReader::kDenoiseWorker);
+        return active;
+    }
+
+    // Put the processed ring on the app's capture timeline, so the IO
+    // thread can align reads to it just as it does with the shared ring
+    void carryTimeline(SharedAudioBuffer* shm) {
+        uint64_t anchorSample = 0;
+        uint64_t anchorHost = 0;
+        if (!mng_shm_load_anchor(shm, &anchorSample, &anchorHost)) {
+            return;
+        }
+
+        // Processed frame p holds raw frame p + offset, counting the raw
+        // frames still waiting in the denoiser for a whole frame
+        const uint64_t consumed = shm->readIndex - denoiser_.pendingFrames();
+        const uint64_t offset = consumed - output_->writeIndex;
+        mng_shm_store_anchor(output_, anchorSample - offset, anchorHost);
+
+        // The newest processed frame also trails by the wait for a whole
+        // frame and for our next pass
+        constexpr uint32_t kPassFrames =
+            uint32_t(kSampleRate * kActiveInterval.count() / 1000);
+        mng_shm_set_producer_delay_frames(
+            output_, mng_shm_producer_delay_frames(shm) + Denoiser::kFrameSize + kPassFrames);
+        mng_shm_set_capture_latency_frames(output_, mng_shm_capture_latency_frames(shm));
+    }
+
+    SharedMemoryReader& reader_;
+
+    // Worker thread only
+    Denoiser denoiser_;
+    float raw_[Denoiser::kFrameSize] = {};
+    float processed_[Denoiser::kFrameSize] = {};
+
+    // Private ring of processed audio, in the same layout as the shared one
+    SharedAudioBuffer* output_;
+    std::atomic<bool> running_{false};
+
+    std::mutex mutex_;
+    std::condition_variable wakeup_;
+    std::thread thread_;
+    bool stopping_ = false;
+};
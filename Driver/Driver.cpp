@@ -6,78 +6,117 @@
 #include <CoreAudio/AudioServerPlugIn.h>
 
 #include "SharedMemory.hpp"
+#include "SharedMemoryReader.hpp"
+#include "RingConsumer.hpp"
+#include "HostClock.hpp"
+#if MNG_DRIVER_DENOISE
+#include "DenoiseWorker.hpp"
+#endif
+#include <algorithm>
+#include <atomic>
+#include <cmath>
 #include <cstring>
 #include <memory>
-#include <sys/mman.h>
-#include <sys/stat.h>
-#include <fcntl.h>
-#include <unistd.h>
+#include <string>
+#include <vector>
 
 namespace {
 
-// Stream format - matches what the app produces
+// Default stream format
 constexpr UInt32 SampleRate = 48000;
 constexpr UInt32 ChannelCount = 2;
 
-// Shared memory manager for receiving audio from the app
-class SharedMemoryReader {
+// Formats clients can pick from: any of RingConsumer::kSampleRates, with
+// the mono ring fanned out to up to this many channels
+constexpr UInt32 MaxChannelCount = 2;
+
+// How many virtual mics to expose when the bundle doesn't say
+constexpr UInt32 DefaultDeviceCount = 1;
+
+AudioStreamBasicDescription MakeFormat(Float64 sampleRate, UInt32 channels)
+{
+    AudioStreamBasicDescription format = {};
+    format.mSampleRate = sampleRate;
+    format.mFormatID = kAudioFormatLinearPCM;
+    format.mFormatFlags = kAudioFormatFlagIsFloat | kAudioFormatFlagsNativeEndian |
+                          kAudioFormatFlagIsPacked;
+    format.mBitsPerChannel = 32;
+    format.mChannelsPerFrame = channels;
+    format.mBytesPerFrame = channels * sizeof(float);
+    format.mFramesPerPacket = 1;
+    format.mBytesPerPacket = format.mBytesPerFrame;
+    return format;
+}
+
+// I/O Handler that reads from shared memory
+// Also handles StartIO/StopIO, which run off the IO thread and bracket the
+// shared memory watcher's lifetime, and AddClient/RemoveClient, which hand
+// each client a slot of its own.
+//
+// Every client reads the ring through its own cursor, with its own latency
+// control, converter and concealer (see RingConsumer.hpp), so two apps
+// recording at once each get the whole signal instead of taking turns at
+// one read index.
+class MicNoiseGateIOHandler : public aspl::ControlRequestHandler,
+                              public aspl::IORequestHandler
+{
 public:
-    SharedMemoryReader() {
-        fd_ = shm_open(kSharedMemoryName, O_RDWR, 0666);
-        if (fd_ != -1) {
-            buffer_ = static_cast<SharedAudioBuffer*>(
-                mmap(nullptr, SharedAudioBuffer::totalSize(),
-                     PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0)
-            );
-            if (buffer_ == MAP_FAILED) {
-                close(fd_);
-                fd_ = -1;
-                buffer_ = nullptr;
-            }
+    // Serves virtual mic `device` from that device's shared segment
+    //
+    // `device` is held weakly: it owns this handler, which only reports
+    // latency back to it.
+    MicNoiseGateIOHandler(UInt32 device, std::weak_ptr<aspl::Device> owner)
+        : shmReader_(sharedMemoryName(device)), device_(std::move(owner))
+    {
+        for (size_t slot = 0; slot < kMaxClients; slot++) {
+            clients_[slot] = std::make_unique<ClientState>(UInt32(slot));
         }
+        shmReader_.setPollHandler([this](SharedAudioBuffer* shm) { reportLatency(shm); });
     }
 
-    ~SharedMemoryReader() {
-        if (buffer_ && buffer_ != MAP_FAILED) {
-            munmap(buffer_, SharedAudioBuffer::totalSize());
-        }
-        if (fd_ != -1) {
-            close(fd_);
-        }
+    OSStatus OnStartIO() override
+    {
+        // libASPL counts the device's sample time from when IO starts, so
+        // this is (to within microseconds) the host time of sample 0
+        consumer_.setIOStart(HostClock::now());
+        shmReader_.start();
+#if MNG_DRIVER_DENOISE
+        denoiseWorker_.start();
+#endif
+        return kAudioHardwareNoError;
     }
 
-    SharedAudioBuffer* buffer() { return buffer_; }
-
-    bool tryReconnect() {
-        if (buffer_) return true;
-
-        fd_ = shm_open(kSharedMemoryName, O_RDWR, 0666);
-        if (fd_ == -1) return false;
-
-        buffer_ = static_cast<SharedAudioBuffer*>(
-            mmap(nullptr, SharedAudioBuffer::totalSize(),
-                 PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0)
-        );
+    void OnStopIO() override
+    {
+#if MNG_DRIVER_DENOISE
+        denoiseWorker_.stop();
+#endif
+        shmReader_.stop();
+    }
 
-        if (buffer_ == MAP_FAILED) {
-            close(fd_);
-            fd_ = -1;
-            buffer_ = nullptr;
-            return false;
+    // Claim a free slot (not on the IO thread). Clients beyond kMaxClients
+    // are still accepted, but read silence.
+    OSStatus OnAddClient(const std::shared_ptr<aspl::Client>& client) override
+    {
+        for (auto& state : clients_) {
+            UInt32 expected = kNoClient;
+            if (state->clientID.compare_exchange_strong(expected, client->GetClientID(),
+                                                        std::memory_order_release)) {
+                break;
+            }
         }
-
-        return true;
+        return kAudioHardwareNoError;
     }
 
-private:
-    int fd_ = -1;
-    SharedAudioBuffer* buffer_ = nullptr;
-};
+    void OnRemoveClient(const std::shared_ptr<aspl::Client>& client) override
+    {
+        for (auto& state : clients_) {
+            UInt32 expected = client->GetClientID();
+            state->clientID.compare_exchange_strong(expected, kNoClient,
+                                                    std::memory_order_release);
+        }
+    }
 
-// I/O Handler that reads from shared memory
-class MicNoiseGateIOHandler : public aspl::IORequestHandler
-{
-public:
     void OnReadClientInput(const std::shared_ptr<aspl::Client>& client,
         const std::shared_ptr<aspl::Stream>& stream,
         Float64 zeroTimestamp,
@@ -85,46 +124,262 @@ public:
         void* bytes,
         UInt32 bytesCount) override
     {
+        const uint64_t started = HostClock::now();
+
+        // The client's format: any of the supported rates, mono or stereo
+        const AudioStreamBasicDescription format = stream->GetPhysicalFormat();
+        const UInt32 channels = std::clamp<UInt32>(format.mChannelsPerFrame, 1, MaxChannelCount);
+        const UInt32 numFrames = bytesCount / (sizeof(float) * channels);
+
         float* samples = static_cast<float*>(bytes);
-        UInt32 numSamples = bytesCount / sizeof(float) / ChannelCount;
 
-        // Try to reconnect to shared memory if not connected
-        if (!shmReader_.buffer()) {
-            shmReader_.tryReconnect();
+        // With mixing enabled (see CreateDevice) the HAL runs ReadInput once
+        // per client each cycle, with that client's ID, and libASPL passes
+        // the aspl::Client it registered for the ID; that is what lets every
+        // client keep its own cursor. The lookup comes back empty for an ID
+        // libASPL doesn't know (an IO racing the client's removal): silence.
+        if (!client) {
+            std::memset(samples, 0, bytesCount);
+            return;
+        }
+        ClientState* state = findClient(client->GetClientID());
+        if (!state || numFrames > RingConsumer::kMaxIOFrames) {
+            std::memset(samples, 0, bytesCount);
+            if (state) {
+                state->detach();
+            }
+            return;
         }
+        RingConsumer::selectConverter(*state, UInt32(format.mSampleRate));
 
-        SharedAudioBuffer* shm = shmReader_.buffer();
+        // Connection management happens on the watcher thread; here we
+        // only pick up whatever mapping it has published, and the layout
+        // it was mapped with
+        RingLayout layout;
+        SharedAudioBuffer* shm = shmReader_.acquire(layout);
+        const bool valid = shm && shm->isValid(layout);
 
-        // Read from shared memory if available and producer is active
-        if (shm && shm->isActive.load(std::memory_order_acquire)) {
-            if (!shm->read(samples, numSamples)) {
-                // Buffer underrun - output silence
-                std::memset(samples, 0, bytesCount);
-            }
+        // The app is recording a capture trace: tell it what was asked for
+        if (valid && mng_request_log_enabled(shm)) {
+            const MNGReadRequest request = {started, consumer_.ioStart(), timestamp, numFrames,
+                                            UInt32(format.mSampleRate), channels, state->slot};
+            mng_request_log_append(shm, &request);
+        }
+
+        // Read from shared memory if available, valid and producer is active
+        SharedAudioBuffer* source = nullptr;
+        if (valid && shm->active()) {
+            source = selectSource(*state, shm, layout);
+        }
+
+        if (source) {
+            consumer_.read(*state, source, shm, mono_, numFrames, timestamp, format.mSampleRate);
+            RingConsumer::publishSlowestCursor(source, state->layout, clients_,
+                                               [](const ClientState& other) {
+                return other.clientID.load(std::memory_order_relaxed) == other.servingID;
+            });
         } else {
-            // No shared memory or producer not active - output silence
-            std::memset(samples, 0, bytesCount);
+            // No shared memory or producer not active - fade out to silence
+            RingConsumer::conceal(*state, mono_, numFrames);
         }
+
+        fanOut(mono_, samples, numFrames, channels);
+
+        // Telemetry for the app, in the app's segment whichever ring we read
+        if (valid) {
+            recordCycle(shm, source, source ? state->layout.frames : layout.frames, zeroTimestamp,
+                        timestamp, consumer_.clock().nanosecondsIn(HostClock::now() - started));
+        }
+        shmReader_.release();
     }
 
 private:
+    static constexpr UInt32 kNoClient = 0;
+
+    // Clients that can read at the same time, each with its own cursor
+    static constexpr size_t kMaxClients = 8;
+
+    // A slot's reading state plus who it belongs to. Only the IO thread
+    // touches it, apart from clientID.
+    struct ClientState : RingConsumer::Client {
+        explicit ClientState(UInt32 index) : slot(index) {}
+
+        const UInt32 slot;
+
+        // Claimed by OnAddClient, cleared by OnRemoveClient
+        std::atomic<UInt32> clientID{kNoClient};
+
+        // The client this state was last used for; a mismatch means the
+        // slot changed hands and starts over
+        UInt32 servingID = kNoClient;
+    };
+
+    // One IO cycle's client reads, summed for consumerTelemetry. The HAL
+    // reads every client of a cycle with the same timestamps, so a read
+    // with new ones finishes the cycle before it.
+    struct CycleTotal {
+        Float64 zeroTimestamp = -1.0;
+        Float64 timestamp = -1.0;
+        uint64_t nanoseconds = 0;
+        uint64_t fillFrames = 0;
+        uint32_t capacity = 0;
+        bool pending = false;
+    };
+
+    // Add a client read to its cycle, recording the previous cycle once one
+    // starts. The fill is how far the producer is ahead of the read index
+    // published for the slowest client, as of the cycle's last read from
+    // a ring; `capacity` is the size of the ring the read used.
+    void recordCycle(SharedAudioBuffer* shm, const SharedAudioBuffer* source, uint64_t capacity,
+                     Float64 zeroTimestamp, Float64 timestamp, uint64_t nanoseconds)
+    {
+        if (zeroTimestamp != cycle_.zeroTimestamp || timestamp != cycle_.timestamp) {
+            if (cycle_.pending) {
+                mng_telemetry_record(&shm->consumerTelemetry, cycle_.nanoseconds,
+                                     cycle_.fillFrames, cycle_.capacity);
+            }
+            cycle_ = CycleTotal();
+            cycle_.zeroTimestamp = zeroTimestamp;
+            cycle_.timestamp = timestamp;
+            cycle_.pending = true;
+        }
+        cycle_.nanoseconds += nanoseconds;
+        if (source) {
+            cycle_.fillFrames = mng_shm_load_write_index(source) - mng_shm_load_read_index(source);
+        }
+        if (source || cycle_.capacity == 0) {
+            cycle_.capacity = uint32_t(capacity);
+        }
+    }
+
+    // The slot claimed for `clientID`, or nullptr
+    ClientState* findClient(UInt32 clientID)
+    {
+        for (auto& state : clients_) {
+            if (state->clientID.load(std::memory_order_acquire) == clientID) {
+                if (state->servingID != clientID) {
+                    state->reset();
+                    state->servingID = clientID;
+                }
+                return state.get();
+            }
+        }
+        return nullptr;
+    }
+
+    // The ring to play from: the shared one, mapped as `layout`, or in
+    // driver processing mode the worker's ring of denoised audio (nullptr
+    // until it has started), which is ours and laid out once
+    SharedAudioBuffer* selectSource(ClientState& state, SharedAudioBuffer* shm,
+                                    const RingLayout& layout)
+    {
+        SharedAudioBuffer* source = shm;
+        RingLayout sourceLayout = layout;
+#if MNG_DRIVER_DENOISE
+        if (mng_shm_processing_mode(shm) == MNG_PROCESSING_DRIVER) {
+            source = denoiseWorker_.output();
+            sourceLayout = source ? source->layout() : RingLayout();
+        }
+#endif
+        // Built without in-driver denoising, a driver-mode ring is played
+        // as it is: unprocessed audio beats a dead microphone
+
+        RingConsumer::selectSource(state, source, sourceLayout);
+        return source;
+    }
+
+    // Watcher thread: tell the HAL how long ago the audio it reads was
+    // captured, so apps can align echo cancellation with it
+    void reportLatency(SharedAudioBuffer* shm)
+    {
+        auto device = device_.lock();
+        if (!device || !shm->isValid()) {
+            return;
+        }
+
+        const SharedAudioBuffer* source = shm;
+#if MNG_DRIVER_DENOISE
+        if (mng_shm_processing_mode(shm) == MNG_PROCESSING_DRIVER && denoiseWorker_.output()) {
+            source = denoiseWorker_.output();
+        }
+#endif
+        const double ringFrames = double(mng_shm_capture_latency_frames(shm)) +
+                                  double(RingConsumer::timelineTargetFrames(shm, source));
+        const UInt32 latency = UInt32(std::lround(
+            ringFrames * device->GetNominalSampleRate() / double(kSampleRate)));
+
+        if (latency != reportedLatency_) {
+            reportedLatency_ = latency;
+            device->SetLatencyAsync(latency);
+        }
+    }
+
+    // Duplicate the mono signal into each of the client's channels
+    static void fanOut(const float* mono, float* samples, UInt32 frameCount, UInt32 channels)
+    {
+        if (channels == 1) {
+            std::memcpy(samples, mono, frameCount * sizeof(float));
+            return;
+        }
+        for (UInt32 i = 0; i < frameCount; i++) {
+            for (UInt32 ch = 0; ch < channels; ch++) {
+                samples[i * channels + ch] = mono[i];
+            }
+        }
+    }
+
     SharedMemoryReader shmReader_;
+    std::weak_ptr<aspl::Device> device_;
+    UInt32 reportedLatency_ = 0;  // Watcher thread only
+
+    RingConsumer consumer_;
+
+#if MNG_DRIVER_DENOISE
+    DenoiseWorker denoiseWorker_{shmReader_};
+#endif
+    std::unique_ptr<ClientState> clients_[kMaxClients];
+
+    // The block at the client rate, before fanning out
+    float mono_[RingConsumer::kMaxIOFrames] = {};
+
+    // The current IO cycle's reads so far (IO thread only)
+    CycleTotal cycle_;
 };
 
-std::shared_ptr<aspl::Driver> CreateDriver()
+// Number of virtual mics, from MicNoiseGateDeviceCount in the bundle's
+// Info.plist (set at build time with -DMICNOISEGATE_DEVICE_COUNT=N)
+UInt32 ConfiguredDeviceCount()
 {
-    // Create context (shared between all objects)
-    auto context = std::make_shared<aspl::Context>();
+    CFBundleRef bundle = CFBundleGetBundleWithIdentifier(CFSTR("com.micnoisegate.driver"));
+    if (!bundle) {
+        return DefaultDeviceCount;
+    }
+
+    CFTypeRef value = CFBundleGetValueForInfoDictionaryKey(bundle, CFSTR("MicNoiseGateDeviceCount"));
+    SInt32 count = 0;
+    if (!value || CFGetTypeID(value) != CFNumberGetTypeID() ||
+        !CFNumberGetValue(static_cast<CFNumberRef>(value), kCFNumberSInt32Type, &count)) {
+        return DefaultDeviceCount;
+    }
+    return UInt32(std::clamp<SInt32>(count, 1, MNG_MAX_DEVICES));
+}
+
+// One virtual mic with its own stream, IO handler and shared segment
+std::shared_ptr<aspl::Device> CreateDevice(const std::shared_ptr<aspl::Context>& context,
+                                           UInt32 index)
+{
+    // The first device keeps the original name and UID, so apps that
+    // remember it still find it
+    const std::string number = std::to_string(index + 1);
 
-    // Create device with parameters
     aspl::DeviceParameters deviceParams;
-    deviceParams.Name = "MicNoiseGate Mic";
+    deviceParams.Name = index == 0 ? "MicNoiseGate Mic" : "MicNoiseGate Mic " + number;
     deviceParams.Manufacturer = "MicNoiseGate";
-    deviceParams.DeviceUID = "MicNoiseGate_VirtualMic";
+    deviceParams.DeviceUID = index == 0 ? MNG_DEVICE_UID : MNG_DEVICE_UID "_" + number;
     deviceParams.ModelUID = "MicNoiseGate_Model";
     deviceParams.SampleRate = SampleRate;
     deviceParams.ChannelCount = ChannelCount;
-    deviceParams.EnableMixing = false;
+    deviceParams.EnableMixing = true;
     deviceParams.CanBeDefault = true;
     deviceParams.CanBeDefaultForSystemSounds = false;
 
@@ -132,15 +387,43 @@ std::shared_ptr<aspl::Driver> CreateDriver()
 
     // Add input stream with volume and mute controls
     // Direction::Input makes this appear as a microphone
-    device->AddStreamWithControlsAsync(aspl::Direction::Input);
+    aspl::StreamParameters streamParams;
+    streamParams.Direction = aspl::Direction::Input;
+    streamParams.Format = MakeFormat(SampleRate, ChannelCount);
+    auto stream = device->AddStreamWithControlsAsync(streamParams);
 
-    // Set our custom I/O handler
-    auto ioHandler = std::make_shared<MicNoiseGateIOHandler>();
+    // Offer every rate/channel combination the IO handler can serve
+    std::vector<AudioStreamRangedDescription> formats;
+    std::vector<AudioValueRange> sampleRates;
+    for (UInt32 rate : RingConsumer::kSampleRates) {
+        sampleRates.push_back({Float64(rate), Float64(rate)});
+        for (UInt32 channels = 1; channels <= MaxChannelCount; channels++) {
+            formats.push_back({MakeFormat(rate, channels), {Float64(rate), Float64(rate)}});
+        }
+    }
+    device->SetAvailableSampleRatesAsync(sampleRates);
+    stream->SetAvailablePhysicalFormatsAsync(formats);
+
+    // Set our custom I/O and control handler. Each device has its own, so
+    // their IO threads never share state.
+    auto ioHandler = std::make_shared<MicNoiseGateIOHandler>(index, device);
+    device->SetControlHandler(ioHandler);
     device->SetIOHandler(ioHandler);
 
-    // Create plugin (root of object hierarchy)
+    return device;
+}
+
+std::shared_ptr<aspl::Driver> CreateDriver()
+{
+    // Create context (shared between all objects)
+    auto context = std::make_shared<aspl::Context>();
+
+    // Create plugin (root of object hierarchy) with one device per mic
     auto plugin = std::make_shared<aspl::Plugin>(context);
-    plugin->AddDevice(device);
+    const UInt32 deviceCount = ConfiguredDeviceCount();
+    for (UInt32 index = 0; index < deviceCount; index++) {
+        plugin->AddDevice(CreateDevice(context, index));
+    }
 
     // Create driver (top-level entry point)
     auto driver = std::make_shared<aspl::Driver>(context, plugin);
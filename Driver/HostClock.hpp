@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include <mach/mach_time.h>
+
+// mach_absolute_time() conversions
+//
+// The timing anchors in the shared header are in host ticks, which every
+// process on the machine shares, so the app's capture timestamps and the
+// virtual device's sample clock can be compared directly.
+class HostClock {
+public:
+    HostClock() {
+        mach_timebase_info_data_t timebase;
+        mach_timebase_info(&timebase);
+        ticksPerSecond_ = 1e9 * double(timebase.denom) / double(timebase.numer);
+    }
+
+    static uint64_t now() { return mach_absolute_time(); }
+
+    double ticksPerSecond() const { return ticksPerSecond_; }
+
+    // Length of `frames` at `sampleRate`, in ticks
+    double ticksFor(double frames, double sampleRate) const {
+        return frames / sampleRate * ticksPerSecond_;
+    }
+
+    uint64_t nanosecondsIn(uint64_t ticks) const {
+        return uint64_t(double(ticks) * 1e9 / ticksPerSecond_);
+    }
+
+    // Frames at `sampleRate` that fit in `ticks`
+    double framesIn(double ticks, double sampleRate) const {
+        return ticks / ticksPerSecond_ * sampleRate;
+    }
+
+private:
+    double ticksPerSecond_;
+};
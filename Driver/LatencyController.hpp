@@ -0,0 +1,152 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include "SharedMemory.hpp"
+
+// Latency bounds for the ring fill level, in frames at kSampleRate
+constexpr uint32_t kMinTargetLatencyFrames = MNG_MIN_TARGET_LATENCY_FRAMES;  // 10ms
+constexpr uint32_t kMaxTargetLatencyFrames = MNG_MAX_TARGET_LATENCY_FRAMES;  // 20ms
+constexpr uint32_t kDefaultTargetLatencyFrames = MNG_DEFAULT_TARGET_LATENCY_FRAMES;  // 15ms
+
+// Keeps the ring fill level at a target by consuming slightly more or
+// fewer frames than the HAL asks for
+//
+// The mic clock feeding the app and the virtual device clock drift apart,
+// so a plain FIFO either runs dry or slowly fills up. Every IO cycle the
+// controller looks at the fill level and returns a resampling ratio
+// (input frames consumed per output frame) a fraction of a percent away
+// from 1, which pulls the fill level back to the target without audible
+// pitch change.
+class LatencyController {
+public:
+    // Largest ratio deviation from 1.0 (0.5%, well below audible pitch shift)
+    static constexpr double kMaxRatioDeviation = 0.005;
+
+    // Keep at least this much headroom above one HAL buffer, since the app
+    // writes whole 480-frame RNNoise frames at a time
+    static constexpr uint32_t kMinHeadroomFrames = 256;
+
+    void reset() {
+        priming_ = true;
+        smoothedFill_ = 0.0;
+        integral_ = 0.0;
+        ratio_ = 1.0;
+    }
+
+    // Target fill level for this cycle. `requested` comes from the shared
+    // header (0 means use the default) and is clamped to the 10-20ms range.
+    static uint32_t targetFrames(uint32_t requested, uint32_t ioFrames) {
+        uint32_t target = requested != 0 ? requested : kDefaultTargetLatencyFrames;
+        target = std::clamp(target, kMinTargetLatencyFrames, kMaxTargetLatencyFrames);
+        return std::max(target, ioFrames + kMinHeadroomFrames);
+    }
+
+    // Fill level above which we stop correcting gently and drop straight
+    // back to the target (first connect, or the app stalled and caught up)
+    static uint64_t resyncThreshold(uint32_t target) {
+        return uint64_t(target) * 3;
+    }
+
+    // After a reset or an underrun, wait for the ring to reach the target
+    // before playing, so we start in the middle of the window rather than
+    // at its empty edge
+    bool isPriming() const { return priming_; }
+
+    void start(uint64_t fill) {
+        priming_ = false;
+        smoothedFill_ = double(fill);
+        integral_ = 0.0;
+        ratio_ = 1.0;
+    }
+
+    // Update from this cycle's fill level and return the ratio to use
+    double update(uint64_t fill, uint32_t target, uint32_t ioFrames) {
+        const double dt = double(ioFrames) / double(kSampleRate);
+
+        // The app writes in bursts, so the raw fill level is a sawtooth;
+        // steer on its average (time constant ~0.5s)
+        const double alpha = std::min(1.0, dt / kSmoothingSeconds);
+        smoothedFill_ += alpha * (double(fill) - smoothedFill_);
+
+        const double error = (smoothedFill_ - double(target)) / double(target);
+        integral_ = std::clamp(integral_ + error * dt, -kMaxIntegral, kMaxIntegral);
+
+        ratio_ = 1.0 + std::clamp(kProportionalGain * error + kIntegralGain * integral_,
+                                  -kMaxRatioDeviation, kMaxRatioDeviation);
+        return ratio_;
+    }
+
+    double ratio() const { return ratio_; }
+
+private:
+    static constexpr double kSmoothingSeconds = 0.5;
+    static constexpr double kProportionalGain = 0.002;
+    static constexpr double kIntegralGain = 0.0002;
+    static constexpr double kMaxIntegral = kMaxRatioDeviation / kIntegralGain;
+
+    bool priming_ = true;
+    double smoothedFill_ = 0.0;
+    double integral_ = 0.0;
+    double ratio_ = 1.0;
+};
+
+// Linear-interpolating resampler for ratios very close to 1
+//
+// Carries the fractional read position and the last input frame across
+// calls, so consecutive IO buffers join without a discontinuity.
+class DriftResampler {
+public:
+    void reset() {
+        phase_ = 0.0;
+        std::fill(history_, history_ + kChannels, 0.0f);
+    }
+
+    // Input frames needed to produce `outFrames` at `ratio`
+    uint32_t inputFramesFor(uint32_t outFrames, double ratio) const {
+        return static_cast<uint32_t>(phase_ + double(outFrames) * ratio);
+    }
+
+    // Most output frames that `inFrames` input frames can produce at `ratio`
+    uint32_t outputFramesFor(uint32_t inFrames, double ratio) const {
+        // Largest n with floor(phase + n * ratio) <= inFrames
+        const double limit = (double(inFrames) + 1.0 - phase_) / ratio;
+        const double frames = std::ceil(limit) - 1.0;
+        return frames > 0.0 ? static_cast<uint32_t>(frames) : 0;
+    }
+
+    // `in` must hold exactly inputFramesFor(outFrames, ratio) frames
+    void process(const float* in, uint32_t inFrames, float* out, uint32_t outFrames,
+                 double ratio, uint32_t channels) {
+        // Position 0 is the carried history frame, position k is in[k - 1]
+        double position = phase_;
+
+        for (uint32_t i = 0; i < outFrames; i++) {
+            const uint32_t index = static_cast<uint32_t>(position);
+            const float frac = static_cast<float>(position - double(index));
+
+            const float* a = index == 0 ? history_ : in + (index - 1) * channels;
+            // The last output can land a hair past the final input frame
+            // when ratio < 1; holding that frame is within 0.5% of exact
+            const float* b = inFrames == 0 ? history_
+                                           : in + std::min(index, inFrames - 1) * channels;
+
+            for (uint32_t ch = 0; ch < channels; ch++) {
+                out[i * channels + ch] = a[ch] + (b[ch] - a[ch]) * frac;
+            }
+
+            position += ratio;
+        }
+
+        phase_ = position - double(inFrames);
+        if (inFrames > 0) {
+            std::copy(in + (inFrames - 1) * channels, in + inFrames * channels, history_);
+        }
+    }
+
+private:
+    double phase_ = 0.0;
+    float history_[kChannels] = {};
+};
@@ -0,0 +1,332 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "HostClock.hpp"
+#include "LatencyController.hpp"
+#include "PolyphaseResampler.hpp"
+#include "SharedMemory.hpp"
+#include "UnderrunConcealer.hpp"
+
+// Serves the clients of one virtual mic from a ring
+//
+// Everything a client read does once the ring is picked: latency control
+// on the producer's timeline, drift correction, rate conversion and
+// concealment. A Client carries one client's state from cycle to cycle.
+// The driver's IO handler runs this for its HAL clients and the replay
+// harness (Driver/replay) for recorded ones, so a trace replays through
+// the code the driver ships. Reads happen on one thread, one client at a
+// time; nothing allocates after construction.
+class RingConsumer {
+public:
+    // Client rates served. The ring always carries mono at 48kHz; lower
+    // rates are downsampled at read time.
+    static constexpr uint32_t kSampleRates[] = {16000, 24000, 48000};
+
+    // Largest HAL buffer we serve, and the most ring frames one cycle may
+    // use (a 16kHz client needs three per output frame). The drift
+    // resampler may pull slightly more input frames than it outputs.
+    static constexpr uint32_t kMaxIOFrames = 4096;
+    static constexpr uint32_t kMaxRingFramesPerCycle = 3 * kMaxIOFrames;
+    static constexpr uint32_t kScratchFrames =
+        kMaxRingFramesPerCycle + kMaxRingFramesPerCycle / 100 + 2;
+
+    // Everything one client's reads carry from cycle to cycle
+    struct Client {
+        SharedAudioBuffer* source = nullptr;
+        RingLayout layout;      // `source`'s, as whoever mapped it saw it
+        RingCursor cursor;
+        bool attached = false;  // cursor points into `source`
+
+        LatencyController latency;
+        DriftResampler resampler;
+        UnderrunConcealer concealer;
+
+        // One downsampler per lower rate, built up front so a format change
+        // never allocates on the IO thread
+        std::vector<std::pair<uint32_t, std::unique_ptr<PolyphaseResampler>>> converters;
+        PolyphaseResampler* converter = nullptr;
+        uint32_t converterRate = kSampleRate;
+
+        // Lag behind the timeline (or fill level) and drift ratio of the
+        // last read that played from the ring, for monitoring
+        uint64_t lagFrames = 0;
+        double ratio = 1.0;
+
+        Client()
+        {
+            for (uint32_t rate : kSampleRates) {
+                if (rate != kSampleRate) {
+                    converters.push_back({rate, std::make_unique<PolyphaseResampler>(
+                                                    kSampleRate, rate, kMaxRingFramesPerCycle)});
+                }
+            }
+        }
+
+        // Stop reading; the next cycle attaches afresh and primes again
+        void detach()
+        {
+            attached = false;
+            latency.reset();
+            resampler.reset();
+        }
+
+        void reset()
+        {
+            detach();
+            source = nullptr;
+            concealer.reset();
+            converterRate = 0;  // Forces selectConverter to pick again
+        }
+    };
+
+    // HAL sample 0 was at `hostTime` (0 while IO isn't running)
+    void setIOStart(uint64_t hostTime)
+    {
+        ioStartHostTime_.store(hostTime, std::memory_order_relaxed);
+    }
+
+    uint64_t ioStart() const { return ioStartHostTime_.load(std::memory_order_relaxed); }
+
+    const HostClock& clock() const { return clock_; }
+
+    // Read from `source`, laid out as `layout`, from now on; a change
+    // starts the client over
+    static void selectSource(Client& client, SharedAudioBuffer* source, const RingLayout& layout)
+    {
+        if (source != client.source || layout != client.layout) {
+            client.detach();
+            client.source = source;
+            client.layout = layout;
+        }
+    }
+
+    // Pick the downsampler for the client's rate (none at 48kHz); a switch
+    // starts it from clean history
+    static void selectConverter(Client& client, uint32_t sampleRate)
+    {
+        if (sampleRate == client.converterRate) {
+            return;
+        }
+        client.converterRate = sampleRate;
+        client.converter = nullptr;
+        for (auto& [rate, converter] : client.converters) {
+            if (rate == sampleRate) {
+                converter->reset();
+                client.converter = converter.get();
+            }
+        }
+        client.detach();
+    }
+
+    // No ring to read: fade out to silence and prime afresh once there is
+    static void conceal(Client& client, float* samples, uint32_t frameCount)
+    {
+        client.concealer.conceal(samples, frameCount, 1);
+        client.detach();
+        client.source = nullptr;
+    }
+
+    // Fill `frameCount` mono frames at the client rate from `source` while
+    // steering the client's lag to the target latency, indexing it by the
+    // client's layout. Frames the ring can't supply are concealed. Latency settings come from, and
+    // underruns are reported to, the shared header `shm`. Returns the
+    // frames that came from the ring.
+    //
+    // With the producer's timing anchors, the lag is measured on its
+    // timeline: how far the cursor trails the ring frame captured at the
+    // same moment as the block's first sample. That follows the HAL
+    // timestamp rather than when this cycle happens to run or how bursty
+    // the writes are, and lets a client seek straight to where it belongs.
+    // Without anchors we fall back to steering the fill level.
+    uint32_t read(Client& state, SharedAudioBuffer* source, SharedAudioBuffer* shm,
+                  float* samples, uint32_t frameCount, double sampleTime, double sampleRate)
+    {
+        // Ring frames (at 48kHz) that make up this cycle
+        const uint32_t ringFrames = state.converter
+            ? uint32_t(state.converter->inputFramesFor(frameCount)) : frameCount;
+        // Tell the app how large a cycle we serve, so its next ring can hold
+        // it if this one can't
+        mng_shm_note_cycle_frames(shm, ringFrames);
+        if (ringFrames > cycleFrameLimit(state.layout)) {
+            state.concealer.conceal(samples, frameCount, 1);
+            return 0;
+        }
+
+        // A new cursor starts at the newest frame and primes from there
+        if (!state.attached) {
+            source->attach(state.cursor);
+            state.attached = true;
+        }
+
+        int64_t timelinePosition = 0;
+        const bool timed = positionOnTimeline(source, sampleTime, sampleRate, timelinePosition);
+        const uint32_t target = timed
+            ? timelineTargetFrames(shm, source)
+            : LatencyController::targetFrames(mng_shm_target_latency_frames(shm), ringFrames);
+
+        // Lag behind the timeline, or the fill level
+        auto lag = [&] {
+            return timed ? uint64_t(std::max<int64_t>(0, timelinePosition -
+                                                         int64_t(state.cursor.position)))
+                         : source->fillLevel(state.cursor);
+        };
+        uint64_t fill = lag();
+
+        if (timed) {
+            // Seek to the block's frames when starting, or when the cursor
+            // has wandered out of the window (the app stalled, dropped
+            // audio or restarted)
+            if (state.latency.isPriming() || fill == 0 || fill > uint64_t(target) * 2) {
+                source->seek(state.cursor, timelinePosition - int64_t(target));
+                fill = lag();
+                if (fill < target) {
+                    // Those frames haven't reached the ring yet
+                    state.concealer.conceal(samples, frameCount, 1);
+                    state.latency.reset();
+                    return 0;
+                }
+                state.latency.start(fill);
+            }
+        } else {
+            if (state.latency.isPriming()) {
+                if (fill < target) {
+                    state.concealer.conceal(samples, frameCount, 1);
+                    return 0;
+                }
+                state.latency.start(fill);
+            }
+
+            // Far too much buffered (first connect, the app stalled and then
+            // caught up, or this client stopped reading for a while): drop
+            // straight back to the target instead of slowly draining stale
+            // audio. Past staleFrames() the producer may have reused the frames.
+            const uint64_t resync = std::min<uint64_t>(
+                LatencyController::resyncThreshold(target), staleFrames(state.layout));
+            if (fill > resync && fill > target) {
+                source->skip(state.cursor, fill - target);
+                fill = target;
+                state.latency.start(fill);
+            }
+        }
+
+        const double ratio = state.latency.update(fill, target, ringFrames);
+        state.lagFrames = fill;
+        state.ratio = ratio;
+        uint32_t inFrames = state.resampler.inputFramesFor(ringFrames, ratio);
+        uint32_t outFrames = ringFrames;
+
+        const uint64_t available = timed ? source->fillLevel(state.cursor) : fill;
+        if (available < inFrames) {
+            // Underrun - play what we have, conceal the rest and re-prime
+            outFrames = std::min(ringFrames,
+                                 state.resampler.outputFramesFor(uint32_t(available), ratio));
+            inFrames = state.resampler.inputFramesFor(outFrames, ratio);
+            mng_shm_note_underrun(shm);
+            state.latency.reset();
+        }
+
+        uint32_t delivered = 0;
+        if (outFrames > 0) {
+            source->read(state.layout, state.cursor, scratch_, inFrames);
+            if (state.converter) {
+                state.resampler.process(scratch_, inFrames, ring_, outFrames, ratio, kChannels);
+                delivered = uint32_t(state.converter->process(ring_, outFrames, samples, frameCount));
+            } else {
+                state.resampler.process(scratch_, inFrames, samples, outFrames, ratio, kChannels);
+                delivered = outFrames;
+            }
+            state.concealer.deliver(samples, delivered, 1);
+        }
+        if (delivered < frameCount) {
+            state.concealer.conceal(samples + delivered, frameCount - delivered, 1);
+        }
+        return delivered;
+    }
+
+    // The producer sees a single read index: publish the slowest client's,
+    // so a frame stays in the ring until every client reading this source
+    // has had it. A cursor more than staleFrames() behind belongs to a
+    // client that stopped asking for input; it doesn't hold the producer
+    // up, and resyncs if the client comes back. `clients` holds pointers
+    // to Clients (or to something derived from them); only those for which
+    // `serving` holds count. `layout` is the one the clients read `source` by.
+    template <typename Clients, typename Serving>
+    static void publishSlowestCursor(SharedAudioBuffer* source, const RingLayout& layout,
+                                     const Clients& clients, Serving serving)
+    {
+        const uint64_t write = mng_shm_load_write_index(source);
+        const uint64_t stale = staleFrames(layout);
+        const uint64_t oldest = write > stale ? write - stale : 0;
+
+        uint64_t slowest = write;
+        for (const auto& state : clients) {
+            if (state->attached && state->source == source && serving(*state)) {
+                slowest = std::min(slowest, std::max(state->cursor.position, oldest));
+            }
+        }
+        source->publishReadIndex(slowest);
+    }
+
+    // Lag behind the timeline to keep: the newest frame can trail it by
+    // the producer's delay (its callback period plus RNNoise buffering), and
+    // the configured target latency covers scheduling jitter on top. The
+    // size of the HAL buffer cancels out, since a later cycle asks for
+    // frames captured correspondingly later.
+    static uint32_t timelineTargetFrames(const SharedAudioBuffer* shm,
+                                         const SharedAudioBuffer* source)
+    {
+        return mng_shm_producer_delay_frames(source) +
+               LatencyController::targetFrames(mng_shm_target_latency_frames(shm), 0);
+    }
+
+    // Ring frames one cycle may take from a ring laid out as `layout`: half
+    // of it at most, so the producer keeps the other half to write into
+    static uint64_t cycleFrameLimit(const RingLayout& layout)
+    {
+        return std::min<uint64_t>(kMaxRingFramesPerCycle, layout.frames / 2);
+    }
+
+    // How far a cursor may fall behind the producer before its frames can
+    // be overwritten
+    static uint64_t staleFrames(const RingLayout& layout)
+    {
+        return layout.frames - cycleFrameLimit(layout);
+    }
+
+private:
+    // The ring frame of `source` captured at the same moment as HAL sample
+    // `sampleTime`, extrapolated from the producer's latest anchor. False
+    // when there is no anchor to go by.
+    bool positionOnTimeline(const SharedAudioBuffer* source, double sampleTime,
+                            double sampleRate, int64_t& position) const
+    {
+        const uint64_t ioStart = ioStartHostTime_.load(std::memory_order_relaxed);
+        uint64_t anchorSample = 0;
+        uint64_t anchorHost = 0;
+        if (ioStart == 0 || sampleRate <= 0 ||
+            !mng_shm_load_anchor(source, &anchorSample, &anchorHost)) {
+            return false;
+        }
+
+        const double sinceAnchor = double(int64_t(ioStart - anchorHost)) +
+                                   clock_.ticksFor(sampleTime, sampleRate);
+        position = int64_t(anchorSample) +
+                   std::llround(clock_.framesIn(sinceAnchor, kSampleRate));
+        return true;
+    }
+
+    HostClock clock_;
+    std::atomic<uint64_t> ioStartHostTime_{0};
+
+    // Per-cycle working buffers, shared by all clients since they are
+    // served one at a time
+    float scratch_[kScratchFrames * kChannels] = {};     // Raw ring frames
+    float ring_[kMaxRingFramesPerCycle * kChannels] = {}; // After drift correction
+};
@@ -0,0 +1,223 @@
+#pragma once
+
+#include "SharedMemory.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// One mapping of the shared segment
+class SharedMemoryMapping {
+public:
+    // Map the segment, but only once the app has published a header whose
+    // magic, version and sizes match this build and fit the mapping.
+    // Returns nullptr for a missing, mismatched or half-initialized segment.
+    static std::unique_ptr<SharedMemoryMapping> open(const char* name) {
+        int fd = shm_open(name, O_RDWR, 0666);
+        if (fd == -1) return nullptr;
+
+        // The smallest segment any valid header can describe
+        const size_t minimumSize = SharedAudioBuffer::totalSize(MNG_MIN_RING_FRAMES, MNG_SAMPLE_INT16);
+
+        struct stat st;
+        if (fstat(fd, &st) == -1 || static_cast<size_t>(st.st_size) < minimumSize) {
+            close(fd);
+            return nullptr;
+        }
+
+        size_t size = static_cast<size_t>(st.st_size);
+        void* mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+        if (mapped == MAP_FAILED) {
+            close(fd);
+            return nullptr;
+        }
+
+        std::unique_ptr<SharedMemoryMapping> mapping(new SharedMemoryMapping(fd, mapped, size));
+        if (mng_shm_validate(mapping->buffer(), size) != MNGShmStatusValid) {
+            return nullptr;
+        }
+        mapping->layout_ = mapping->buffer()->layout();
+        if (!mapping->isValid()) {
+            return nullptr;  // Rewritten while we looked
+        }
+        return mapping;
+    }
+
+    ~SharedMemoryMapping() {
+        munmap(address_, size_);
+        close(fd_);
+    }
+
+    SharedMemoryMapping(const SharedMemoryMapping&) = delete;
+    SharedMemoryMapping& operator=(const SharedMemoryMapping&) = delete;
+
+    SharedAudioBuffer* buffer() const { return static_cast<SharedAudioBuffer*>(address_); }
+
+    // The ring's layout when it was mapped, which every read of it goes by
+    const RingLayout& layout() const { return layout_; }
+
+    // Still looking at a header we understand, laid out as it was when
+    // mapped? The app invalidates the magic while it re-initializes or
+    // replaces the segment; a layout change means it must be remapped.
+    bool isValid() const {
+        return mng_shm_validate(buffer(), size_) == MNGShmStatusValid &&
+               buffer()->isValid(layout_);
+    }
+
+private:
+    SharedMemoryMapping(int fd, void* address, size_t size)
+        : fd_(fd), address_(address), size_(size) {}
+
+    int fd_;
+    void* address_;
+    size_t size_;
+    RingLayout layout_;
+};
+
+// Shared memory manager for receiving audio from the app
+//
+// shm_open/mmap/munmap are syscalls that may block, so they never run on
+// the IO thread. While IO is running, a watcher thread connects to the
+// segment, notices when the app invalidates or replaces it, and publishes
+// the current mapping through an atomic pointer. Readers only do atomic
+// loads and stores: each announces the mapping it is using in its own
+// hazard slot, and the watcher waits for every slot to move on before
+// unmapping.
+class SharedMemoryReader {
+public:
+    // One hazard slot per thread that reads the segment
+    enum Reader : size_t {
+        kIOThread = 0,
+        kDenoiseWorker,
+        kReaderCount
+    };
+
+    explicit SharedMemoryReader(std::string name = kSharedMemoryName)
+        : name_(std::move(name)) {}
+
+    ~SharedMemoryReader() {
+        stop();
+        current_.store(nullptr);
+        mapping_.reset();
+    }
+
+    SharedMemoryReader(const SharedMemoryReader&) = delete;
+    SharedMemoryReader& operator=(const SharedMemoryReader&) = delete;
+
+    // Called on the watcher thread after every poll that finds a valid
+    // mapping, for housekeeping that must stay off the IO thread. Set it
+    // before start().
+    void setPollHandler(std::function<void(SharedAudioBuffer*)> handler) {
+        pollHandler_ = std::move(handler);
+    }
+
+    // Start watching (not on the IO thread). Makes one connection attempt
+    // right away so IO can start with the segment already mapped.
+    void start() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (watcher_.joinable()) return;
+
+        poll();
+        stopping_ = false;
+        watcher_ = std::thread([this] { run(); });
+    }
+
+    // Stop watching. The current mapping stays published.
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!watcher_.joinable()) return;
+            stopping_ = true;
+        }
+        wakeup_.notify_all();
+        watcher_.join();
+    }
+
+    // Reader thread: the buffer to use this cycle, or nullptr, and in
+    // `layout` the layout it was mapped with. Check the buffer against that
+    // (SharedAudioBuffer::isValid(layout)) and read the ring by it. Must be
+    // paired with release() before the cycle ends.
+    SharedAudioBuffer* acquire(RingLayout& layout, Reader reader = kIOThread) {
+        SharedMemoryMapping* mapping = current_.load();
+        hazards_[reader].store(mapping);
+        // The watcher may have retired it between the two loads; skip this
+        // cycle rather than loop on the IO thread
+        if (!mapping || current_.load() != mapping) {
+            hazards_[reader].store(nullptr);
+            return nullptr;
+        }
+        layout = mapping->layout();
+        return mapping->buffer();
+    }
+
+    void release(Reader reader = kIOThread) {
+        hazards_[reader].store(nullptr);
+    }
+
+private:
+    static constexpr std::chrono::milliseconds kPollInterval{100};
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!stopping_) {
+            wakeup_.wait_for(lock, kPollInterval, [this] { return stopping_; });
+            if (!stopping_) {
+                poll();
+            }
+        }
+    }
+
+    // Drop an invalidated mapping and (re)connect if needed
+    void poll() {
+        if (mapping_ && !mapping_->isValid()) {
+            retire();
+        }
+        if (!mapping_) {
+            mapping_ = SharedMemoryMapping::open(name_.c_str());
+            if (mapping_) {
+                current_.store(mapping_.get());
+            }
+        }
+        if (mapping_ && pollHandler_) {
+            pollHandler_(mapping_->buffer());
+        }
+    }
+
+    // Unpublish the mapping, wait until no reader is still inside a cycle
+    // that uses it, then unmap
+    void retire() {
+        SharedMemoryMapping* old = mapping_.get();
+        current_.store(nullptr);
+        for (auto& hazard : hazards_) {
+            while (hazard.load() == old) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+        mapping_.reset();
+    }
+
+    const std::string name_;
+    std::function<void(SharedAudioBuffer*)> pollHandler_;
+
+    // Published to the reader threads
+    std::atomic<SharedMemoryMapping*> current_{nullptr};
+    std::atomic<SharedMemoryMapping*> hazards_[kReaderCount] = {};
+
+    // Owned by whoever holds mutex_ (the watcher, or start())
+    std::unique_ptr<SharedMemoryMapping> mapping_;
+    std::mutex mutex_;
+    std::condition_variable wakeup_;
+    std::thread watcher_;
+    bool stopping_ = false;
+};
@@ -0,0 +1,230 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+#include "SharedMemory.hpp"
+
+// Hides short gaps in the ring instead of cutting to silence
+//
+// Keeps the last few milliseconds of delivered audio. When the ring runs
+// short, the missing frames are filled by looping one period of it with a
+// gain that ramps down to zero; when real audio comes back it is
+// crossfaded in from that loop. A gap of a few frames therefore costs a
+// few frames of smeared audio rather than a full buffer of silence and a
+// click at each edge.
+//
+// The period is the lag at which the history best matches its own last
+// kMatchFrames, so for voiced speech the loop is about one pitch period
+// and repeats in phase. Whatever step is left where the loop starts, wraps,
+// or takes over from a resume that was cut short is taken out by an offset
+// that decays over kSeamFrames.
+class UnderrunConcealer {
+public:
+    // Shortest and longest loop (1ms and 10ms: pitches down to 100Hz), the
+    // window matched to pick it, the seam correction and each fade (10ms)
+    static constexpr uint32_t kMinPeriodFrames = 48;
+    static constexpr uint32_t kMaxPeriodFrames = 480;
+    static constexpr uint32_t kMatchFrames = 96;
+    static constexpr uint32_t kSeamFrames = 32;
+    static constexpr uint32_t kFadeFrames = 480;
+
+    void reset() {
+        std::fill(history_, history_ + kHistoryFrames * kChannels, 0.0f);
+        historyPos_ = 0;
+        period_ = kMaxPeriodFrames;
+        repeatPos_ = 0;
+        entryPos_ = kSeamFrames;
+        state_ = State::Playing;
+        repeatGain_ = 0.0f;
+        fadeIn_ = 1.0f;
+    }
+
+    bool isConcealing() const { return state_ == State::Concealing; }
+
+    // Concealment has fully faded out to silence
+    bool isSilent() const {
+        return state_ == State::Concealing && repeatGain_ == 0.0f && entryPos_ >= kSeamFrames;
+    }
+
+    // Real audio was delivered in `frames`. Coming out of a gap, crossfade
+    // into it from the loop (a plain fade-in once that has
+    // faded to silence); then remember it as history.
+    void deliver(float* frames, uint32_t frameCount, uint32_t channels) {
+        if (state_ == State::Concealing) {
+            state_ = State::Resuming;
+            fadeIn_ = 0.0f;
+        }
+
+        if (state_ == State::Resuming) {
+            uint32_t i = 0;
+            for (; i < frameCount && fadeIn_ < 1.0f; i++) {
+                const float* repeat = nextRepeatFrame(channels);
+                const float repeatWeight = repeatGain_ * (1.0f - fadeIn_);
+                const float entryWeight = nextEntryWeight() * (1.0f - fadeIn_);
+                for (uint32_t ch = 0; ch < channels; ch++) {
+                    float& sample = frames[i * channels + ch];
+                    sample = sample * fadeIn_ + repeat[ch] * repeatWeight +
+                             entryStep_[ch] * entryWeight;
+                }
+                fadeIn_ = std::min(1.0f, fadeIn_ + kFadeStep);
+            }
+            if (fadeIn_ >= 1.0f) {
+                state_ = State::Playing;
+            }
+        }
+
+        remember(frames, frameCount, channels);
+    }
+
+    // Fill `frameCount` missing frames
+    void conceal(float* frames, uint32_t frameCount, uint32_t channels) {
+        if (state_ != State::Concealing) {
+            // From full playback, loop the newest period; in the middle of
+            // a resume, keep fading the loop out and carry on from the
+            // last output as the real audio in it drops away
+            if (state_ == State::Playing) {
+                startLoop(channels);
+            } else {
+                continueLoop(channels);
+            }
+            state_ = State::Concealing;
+        }
+
+        for (uint32_t i = 0; i < frameCount; i++) {
+            if (repeatGain_ == 0.0f && entryPos_ >= kSeamFrames) {
+                std::fill(frames + i * channels, frames + frameCount * channels, 0.0f);
+                return;
+            }
+            const float* repeat = nextRepeatFrame(channels);
+            const float entryWeight = nextEntryWeight();
+            for (uint32_t ch = 0; ch < channels; ch++) {
+                frames[i * channels + ch] = repeat[ch] * repeatGain_ + entryStep_[ch] * entryWeight;
+            }
+            repeatGain_ = std::max(0.0f, repeatGain_ - kFadeStep);
+        }
+    }
+
+private:
+    static constexpr float kFadeStep = 1.0f / float(kFadeFrames);
+
+    static constexpr uint32_t kHistoryFrames = kMaxPeriodFrames + kMatchFrames;
+
+    // Frame `age` frames back in the history (1 = the newest)
+    const float* historyFrame(uint32_t age, uint32_t channels) const {
+        return history_ + ((historyPos_ + kHistoryFrames - age) % kHistoryFrames) * channels;
+    }
+
+    // The lag whose window best matches the newest kMatchFrames, by
+    // normalized cross-correlation over all channels
+    uint32_t findPeriod(uint32_t channels) const {
+        uint32_t best = kMaxPeriodFrames;
+        float bestScore = 0.0f;
+        for (uint32_t lag = kMinPeriodFrames; lag <= kMaxPeriodFrames; lag++) {
+            float correlation = 0.0f;
+            float energy = 0.0f;
+            for (uint32_t age = 1; age <= kMatchFrames; age++) {
+                const float* recent = historyFrame(age, channels);
+                const float* earlier = historyFrame(age + lag, channels);
+                for (uint32_t ch = 0; ch < channels; ch++) {
+                    correlation += recent[ch] * earlier[ch];
+                    energy += earlier[ch] * earlier[ch];
+                }
+            }
+            // correlation / sqrt(energy), compared squared with its sign
+            if (correlation > 0.0f && energy > 0.0f) {
+                const float score = correlation * correlation / energy;
+                if (score > bestScore) {
+                    bestScore = score;
+                    best = lag;
+                }
+            }
+        }
+        return best;
+    }
+
+    // Copy the newest period into the loop at full gain. The loop's first
+    // frame would naturally follow the one a period before the newest, so
+    // the seam offset is what it takes to continue from the newest instead;
+    // the same offset closes the seam where the loop wraps.
+    void startLoop(uint32_t channels) {
+        period_ = findPeriod(channels);
+        for (uint32_t i = 0; i < period_; i++) {
+            const float* frame = historyFrame(period_ - i, channels);
+            std::copy(frame, frame + channels, loop_ + i * channels);
+        }
+        const float* newest = historyFrame(1, channels);
+        const float* beforeLoop = historyFrame(period_ + 1, channels);
+        for (uint32_t ch = 0; ch < channels; ch++) {
+            seamStep_[ch] = newest[ch] - beforeLoop[ch];
+        }
+        repeatPos_ = 0;
+        repeatGain_ = 1.0f;
+        entryPos_ = kSeamFrames;
+    }
+
+    // Concealing again before a resume finished: the last output was the
+    // real audio faded in plus the loop at what is now its gain, so the
+    // entry offset is the real audio's part, dropped away over kSeamFrames
+    void continueLoop(uint32_t channels) {
+        repeatGain_ *= 1.0f - fadeIn_;
+        const float* last = historyFrame(1, channels);
+        for (uint32_t ch = 0; ch < channels; ch++) {
+            entryStep_[ch] = last[ch] - repeatFrame_[ch] * repeatGain_;
+        }
+        entryPos_ = 0;
+    }
+
+    float nextEntryWeight() {
+        if (entryPos_ >= kSeamFrames) {
+            return 0.0f;
+        }
+        return 1.0f - float(entryPos_++) / float(kSeamFrames);
+    }
+
+    const float* nextRepeatFrame(uint32_t channels) {
+        const float* frame = loop_ + repeatPos_ * channels;
+        const float seam = repeatPos_ < kSeamFrames
+                               ? 1.0f - float(repeatPos_) / float(kSeamFrames)
+                               : 0.0f;
+        for (uint32_t ch = 0; ch < channels; ch++) {
+            repeatFrame_[ch] = frame[ch] + seamStep_[ch] * seam;
+        }
+        repeatPos_ = (repeatPos_ + 1) % period_;
+        return repeatFrame_;
+    }
+
+    void remember(const float* frames, uint32_t frameCount, uint32_t channels) {
+        // Only the last kHistoryFrames matter
+        uint32_t start = frameCount > kHistoryFrames ? frameCount - kHistoryFrames : 0;
+        for (uint32_t i = start; i < frameCount; i++) {
+            std::copy(frames + i * channels, frames + (i + 1) * channels,
+                      history_ + historyPos_ * channels);
+            historyPos_ = (historyPos_ + 1) % kHistoryFrames;
+        }
+    }
+
+    enum class State {
+        Playing,
+        Concealing,
+        Resuming,
+    };
+
+    float history_[kHistoryFrames * kChannels] = {};
+    uint32_t historyPos_ = 0;   // Next history slot to write (= oldest frame)
+
+    // The period being looped, its offset at the seam and the next frame
+    float loop_[kMaxPeriodFrames * kChannels] = {};
+    float seamStep_[kChannels] = {};
+    float repeatFrame_[kChannels] = {};
+    uint32_t period_ = kMaxPeriodFrames;
+    uint32_t repeatPos_ = 0;
+
+    // Offset from the last output when concealing cuts a resume short
+    float entryStep_[kChannels] = {};
+    uint32_t entryPos_ = kSeamFrames;
+
+    State state_ = State::Playing;
+    float repeatGain_ = 0.0f;   // Weight of the loop
+    float fadeIn_ = 1.0f;       // Weight of real audio while resuming
+};
@@ -0,0 +1,253 @@
+// Hot-path benchmarks for the ring buffer and the DSP engine
+//
+// Build with -DMICNOISEGATE_BENCH=ON and run ./micnoisegate_bench. Besides
+// the time per iteration every benchmark reports:
+//
+//   per_frame   CPU time per audio frame moved or processed
+//   per_second  CPU time per second of that audio, i.e. the share of the
+//               real-time budget: 10ms per second (10ms/s) is 1%
+//
+// Ring benchmarks run over the HAL buffer sizes the driver sees (32 to
+// 4096 frames) in both wire formats: range(1) is the ring's sampleFormat,
+// 0 for Float32 and 1 for Int16. The cross-process one forks a consumer
+// over a real shm_open segment, so it includes the cache-line traffic
+// between the two sides; it reports wall time, as the cost sits on both
+// processes.
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <rnnoise.h>
+
+#include "SharedMemory.hpp"
+#include "SpectralGate.hpp"
+#include "mng_dsp.h"
+
+namespace {
+
+const std::vector<int64_t> kBlocks = benchmark::CreateRange(32, 4096, 2);
+const std::vector<int64_t> kFormats = {MNG_SAMPLE_FLOAT32, MNG_SAMPLE_INT16};
+
+// Attach the per-frame counters for `frames` frames of `sampleRate` audio
+// handled per iteration
+void countFrames(benchmark::State& state, double frames, double sampleRate = kSampleRate) {
+    using benchmark::Counter;
+    const auto flags = Counter::Flags(Counter::kIsIterationInvariantRate | Counter::kInvert);
+    state.counters["per_frame"] = Counter(frames, flags);
+    state.counters["per_second"] = Counter(frames / sampleRate, flags);
+    state.SetItemsProcessed(state.iterations() * int64_t(frames));
+}
+
+// A test tone, so the DSP paths see realistic data
+std::vector<float> tone(size_t count, double sampleRate) {
+    std::vector<float> samples(count);
+    for (size_t i = 0; i < count; ++i) {
+        samples[i] = 0.25f * float(std::sin(2.0 * M_PI * 440.0 * double(i) / sampleRate));
+    }
+    return samples;
+}
+
+// A ring in private memory, laid out like the shared segment
+class PrivateRing {
+public:
+    explicit PrivateRing(uint32_t format) {
+        memory_ = std::aligned_alloc(kCacheLineSize,
+                                     SharedAudioBuffer::totalSize(kDefaultRingFrames, format));
+        mng_shm_initialize(ring(), kDefaultRingFrames, format);
+        mng_shm_set_active(ring(), 1);
+    }
+
+    ~PrivateRing() { std::free(memory_); }
+
+    SharedAudioBuffer* ring() { return static_cast<SharedAudioBuffer*>(memory_); }
+
+private:
+    void* memory_;
+};
+
+// MARK: - Ring buffer
+
+void BM_RingWrite(benchmark::State& state) {
+    PrivateRing storage(uint32_t(state.range(1)));
+    SharedAudioBuffer* ring = storage.ring();
+    const auto frames = uint64_t(state.range(0));
+    std::vector<float> block = tone(frames, kSampleRate);
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(ring->writeMono(block.data(), frames));
+        // Free the space again without running the consumer's code
+        mng_shm_store_read_index(ring, ring->writeIndex);
+    }
+    countFrames(state, double(frames));
+}
+BENCHMARK(BM_RingWrite)->ArgsProduct({kBlocks, kFormats});
+
+void BM_RingRead(benchmark::State& state) {
+    PrivateRing storage(uint32_t(state.range(1)));
+    SharedAudioBuffer* ring = storage.ring();
+    const auto frames = uint64_t(state.range(0));
+    std::vector<float> block(frames);
+
+    RingCursor cursor;
+    ring->attach(cursor);
+    for (auto _ : state) {
+        // Make the next frames readable without running the producer's code
+        mng_shm_store_write_index(ring, cursor.position + frames);
+        benchmark::DoNotOptimize(ring->read(cursor, block.data(), frames));
+        ring->publishReadIndex(cursor.position);
+        benchmark::ClobberMemory();
+    }
+    countFrames(state, double(frames));
+}
+BENCHMARK(BM_RingRead)->ArgsProduct({kBlocks, kFormats});
+
+// MARK: - Cross-process throughput
+
+// Producer here, consumer in a forked child, over a fresh shm_open
+// segment; each iteration moves one second of audio in blocks of range(0)
+void BM_RingAcrossProcesses(benchmark::State& state) {
+    const std::string name = "/micnoisegate_bench_" + std::to_string(getpid());
+    const auto format = uint32_t(state.range(1));
+    const size_t size = SharedAudioBuffer::totalSize(kDefaultRingFrames, format);
+
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0600);
+    if (fd < 0 || ftruncate(fd, off_t(size)) != 0) {
+        state.SkipWithError("shm_open failed");
+        return;
+    }
+    void* address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    shm_unlink(name.c_str());
+    if (address == MAP_FAILED) {
+        state.SkipWithError("mmap failed");
+        return;
+    }
+    auto* ring = static_cast<SharedAudioBuffer*>(address);
+    mng_shm_initialize(ring, kDefaultRingFrames, format);
+    mng_shm_set_active(ring, 1);
+
+    const auto frames = uint64_t(state.range(0));
+    pid_t consumer = fork();
+    if (consumer == 0) {
+        // Drain in the same block size until the producer deactivates
+        std::vector<float> block(frames);
+        while (ring->active()) {
+            if (ring->read(block.data(), frames) == 0) {
+                std::this_thread::yield();
+            }
+        }
+        _exit(0);
+    }
+
+    std::vector<float> block = tone(frames, kSampleRate);
+    const uint64_t perIteration = kSampleRate / frames * frames;
+    for (auto _ : state) {
+        for (uint64_t written = 0; written < perIteration; written += frames) {
+            while (!ring->writeMono(block.data(), frames)) {
+                std::this_thread::yield();
+            }
+        }
+        while (mng_shm_load_read_index(ring) != ring->writeIndex) {
+            std::this_thread::yield();
+        }
+    }
+
+    mng_shm_set_active(ring, 0);
+    waitpid(consumer, nullptr, 0);
+    munmap(address, size);
+    countFrames(state, double(perIteration));
+}
+BENCHMARK(BM_RingAcrossProcesses)
+    ->ArgsProduct({kBlocks, kFormats})
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+
+// MARK: - DSP
+
+// One 10ms RNNoise frame, as the denoiser calls it (int16 scale)
+void BM_RNNoiseFrame(benchmark::State& state) {
+    constexpr size_t kFrameSize = 480;
+    DenoiseState* denoiser = rnnoise_create(nullptr);
+    std::vector<float> input = tone(kFrameSize, kSampleRate);
+    for (float& sample : input) {
+        sample *= 32767.0f;
+    }
+    std::vector<float> output(kFrameSize);
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(rnnoise_process_frame(denoiser, output.data(), input.data()));
+        benchmark::ClobberMemory();
+    }
+    rnnoise_destroy(denoiser);
+    countFrames(state, double(kFrameSize));
+}
+BENCHMARK(BM_RNNoiseFrame);
+
+// The same frame through the spectral gate, RNNoise's cheap fallback
+void BM_SpectralGateFrame(benchmark::State& state) {
+    SpectralGate gate;
+    std::vector<float> input = tone(SpectralGate::kFrameSize, kSampleRate);
+    for (float& sample : input) {
+        sample *= 32767.0f;
+    }
+    std::vector<float> frame(SpectralGate::kFrameSize);
+
+    for (auto _ : state) {
+        std::copy(input.begin(), input.end(), frame.begin());
+        benchmark::DoNotOptimize(gate.processFrame(frame.data()));
+        benchmark::ClobberMemory();
+    }
+    countFrames(state, double(SpectralGate::kFrameSize));
+}
+BENCHMARK(BM_SpectralGateFrame);
+
+// The whole app-side denoiser: resampling, frame FIFO and RNNoise, fed
+// 512-frame callbacks at range(0) Hz
+void BM_Denoiser(benchmark::State& state) {
+    constexpr uint32_t kCallbackFrames = 512;
+    const double rate = double(state.range(0));
+    MNGDenoiser* denoiser = mng_denoiser_create(rate, kCallbackFrames);
+    std::vector<float> input = tone(kCallbackFrames, rate);
+    std::vector<float> output(mng_denoiser_max_output_frames(denoiser));
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(mng_denoiser_process(denoiser, input.data(), kCallbackFrames,
+                                                      output.data(), uint32_t(output.size())));
+    }
+    mng_denoiser_destroy(denoiser);
+    countFrames(state, kCallbackFrames, rate);
+}
+BENCHMARK(BM_Denoiser)->Arg(16000)->Arg(44100)->Arg(48000);
+
+// Conversion of range(0)-frame blocks to 48kHz from range(1) Hz
+void BM_Resampler(benchmark::State& state) {
+    const auto frames = uint32_t(state.range(0));
+    const double rate = double(state.range(1));
+    MNGResampler* resampler = mng_resampler_create(rate, double(kSampleRate), frames);
+    std::vector<float> input = tone(frames, rate);
+    std::vector<float> output(mng_resampler_max_output_frames(resampler, frames));
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(mng_resampler_process(resampler, input.data(), frames,
+                                                       output.data(), uint32_t(output.size())));
+    }
+    mng_resampler_destroy(resampler);
+    countFrames(state, frames, rate);
+}
+BENCHMARK(BM_Resampler)->ArgsProduct({{32, 512, 4096}, {16000, 44100, 96000}});
+
+}  // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <AudioToolbox/ExtendedAudioFile.h>
+#include <CoreFoundation/CoreFoundation.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Chunked reader for any file ExtAudioFile can decode (WAV, CAF, FLAC,
+// AIFF, M4A, ...)
+//
+// Decodes to float at the file's own rate and mixes every channel down to
+// mono, the format the denoiser takes. Only one chunk is held at a time, so
+// memory doesn't grow with the file. Each worker opens its own reader: an
+// ExtAudioFile isn't safe to share between threads.
+class AudioFileReader {
+public:
+    // Largest read, in frames
+    static constexpr uint32_t kChunkFrames = 4096;
+
+    AudioFileReader() = default;
+    AudioFileReader(const AudioFileReader&) = delete;
+    AudioFileReader& operator=(const AudioFileReader&) = delete;
+
+    ~AudioFileReader() {
+        if (file_) {
+            ExtAudioFileDispose(file_);
+        }
+    }
+
+    bool open(const std::string& path) {
+        CFURLRef url = CFURLCreateFromFileSystemRepresentation(
+            kCFAllocatorDefault, reinterpret_cast<const UInt8*>(path.c_str()),
+            CFIndex(path.size()), false);
+        if (!url) {
+            return false;
+        }
+        OSStatus status = ExtAudioFileOpenURL(url, &file_);
+        CFRelease(url);
+        if (status != noErr) {
+            file_ = nullptr;
+            return false;
+        }
+
+        AudioStreamBasicDescription fileFormat = {};
+        UInt32 size = sizeof(fileFormat);
+        SInt64 length = 0;
+        UInt32 lengthSize = sizeof(length);
+        if (ExtAudioFileGetProperty(file_, kExtAudioFileProperty_FileDataFormat,
+                                    &size, &fileFormat) != noErr ||
+            ExtAudioFileGetProperty(file_, kExtAudioFileProperty_FileLengthFrames,
+                                    &lengthSize, &length) != noErr ||
+            fileFormat.mSampleRate <= 0 || fileFormat.mChannelsPerFrame == 0) {
+            return false;
+        }
+
+        // Interleaved float at the file's rate; the mixdown is ours, as the
+        // converter's own channel mapping would drop channels
+        AudioStreamBasicDescription client = {};
+        client.mSampleRate = fileFormat.mSampleRate;
+        client.mFormatID = kAudioFormatLinearPCM;
+        client.mFormatFlags = kAudioFormatFlagIsFloat | kAudioFormatFlagIsPacked;
+        client.mChannelsPerFrame = fileFormat.mChannelsPerFrame;
+        client.mBitsPerChannel = 32;
+        client.mBytesPerFrame = 4 * client.mChannelsPerFrame;
+        client.mFramesPerPacket = 1;
+        client.mBytesPerPacket = client.mBytesPerFrame;
+        if (ExtAudioFileSetProperty(file_, kExtAudioFileProperty_ClientDataFormat,
+                                    sizeof(client), &client) != noErr) {
+            return false;
+        }
+
+        sampleRate_ = fileFormat.mSampleRate;
+        length_ = length;
+        channels_ = fileFormat.mChannelsPerFrame;
+        interleaved_.resize(size_t(kChunkFrames) * channels_);
+        return true;
+    }
+
+    double sampleRate() const { return sampleRate_; }
+
+    bool failed() const { return failed_; }
+
+    // Length in frames at sampleRate()
+    int64_t length() const { return length_; }
+
+    bool seek(int64_t frame) {
+        return ExtAudioFileSeek(file_, frame) == noErr;
+    }
+
+    // Read up to `maxFrames` (at most kChunkFrames) mono frames. Returns
+    // the number read: 0 at the end of the file or on a decode error, which
+    // failed() tells apart.
+    uint32_t read(float* mono, uint32_t maxFrames) {
+        UInt32 frames = maxFrames < kChunkFrames ? maxFrames : kChunkFrames;
+
+        AudioBufferList buffers;
+        buffers.mNumberBuffers = 1;
+        buffers.mBuffers[0].mNumberChannels = channels_;
+        buffers.mBuffers[0].mDataByteSize = UInt32(frames * channels_ * sizeof(float));
+        buffers.mBuffers[0].mData = interleaved_.data();
+        if (ExtAudioFileRead(file_, &frames, &buffers) != noErr) {
+            failed_ = true;
+            return 0;
+        }
+
+        const float scale = 1.0f / float(channels_);
+        for (UInt32 i = 0; i < frames; ++i) {
+            float sum = 0.0f;
+            for (uint32_t ch = 0; ch < channels_; ++ch) {
+                sum += interleaved_[size_t(i) * channels_ + ch];
+            }
+            mono[i] = sum * scale;
+        }
+        return frames;
+    }
+
+private:
+    ExtAudioFileRef file_ = nullptr;
+    double sampleRate_ = 0.0;
+    int64_t length_ = 0;
+    uint32_t channels_ = 0;
+    bool failed_ = false;
+    std::vector<float> interleaved_;
+};
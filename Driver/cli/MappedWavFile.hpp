@@ -0,0 +1,156 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Mono 32-bit float WAV output written through memory mappings
+//
+// The file is created at its final size up front, so workers can fill
+// disjoint stretches of it in any order and from any thread. Each one goes
+// through a Window that maps a few megabytes at a time and moves on, so
+// memory stays flat however long the file is; the kernel writes the dirty
+// pages back.
+class MappedWavFile {
+public:
+    static constexpr size_t kHeaderBytes = 44;
+
+    // WAV sizes are 32-bit, which at 48kHz allows about six hours
+    static constexpr uint64_t kMaxFrames = (UINT32_MAX - kHeaderBytes) / sizeof(float);
+
+    MappedWavFile() = default;
+    MappedWavFile(const MappedWavFile&) = delete;
+    MappedWavFile& operator=(const MappedWavFile&) = delete;
+
+    ~MappedWavFile() {
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+    }
+
+    // Create (or replace) `path` holding `frames` frames of silence
+    bool create(const std::string& path, uint64_t frames, uint32_t sampleRate) {
+        if (frames > kMaxFrames) {
+            return false;
+        }
+        fd_ = open(path.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0644);
+        if (fd_ < 0) {
+            return false;
+        }
+        frames_ = frames;
+
+        const uint32_t dataBytes = uint32_t(frames * sizeof(float));
+        uint8_t header[kHeaderBytes];
+        uint8_t* p = header;
+        // Little-endian fields
+        auto tag = [&](const char* text) {
+            std::memcpy(p, text, 4);
+            p += 4;
+        };
+        auto u32 = [&](uint32_t value) {
+            for (int i = 0; i < 4; ++i) {
+                *p++ = uint8_t(value >> (8 * i));
+            }
+        };
+        auto u16 = [&](uint16_t value) {
+            *p++ = uint8_t(value);
+            *p++ = uint8_t(value >> 8);
+        };
+
+        tag("RIFF");
+        u32(uint32_t(kHeaderBytes - 8) + dataBytes);
+        tag("WAVE");
+        tag("fmt ");
+        u32(16);
+        u16(3);  // WAVE_FORMAT_IEEE_FLOAT
+        u16(1);
+        u32(sampleRate);
+        u32(sampleRate * uint32_t(sizeof(float)));
+        u16(uint16_t(sizeof(float)));
+        u16(32);
+        tag("data");
+        u32(dataBytes);
+
+        return pwrite(fd_, header, kHeaderBytes, 0) == ssize_t(kHeaderBytes) &&
+               ftruncate(fd_, off_t(kHeaderBytes + dataBytes)) == 0;
+    }
+
+    uint64_t frames() const { return frames_; }
+
+    // One writer's view of the file. Not thread safe itself; give each
+    // worker its own.
+    class Window {
+    public:
+        explicit Window(MappedWavFile& file) : file_(file) {}
+        Window(const Window&) = delete;
+        Window& operator=(const Window&) = delete;
+
+        ~Window() { unmap(); }
+
+        // Copy `count` frames to frame `position`, clipped to the file
+        bool write(uint64_t position, const float* samples, uint64_t count) {
+            if (position >= file_.frames_) {
+                return true;
+            }
+            count = std::min(count, file_.frames_ - position);
+
+            uint64_t offset = kHeaderBytes + position * sizeof(float);
+            const uint64_t end = offset + count * sizeof(float);
+            const auto* bytes = reinterpret_cast<const uint8_t*>(samples);
+            while (offset < end) {
+                if (offset < start_ || offset >= start_ + length_) {
+                    if (!map(offset)) {
+                        return false;
+                    }
+                }
+                const uint64_t run = std::min(end, start_ + length_) - offset;
+                std::memcpy(static_cast<uint8_t*>(address_) + (offset - start_), bytes, run);
+                bytes += run;
+                offset += run;
+            }
+            return true;
+        }
+
+    private:
+        static constexpr uint64_t kWindowBytes = 4 << 20;
+
+        // Map the window holding byte `offset`
+        bool map(uint64_t offset) {
+            unmap();
+            const uint64_t page = uint64_t(getpagesize());
+            const uint64_t fileBytes = kHeaderBytes + file_.frames_ * sizeof(float);
+            start_ = offset / page * page;
+            length_ = std::min(kWindowBytes, fileBytes - start_);
+            address_ = mmap(nullptr, length_, PROT_READ | PROT_WRITE, MAP_SHARED,
+                            file_.fd_, off_t(start_));
+            if (address_ == MAP_FAILED) {
+                address_ = nullptr;
+                length_ = 0;
+                return false;
+            }
+            return true;
+        }
+
+        void unmap() {
+            if (address_) {
+                munmap(address_, length_);
+                address_ = nullptr;
+                length_ = 0;
+            }
+        }
+
+        MappedWavFile& file_;
+        void* address_ = nullptr;
+        uint64_t start_ = 0;
+        uint64_t length_ = 0;
+    };
+
+private:
+    int fd_ = -1;
+    uint64_t frames_ = 0;
+};
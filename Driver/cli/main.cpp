@@ -0,0 +1,279 @@
+// micnoisegate-cli: denoise recorded audio with the app's RNNoise pipeline
+//
+//   micnoisegate-cli [-j threads] [-o directory] [-s seconds] file...
+//
+// Every input (anything ExtAudioFile decodes: WAV, CAF, FLAC, ...) becomes
+// <name>.denoised.wav next to it or in the -o directory: mono, 48kHz,
+// 32-bit float, through the same Denoiser the live path uses.
+//
+// To keep every core busy on one long file as well as on many short ones,
+// files are cut into segments of -s seconds (60 by default) and a pool of
+// -j workers (one per core by default) takes segments from all files in
+// turn. RNNoise is recurrent, so a segment's worker starts one second
+// early on a fresh state and throws that warm-up output away; by the
+// segment's first frame the state matches an uninterrupted run closely
+// enough that the joins don't show. Segment edges fall on frames that map
+// exactly onto 48kHz frames, so the pieces line up sample for sample.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "AudioFileReader.hpp"
+#include "MappedWavFile.hpp"
+#include "mng_dsp.h"
+
+namespace {
+
+constexpr uint32_t kOutputRate = 48000;
+constexpr double kWarmupSeconds = 1.0;
+
+// Silence fed after the end of a file to flush what the denoiser holds
+// back; far more than it ever holds
+constexpr uint32_t kFlushFrames = 2 * AudioFileReader::kChunkFrames;
+
+struct InputFile {
+    std::string path;
+    std::string outputPath;
+    double sampleRate = 0.0;
+    int64_t length = 0;
+    int64_t warmupFrames = 0;
+    MappedWavFile output;
+    std::atomic<size_t> segmentsLeft{0};
+    std::atomic<bool> failed{false};
+
+    // Output frame at input frame `frame`; exact on segment edges
+    uint64_t outputFrame(int64_t frame) const {
+        return uint64_t(std::llround(double(frame) * kOutputRate / sampleRate));
+    }
+};
+
+struct Segment {
+    InputFile* file;
+    int64_t start;
+    int64_t end;
+};
+
+std::mutex printLock;
+
+template <typename... Args>
+void report(const char* format, Args... args) {
+    std::lock_guard<std::mutex> lock(printLock);
+    std::fprintf(stderr, format, args...);
+}
+
+// Input frames between segment edges: the smallest run that is a whole
+// number of frames at 48kHz too (147 at 44.1kHz, 1 at 16kHz)
+int64_t edgeStep(double sampleRate) {
+    const auto rate = int64_t(std::llround(sampleRate));
+    if (std::abs(sampleRate - double(rate)) > 1e-6) {
+        return 1;  // Fractional rate: edges round to the nearest frame
+    }
+    return rate / std::gcd(rate, int64_t(kOutputRate));
+}
+
+int64_t roundToStep(double frames, int64_t step) {
+    return std::max<int64_t>(1, std::llround(frames / double(step))) * step;
+}
+
+// Runs segments one after another on one thread, keeping its denoiser
+// (and RNNoise state) between them
+class SegmentWorker {
+public:
+    SegmentWorker() : input_(AudioFileReader::kChunkFrames) {}
+
+    ~SegmentWorker() { mng_denoiser_destroy(denoiser_); }
+
+    bool run(const Segment& segment) {
+        InputFile& file = *segment.file;
+        if (!prepare(file.sampleRate)) {
+            return false;
+        }
+
+        AudioFileReader reader;
+        const int64_t warmup = std::min(segment.start, file.warmupFrames);
+        if (!reader.open(file.path) || !reader.seek(segment.start - warmup)) {
+            return false;
+        }
+
+        const bool last = segment.end >= file.length;
+        uint64_t position = file.outputFrame(segment.start);
+        const uint64_t end = last ? file.output.frames() : file.outputFrame(segment.end);
+        uint64_t discard = position - file.outputFrame(segment.start - warmup);
+
+        MappedWavFile::Window window(file.output);
+        uint32_t flushed = 0;
+        while (position < end) {
+            uint32_t count = reader.read(input_.data(), AudioFileReader::kChunkFrames);
+            if (count == 0) {
+                if (reader.failed() || flushed >= kFlushFrames) {
+                    return !reader.failed();
+                }
+                count = AudioFileReader::kChunkFrames;
+                std::fill(input_.begin(), input_.end(), 0.0f);
+                flushed += count;
+            }
+
+            uint32_t produced = mng_denoiser_process(denoiser_, input_.data(), count,
+                                                     output_.data(), uint32_t(output_.size()));
+            const float* samples = output_.data();
+            const auto dropped = uint32_t(std::min<uint64_t>(discard, produced));
+            discard -= dropped;
+            samples += dropped;
+            produced -= dropped;
+
+            const uint64_t kept = std::min<uint64_t>(produced, end - position);
+            if (!window.write(position, samples, kept)) {
+                return false;
+            }
+            position += kept;
+        }
+        return true;
+    }
+
+private:
+    // A fresh denoiser state for `sampleRate`, reusing the last one when
+    // the rate hasn't changed
+    bool prepare(double sampleRate) {
+        if (denoiser_ && sampleRate == sampleRate_) {
+            mng_denoiser_reset(denoiser_);
+            return true;
+        }
+        mng_denoiser_destroy(denoiser_);
+        denoiser_ = mng_denoiser_create(sampleRate, AudioFileReader::kChunkFrames);
+        if (!denoiser_) {
+            return false;
+        }
+        sampleRate_ = sampleRate;
+        output_.resize(mng_denoiser_max_output_frames(denoiser_));
+        return true;
+    }
+
+    MNGDenoiser* denoiser_ = nullptr;
+    double sampleRate_ = 0.0;
+    std::vector<float> input_;
+    std::vector<float> output_;
+};
+
+void usage() {
+    std::fprintf(stderr,
+                 "usage: micnoisegate-cli [-j threads] [-o directory] [-s seconds] file...\n"
+                 "  -j  worker threads (default: one per core)\n"
+                 "  -o  directory for the .denoised.wav outputs (default: next to each input)\n"
+                 "  -s  segment length in seconds that workers split files into (default: 60)\n");
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    std::string outputDirectory;
+    double segmentSeconds = 60.0;
+    std::vector<std::string> paths;
+
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (arg == "-j" && hasValue) {
+            threads = unsigned(std::max(1, std::atoi(argv[++i])));
+        } else if (arg == "-o" && hasValue) {
+            outputDirectory = argv[++i];
+        } else if (arg == "-s" && hasValue) {
+            segmentSeconds = std::atof(argv[++i]);
+        } else if (arg == "-h" || arg == "--help" || arg[0] == '-') {
+            usage();
+            return 2;
+        } else {
+            paths.push_back(arg);
+        }
+    }
+    if (paths.empty() || segmentSeconds < 2.0 * kWarmupSeconds) {
+        usage();
+        return 2;
+    }
+
+    // Open every input once to size its output and plan its segments
+    std::vector<std::unique_ptr<InputFile>> files;
+    std::vector<Segment> segments;
+    double totalSeconds = 0.0;
+    bool failed = false;
+    for (const std::string& path : paths) {
+        auto file = std::make_unique<InputFile>();
+        file->path = path;
+
+        AudioFileReader reader;
+        if (!reader.open(path)) {
+            report("%s: cannot read audio\n", path.c_str());
+            failed = true;
+            continue;
+        }
+        file->sampleRate = reader.sampleRate();
+        file->length = reader.length();
+
+        namespace fs = std::filesystem;
+        fs::path output = fs::path(path).replace_extension(".denoised.wav");
+        if (!outputDirectory.empty()) {
+            output = fs::path(outputDirectory) / output.filename();
+        }
+        file->outputPath = output.string();
+        if (!file->output.create(file->outputPath, file->outputFrame(file->length), kOutputRate)) {
+            report("%s: cannot create %s\n", path.c_str(), file->outputPath.c_str());
+            failed = true;
+            continue;
+        }
+
+        const int64_t step = edgeStep(file->sampleRate);
+        const int64_t segmentFrames = roundToStep(segmentSeconds * file->sampleRate, step);
+        file->warmupFrames = roundToStep(kWarmupSeconds * file->sampleRate, step);
+        for (int64_t start = 0; start < file->length; start += segmentFrames) {
+            segments.push_back({file.get(), start, std::min(start + segmentFrames, file->length)});
+            file->segmentsLeft++;
+        }
+        totalSeconds += double(file->length) / file->sampleRate;
+        files.push_back(std::move(file));
+    }
+
+    const auto started = std::chrono::steady_clock::now();
+    std::atomic<size_t> next{0};
+    std::vector<std::thread> pool;
+    for (unsigned t = 0; t < std::min<size_t>(threads, segments.size()); ++t) {
+        pool.emplace_back([&] {
+            SegmentWorker worker;
+            for (size_t i = next++; i < segments.size(); i = next++) {
+                InputFile& file = *segments[i].file;
+                if (!worker.run(segments[i])) {
+                    file.failed = true;
+                }
+                if (--file.segmentsLeft == 0) {
+                    if (file.failed) {
+                        report("%s: processing failed\n", file.path.c_str());
+                    } else {
+                        report("%s -> %s\n", file.path.c_str(), file.outputPath.c_str());
+                    }
+                }
+            }
+        });
+    }
+    for (std::thread& thread : pool) {
+        thread.join();
+    }
+    const double elapsed =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+    for (const auto& file : files) {
+        failed = failed || file->failed;
+    }
+    report("%.1fs of audio in %.2fs on %u threads (%.0fx real time)\n", totalSeconds, elapsed,
+           threads, elapsed > 0.0 ? totalSeconds / elapsed : 0.0);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,592 @@
+// micnoisegate-replay: replay a capture trace through the ring and the
+// driver's read path
+//
+//   micnoisegate-replay [-w us] [-j us] [-s seed] [-u underruns] [-l ms] trace.mngtrace
+//
+// A trace (recorded with the app's CaptureTrace default, see
+// MicNoiseGateDSP/TraceRecorder.hpp) holds every buffer the microphone
+// delivered and every read the driver served, with their host times. The
+// replay runs them on a virtual clock, as fast as the machine allows: the
+// app's processing thread turns each buffer into ring writes the way
+// ProcessingWorker does, and the reads go through the driver's own
+// RingConsumer (and, in driver processing mode, an in-line copy of its
+// DenoiseWorker pass). The same trace and options always give the same
+// output, so a change to the ring, the latency controller or the
+// resamplers shows up as a different output hash or different numbers.
+//
+// The processing thread picks up a buffer -w microseconds after its
+// callback ended (300 by default), plus up to -j microseconds of jitter
+// drawn from a generator seeded with -s. A full ring holds it up until a
+// read makes room or a callback period passes, as in the app. The
+// automatic suppressor measures its own cost, so it replays as RNNoise.
+//
+// Exits 1 when the replay has more underruns than -u, or its 99th
+// percentile lag is over -l milliseconds; 2 when the trace can't be read.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <memory>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "RingConsumer.hpp"
+#include "TraceFormat.hpp"
+#include "mng_dsp.h"
+
+namespace {
+
+constexpr uint64_t kNever = std::numeric_limits<uint64_t>::max();
+
+struct Input {
+    uint64_t hostTime;
+    std::vector<float> samples;
+};
+
+struct Trace {
+    TraceFileHeader header;
+    std::vector<Input> inputs;
+    std::vector<MNGReadRequest> reads;
+    uint64_t lostInputs = 0;
+    uint64_t lostReads = 0;
+};
+
+// Load `path`, with host times converted from the recording machine's
+// ticks to ours
+bool loadTrace(const char* path, const HostClock& clock, Trace& trace) {
+    FILE* file = std::fopen(path, "rb");
+    if (!file) {
+        std::fprintf(stderr, "%s: cannot open\n", path);
+        return false;
+    }
+    std::unique_ptr<FILE, int (*)(FILE*)> closer(file, std::fclose);
+
+    if (std::fread(&trace.header, sizeof(trace.header), 1, file) != 1 ||
+        trace.header.magic != TraceFileHeader::kMagic ||
+        trace.header.version != TraceFileHeader::kVersion || trace.header.timebaseDenom == 0) {
+        std::fprintf(stderr, "%s: not a version %u capture trace\n", path,
+                     TraceFileHeader::kVersion);
+        return false;
+    }
+    const double recordedTicksPerSecond =
+        1e9 * double(trace.header.timebaseDenom) / double(trace.header.timebaseNumer);
+    const double scale = clock.ticksPerSecond() / recordedTicksPerSecond;
+    auto convert = [scale](uint64_t ticks) { return uint64_t(std::llround(double(ticks) * scale)); };
+
+    TraceRecord record;
+    while (std::fread(&record, sizeof(record), 1, file) == 1) {
+        bool complete = true;
+        switch (record.type) {
+        case TraceRecordType::Input: {
+            TraceInput input;
+            complete = record.size >= sizeof(input) &&
+                       std::fread(&input, sizeof(input), 1, file) == 1 &&
+                       record.size == sizeof(input) + input.frameCount * sizeof(float);
+            if (complete) {
+                Input& entry = trace.inputs.emplace_back();
+                entry.hostTime = input.hostTime ? convert(input.hostTime) : 0;
+                entry.samples.resize(input.frameCount);
+                complete = std::fread(entry.samples.data(), sizeof(float), input.frameCount,
+                                      file) == input.frameCount;
+                if (!complete) {
+                    trace.inputs.pop_back();
+                }
+            }
+            break;
+        }
+        case TraceRecordType::Read: {
+            MNGReadRequest request;
+            complete = record.size == sizeof(request) &&
+                       std::fread(&request, sizeof(request), 1, file) == 1;
+            if (complete) {
+                request.hostTime = convert(request.hostTime);
+                request.ioStartHostTime =
+                    request.ioStartHostTime ? convert(request.ioStartHostTime) : 0;
+                trace.reads.push_back(request);
+            }
+            break;
+        }
+        case TraceRecordType::Lost: {
+            TraceLost lost;
+            complete = record.size == sizeof(lost) && std::fread(&lost, sizeof(lost), 1, file) == 1;
+            if (complete) {
+                (lost.type == TraceRecordType::Input ? trace.lostInputs : trace.lostReads) +=
+                    lost.count;
+            }
+            break;
+        }
+        default:
+            // A newer recorder's record: skip it
+            complete = std::fseek(file, long(record.size), SEEK_CUR) == 0;
+            break;
+        }
+        if (!complete) {
+            // The app was killed mid-write: replay what made it to disk
+            std::fprintf(stderr, "%s: truncated, replaying what is complete\n", path);
+            break;
+        }
+    }
+    return true;
+}
+
+// A ring laid out like the app's shared segment, on the heap
+struct Ring {
+    Ring(uint32_t frames, uint32_t sampleFormat)
+        : buffer(static_cast<SharedAudioBuffer*>(std::aligned_alloc(
+              kCacheLineSize, SharedAudioBuffer::totalSize(frames, sampleFormat)))) {
+        if (buffer) {
+            mng_shm_initialize(buffer, frames, sampleFormat);
+        }
+    }
+
+    ~Ring() { std::free(buffer); }
+
+    SharedAudioBuffer* buffer;
+};
+
+// The app's processing thread (ProcessingWorker in CapturePipeline.swift)
+// on the virtual clock: processes each input buffer and writes it to the
+// ring, waiting for room the way the app does
+class Producer {
+public:
+    Producer(const MNGTraceConfig& config, SharedAudioBuffer* ring, const HostClock& clock)
+        : ring_(ring),
+          clock_(clock),
+          config_(config),
+          denoises_(config.processingMode == MNG_PROCESSING_APP) {
+        if (denoises_) {
+            denoiser_ = mng_denoiser_create(config.inputRate, config.maxInputFrames);
+            mng_denoiser_set_power_saving(denoiser_, int(config.powerSaving));
+            mng_denoiser_set_suppressor(denoiser_, config.suppressor == MNG_SUPPRESSOR_AUTOMATIC
+                                                       ? MNG_SUPPRESSOR_RNNOISE
+                                                       : config.suppressor);
+            output_.resize(mng_denoiser_max_output_frames(denoiser_));
+        } else if (std::abs(config.inputRate - double(kSampleRate)) > 1.0) {
+            resampler_ = mng_resampler_create(config.inputRate, kSampleRate, config.maxInputFrames);
+            output_.resize(mng_resampler_max_output_frames(resampler_, config.maxInputFrames));
+        }
+
+        const bool aligned = config.alignedFrames > 0 && config.inputRate == double(kSampleRate) &&
+                             config.alignedFrames <= config.maxInputFrames;
+        alignment_ = aligned ? config.alignedFrames : 0;
+        // The device's IO period, as the worker takes it
+        const uint32_t bufferFrames =
+            config.ioBufferFrames > 0 ? std::min(config.ioBufferFrames, config.maxInputFrames)
+                                      : config.maxInputFrames;
+        const double periodFrames = double(aligned ? alignment_ : bufferFrames);
+        periodTicks_ = uint64_t(clock_.ticksFor(periodFrames, config.inputRate));
+        callbackFrames_ = periodFrames * double(kSampleRate) / config.inputRate;
+    }
+
+    ~Producer() {
+        mng_denoiser_destroy(denoiser_);
+        mng_resampler_destroy(resampler_);
+    }
+
+    Producer(const Producer&) = delete;
+    Producer& operator=(const Producer&) = delete;
+
+    bool ready() const { return denoiser_ || resampler_ || !denoises_; }
+
+    // Virtual time of the next thing the thread does on its own: give up
+    // waiting for room, or nothing
+    uint64_t deadline() const { return blocked_ ? blockedUntil_ : kNever; }
+
+    // When a buffer due at `time` gets processed: then, or never while a
+    // write waits for room
+    uint64_t freeAt(uint64_t time) const { return blocked_ ? kNever : time; }
+
+    // Process one buffer, captured from `hostTime` (0 if unknown), at
+    // `now`. Like the app's input callback, drops buffers larger than the
+    // unit's maximum.
+    void process(const float* samples, uint32_t frameCount, uint64_t hostTime, uint64_t now) {
+        if (frameCount <= config_.maxInputFrames) {
+            processBlock(samples, frameCount, hostTime, now);
+        }
+    }
+
+    // The driver has consumed: a blocked write goes through if it fits now
+    void consumed() {
+        if (blocked_ && ring_->availableToWrite(pending_.size()) >= pending_.size()) {
+            writePending();
+        }
+    }
+
+    // Waited a whole period: write anyway, counting an overrun if it fails
+    void timeout() {
+        if (blocked_) {
+            writePending();
+        }
+    }
+
+private:
+    void processBlock(const float* samples, uint32_t count, uint64_t hostTime, uint64_t now) {
+        const uint32_t heldBack = denoiser_ ? mng_denoiser_pending_frames(denoiser_) : 0;
+        const auto heldBackTicks = uint64_t(clock_.ticksFor(heldBack, kSampleRate));
+        const uint64_t startTime = hostTime > heldBackTicks ? hostTime - heldBackTicks : 0;
+
+        const bool holdsBack = denoises_ && (alignment_ == 0 || heldBack > 0);
+        mng_shm_set_producer_delay_frames(
+            ring_, uint32_t(std::ceil(callbackFrames_)) + (holdsBack ? 480 : 0));
+
+        const float* processed = samples;
+        uint32_t produced = count;
+        if (denoiser_) {
+            produced = mng_denoiser_process(denoiser_, samples, count, output_.data(),
+                                            uint32_t(output_.size()));
+            processed = output_.data();
+        } else if (resampler_) {
+            produced = mng_resampler_process(resampler_, samples, count, output_.data(),
+                                             uint32_t(output_.size()));
+            processed = output_.data();
+        }
+        if (produced == 0) {
+            return;
+        }
+
+        pending_.assign(processed, processed + produced);
+        pendingStart_ = startTime;
+        if (ring_->availableToWrite(produced) >= produced) {
+            writePending();
+        } else {
+            blocked_ = true;
+            blockedUntil_ = now + periodTicks_;
+        }
+    }
+
+    void writePending() {
+        const uint64_t start = mng_shm_load_write_index(ring_);
+        if (mng_ring_write_mono(ring_, pending_.data(), uint32_t(pending_.size())) &&
+            pendingStart_ != 0) {
+            mng_shm_store_anchor(ring_, start, pendingStart_);
+        }
+        blocked_ = false;
+    }
+
+    SharedAudioBuffer* ring_;
+    const HostClock& clock_;
+    const MNGTraceConfig config_;
+    const bool denoises_;
+
+    MNGDenoiser* denoiser_ = nullptr;
+    MNGResampler* resampler_ = nullptr;
+    std::vector<float> output_;
+
+    uint32_t alignment_ = 0;
+    double callbackFrames_ = 0.0;
+    uint64_t periodTicks_ = 0;
+
+    // A block waiting for room in the ring
+    std::vector<float> pending_;
+    uint64_t pendingStart_ = 0;
+    bool blocked_ = false;
+    uint64_t blockedUntil_ = 0;
+};
+
+// The driver's DenoiseWorker pass (DenoiseWorker.hpp) in driver processing
+// mode, run every kPassTicks of virtual time instead of on its own thread
+class DriverDenoiser {
+public:
+    static constexpr double kPassSeconds = 0.002;
+
+    DriverDenoiser()
+        : output_(MNG_MAX_RING_FRAMES, MNG_SAMPLE_FLOAT32),
+          denoiser_(mng_denoiser_create(kSampleRate, kFrameSize)) {}
+
+    ~DriverDenoiser() { mng_denoiser_destroy(denoiser_); }
+
+    DriverDenoiser(const DriverDenoiser&) = delete;
+    DriverDenoiser& operator=(const DriverDenoiser&) = delete;
+
+    bool ready() const { return output_.buffer && denoiser_; }
+
+    SharedAudioBuffer* output() { return output_.buffer; }
+
+    void pass(SharedAudioBuffer* shm) {
+        SharedAudioBuffer* output = output_.buffer;
+        mng_shm_set_target_latency_frames(output, mng_shm_target_latency_frames(shm));
+
+        while (shm->availableToRead(kFrameSize) >= kFrameSize) {
+            shm->read(raw_, kFrameSize);
+            const uint32_t produced =
+                mng_denoiser_process(denoiser_, raw_, kFrameSize, processed_, kFrameSize);
+            if (produced > 0 && !output->writeMono(processed_, produced)) {
+                mng_shm_note_overrun(output);
+            }
+        }
+
+        uint64_t anchorSample = 0;
+        uint64_t anchorHost = 0;
+        if (!mng_shm_load_anchor(shm, &anchorSample, &anchorHost)) {
+            return;
+        }
+        const uint64_t consumed =
+            mng_shm_load_read_index(shm) - mng_denoiser_pending_frames(denoiser_);
+        const uint64_t offset = consumed - mng_shm_load_write_index(output);
+        mng_shm_store_anchor(output, anchorSample - offset, anchorHost);
+
+        const auto passFrames = uint32_t(kSampleRate * kPassSeconds);
+        mng_shm_set_producer_delay_frames(
+            output, mng_shm_producer_delay_frames(shm) + kFrameSize + passFrames);
+    }
+
+private:
+    static constexpr uint32_t kFrameSize = 480;
+
+    Ring output_;
+    MNGDenoiser* denoiser_;
+    float raw_[kFrameSize] = {};
+    float processed_[kFrameSize] = {};
+};
+
+struct Stats {
+    uint64_t reads = 0;
+    uint64_t framesRequested = 0;
+    uint64_t framesConcealed = 0;
+    std::vector<double> lagMs;
+    double minRatio = 1.0;
+    double maxRatio = 1.0;
+    uint64_t hash = 0xcbf29ce484222325ull;  // FNV-1a over every delivered sample
+
+    void hashSamples(const float* samples, uint32_t count) {
+        const auto* bytes = reinterpret_cast<const unsigned char*>(samples);
+        for (size_t i = 0; i < size_t(count) * sizeof(float); ++i) {
+            hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+        }
+    }
+
+    double percentile(double p) {
+        if (lagMs.empty()) {
+            return 0.0;
+        }
+        const auto index = size_t(std::ceil(p * double(lagMs.size()))) - 1;
+        std::nth_element(lagMs.begin(), lagMs.begin() + index, lagMs.end());
+        return lagMs[index];
+    }
+};
+
+void usage() {
+    std::fprintf(stderr,
+                 "usage: micnoisegate-replay [-w us] [-j us] [-s seed] [-u underruns] [-l ms] "
+                 "trace.mngtrace\n"
+                 "  -w  processing thread wake-up after each input callback (default: 300)\n"
+                 "  -j  random extra wake-up delay, up to this (default: 0)\n"
+                 "  -s  seed for the jitter (default: 1)\n"
+                 "  -u  fail if there are more underruns than this\n"
+                 "  -l  fail if the 99th percentile lag is over this many milliseconds\n");
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    double wakeMicroseconds = 300.0;
+    double jitterMicroseconds = 0.0;
+    uint64_t seed = 1;
+    long long maxUnderruns = -1;
+    double maxLatencyMs = -1.0;
+    const char* path = nullptr;
+
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (arg == "-w" && hasValue) {
+            wakeMicroseconds = std::max(0.0, std::atof(argv[++i]));
+        } else if (arg == "-j" && hasValue) {
+            jitterMicroseconds = std::max(0.0, std::atof(argv[++i]));
+        } else if (arg == "-s" && hasValue) {
+            seed = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "-u" && hasValue) {
+            maxUnderruns = std::atoll(argv[++i]);
+        } else if (arg == "-l" && hasValue) {
+            maxLatencyMs = std::atof(argv[++i]);
+        } else if (arg[0] == '-' || path) {
+            usage();
+            return 2;
+        } else {
+            path = argv[i];
+        }
+    }
+    if (!path) {
+        usage();
+        return 2;
+    }
+
+    RingConsumer consumer;
+    const HostClock& clock = consumer.clock();
+    Trace trace;
+    if (!loadTrace(path, clock, trace)) {
+        return 2;
+    }
+    const MNGTraceConfig& config = trace.header.config;
+    if (config.inputRate <= 0.0 || config.maxInputFrames == 0 ||
+        !mng_shm_valid_capacity(config.ringFrames) ||
+        mng_shm_sample_bytes(config.sampleFormat) == 0) {
+        std::fprintf(stderr, "%s: bad pipeline configuration\n", path);
+        return 2;
+    }
+    if (trace.inputs.empty() || trace.reads.empty()) {
+        std::fprintf(stderr, "%s: nothing to replay\n", path);
+        return 2;
+    }
+
+    // The virtual mic's segment as the app laid it out
+    Ring shm(config.ringFrames, config.sampleFormat);
+    if (!shm.buffer) {
+        std::fprintf(stderr, "cannot allocate the ring\n");
+        return 2;
+    }
+    mng_shm_set_processing_mode(shm.buffer, config.processingMode);
+    mng_shm_set_target_latency_frames(shm.buffer, config.targetLatencyFrames);
+    mng_shm_set_capture_latency_frames(shm.buffer, config.captureLatencyFrames);
+    mng_shm_set_active(shm.buffer, 1);
+
+    Producer producer(config, shm.buffer, clock);
+    const bool driverMode = config.processingMode == MNG_PROCESSING_DRIVER;
+    std::unique_ptr<DriverDenoiser> driverDenoiser;
+    if (driverMode) {
+        driverDenoiser = std::make_unique<DriverDenoiser>();
+    }
+    if (!producer.ready() || (driverDenoiser && !driverDenoiser->ready())) {
+        std::fprintf(stderr, "cannot set up the pipeline\n");
+        return 2;
+    }
+    SharedAudioBuffer* source = driverMode ? driverDenoiser->output() : shm.buffer;
+
+    // When the processing thread gets to each input: after its callback,
+    // which runs once the buffer is complete, plus the wake-up. Inputs
+    // without a host time follow on from the one before.
+    std::mt19937_64 random(seed);
+    std::uniform_real_distribution<double> jitter(0.0, jitterMicroseconds);
+    std::vector<uint64_t> processAt(trace.inputs.size());
+    uint64_t captured = trace.inputs.front().hostTime ? trace.inputs.front().hostTime
+                                                      : trace.reads.front().hostTime;
+    for (size_t i = 0; i < trace.inputs.size(); ++i) {
+        const Input& input = trace.inputs[i];
+        if (input.hostTime != 0) {
+            captured = input.hostTime;
+        }
+        captured += uint64_t(clock.ticksFor(double(input.samples.size()), config.inputRate));
+        const double wake = wakeMicroseconds + (jitterMicroseconds > 0.0 ? jitter(random) : 0.0);
+        processAt[i] = captured + uint64_t(clock.ticksFor(wake, 1e6));
+    }
+
+    std::vector<std::unique_ptr<RingConsumer::Client>> clients;
+    std::vector<float> block(RingConsumer::kMaxIOFrames);
+    Stats stats;
+
+    const auto passTicks = uint64_t(clock.ticksFor(DriverDenoiser::kPassSeconds, 1.0));
+    uint64_t nextPass = driverMode ? std::min(processAt.front(), trace.reads.front().hostTime)
+                                   : kNever;
+
+    const auto started = std::chrono::steady_clock::now();
+    size_t nextInput = 0;
+    size_t nextRead = 0;
+    uint64_t now = 0;
+    while (nextRead < trace.reads.size()) {
+        // Virtual time only moves forward: an input that came due while
+        // the producer was blocked is processed as soon as it is free
+        const uint64_t inputTime = nextInput < trace.inputs.size()
+            ? producer.freeAt(std::max(processAt[nextInput], now)) : kNever;
+        const uint64_t readTime = trace.reads[nextRead].hostTime;
+        const uint64_t producerTime = producer.deadline();
+
+        // Writes land before a read at the same moment
+        now = std::min({inputTime, readTime, producerTime, nextPass});
+        if (now == producerTime) {
+            producer.timeout();
+        } else if (now == inputTime) {
+            const Input& input = trace.inputs[nextInput++];
+            producer.process(input.samples.data(), uint32_t(input.samples.size()), input.hostTime,
+                             now);
+        } else if (now == nextPass) {
+            driverDenoiser->pass(shm.buffer);
+            nextPass += passTicks;
+        } else {
+            const MNGReadRequest& request = trace.reads[nextRead++];
+            const uint32_t frameCount = std::min(request.frameCount, RingConsumer::kMaxIOFrames);
+            while (clients.size() <= request.client) {
+                clients.push_back(std::make_unique<RingConsumer::Client>());
+            }
+            RingConsumer::Client& client = *clients[request.client];
+
+            RingConsumer::selectConverter(client, request.sampleRate);
+            RingConsumer::selectSource(client, source, source->layout());
+            consumer.setIOStart(request.ioStartHostTime);
+            const uint32_t delivered = consumer.read(client, source, shm.buffer, block.data(),
+                                                     frameCount, request.sampleTime,
+                                                     double(request.sampleRate));
+            RingConsumer::publishSlowestCursor(source, client.layout, clients,
+                                               [](const RingConsumer::Client&) { return true; });
+
+            stats.reads++;
+            stats.framesRequested += frameCount;
+            stats.framesConcealed += frameCount - std::min(delivered, frameCount);
+            stats.hashSamples(block.data(), frameCount);
+            if (delivered > 0) {
+                stats.lagMs.push_back(double(client.lagFrames) * 1000.0 / kSampleRate);
+                stats.minRatio = std::min(stats.minRatio, client.ratio);
+                stats.maxRatio = std::max(stats.maxRatio, client.ratio);
+            }
+            producer.consumed();
+        }
+    }
+    const double elapsed =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    const double seconds =
+        double(trace.reads.back().hostTime - trace.reads.front().hostTime) / clock.ticksPerSecond();
+
+    const uint64_t underruns = mng_shm_underrun_count(shm.buffer);
+    const uint64_t overruns = mng_shm_overrun_count(shm.buffer) +
+                              (driverMode ? mng_shm_overrun_count(source) : 0);
+    const double p99 = stats.percentile(0.99);
+    double meanLag = 0.0;
+    for (double lag : stats.lagMs) {
+        meanLag += lag / double(stats.lagMs.size());
+    }
+    const auto [minLag, maxLag] = stats.lagMs.empty()
+        ? std::pair<double, double>(0.0, 0.0)
+        : std::pair<double, double>(*std::min_element(stats.lagMs.begin(), stats.lagMs.end()),
+                                    *std::max_element(stats.lagMs.begin(), stats.lagMs.end()));
+
+    std::printf("trace       %s (%.0f Hz input, %s mode, %u-frame %s ring)\n", path,
+                config.inputRate, driverMode ? "driver" : "app", config.ringFrames,
+                config.sampleFormat == MNG_SAMPLE_INT16 ? "int16" : "float32");
+    if (config.suppressor == MNG_SUPPRESSOR_AUTOMATIC && !driverMode) {
+        std::printf("suppressor  automatic, replayed as rnnoise\n");
+    }
+    if (trace.lostInputs > 0 || trace.lostReads > 0) {
+        std::printf("lost        %llu inputs, %llu reads while recording\n",
+                    (unsigned long long)trace.lostInputs, (unsigned long long)trace.lostReads);
+    }
+    std::printf("inputs      %zu\n", trace.inputs.size());
+    std::printf("reads       %llu by %zu clients, %llu of %llu frames concealed\n",
+                (unsigned long long)stats.reads, clients.size(),
+                (unsigned long long)stats.framesConcealed,
+                (unsigned long long)stats.framesRequested);
+    std::printf("underruns   %llu\n", (unsigned long long)underruns);
+    std::printf("overruns    %llu\n", (unsigned long long)overruns);
+    std::printf("lag         min %.2f  mean %.2f  p99 %.2f  max %.2f ms\n", minLag, meanLag, p99,
+                maxLag);
+    std::printf("drift       %+.0f to %+.0f ppm\n", (stats.minRatio - 1.0) * 1e6,
+                (stats.maxRatio - 1.0) * 1e6);
+    std::printf("output      %016llx\n", (unsigned long long)stats.hash);
+    std::printf("replayed    %.1fs in %.2fs (%.0fx real time)\n", seconds, elapsed,
+                elapsed > 0.0 ? seconds / elapsed : 0.0);
+
+    bool failed = false;
+    if (maxUnderruns >= 0 && underruns > uint64_t(maxUnderruns)) {
+        std::fprintf(stderr, "FAIL: %llu underruns, at most %lld allowed\n",
+                     (unsigned long long)underruns, maxUnderruns);
+        failed = true;
+    }
+    if (maxLatencyMs >= 0.0 && p99 > maxLatencyMs) {
+        std::fprintf(stderr, "FAIL: p99 lag %.2f ms, at most %.2f ms allowed\n", p99, maxLatencyMs);
+        failed = true;
+    }
+    return failed ? 1 : 0;
+}
@@ -43,7 +43,7 @@ fi
 
 # Clean up shared memory
 echo "Cleaning up shared memory..."
-rm -f "/dev/shm$SHM_NAME" 2>/dev/null || true
+rm -f "/dev/shm$SHM_NAME" "/dev/shm${SHM_NAME}"_* 2>/dev/null || true
 
 # Restart coreaudiod to unload driver
 echo "Restarting coreaudiod..."
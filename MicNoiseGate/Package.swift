@@ -23,14 +23,25 @@ let package = Package(
             path: "Sources/SharedMemoryBridge",
             publicHeadersPath: "."
         ),
+        // C++ DSP engine, also built by Driver/CMakeLists.txt
+        .target(
+            name: "MicNoiseGateDSP",
+            dependencies: ["CRNNoise", "SharedMemoryBridge"],
+            path: "Sources/MicNoiseGateDSP",
+            cxxSettings: [
+                .headerSearchPath("../RNNoise/include"),
+                .unsafeFlags(["-O3", "-Xarch_x86_64", "-mavx2", "-Xarch_x86_64", "-mfma"])
+            ]
+        ),
         .executableTarget(
             name: "MicNoiseGate",
-            dependencies: ["CRNNoise", "SharedMemoryBridge"],
+            dependencies: ["CRNNoise", "SharedMemoryBridge", "MicNoiseGateDSP"],
             path: "Sources",
-            exclude: ["RNNoise", "SharedMemoryBridge"],
+            exclude: ["RNNoise", "SharedMemoryBridge", "MicNoiseGateDSP"],
             linkerSettings: [
                 .unsafeFlags(["-L/Users/xaero/.local/lib", "-lrnnoise"])
             ]
         )
-    ]
+    ],
+    cxxLanguageStandard: .cxx17
 )
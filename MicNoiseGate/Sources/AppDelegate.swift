@@ -23,6 +23,7 @@ class AppDelegate: NSObject, NSApplicationDelegate {
         popover = NSPopover()
         popover.contentSize = NSSize(width: 320, height: 480)
         popover.behavior = .transient
+        popover.delegate = self
         popover.contentViewController = NSHostingController(rootView: ContentView(audioManager: audioManager))
 
         // Observe noise suppression state changes to update icon
@@ -81,6 +82,17 @@ class AppDelegate: NSObject, NSApplicationDelegate {
     }
 }
 
+// Meters are only measured while someone can see them
+extension AppDelegate: NSPopoverDelegate {
+    func popoverDidShow(_ notification: Notification) {
+        audioManager.isMeterVisible = true
+    }
+
+    func popoverDidClose(_ notification: Notification) {
+        audioManager.isMeterVisible = false
+    }
+}
+
 struct ContentView: View {
     @ObservedObject var audioManager: AudioManager
     @State private var showUninstallConfirm = false
@@ -155,6 +167,27 @@ struct ContentView: View {
                 }
             }
 
+            // Sources for the driver's other virtual mics, if it has any
+            ForEach(audioManager.additionalSourceIDs.indices, id: \.self) { index in
+                HStack {
+                    Text("MicNoiseGate Mic \(index + 2)")
+                        .font(.caption)
+                        .foregroundColor(.secondary)
+
+                    Spacer()
+
+                    Picker("", selection: $audioManager.additionalSourceIDs[index]) {
+                        Text("None").tag(nil as AudioDeviceID?)
+                        ForEach(audioManager.inputDevices) { device in
+                            Text(device.name).tag(device.id as AudioDeviceID?)
+                        }
+                    }
+                    .pickerStyle(.menu)
+                    .labelsHidden()
+                    .frame(width: 180)
+                }
+            }
+
             Divider()
 
             // Waveform Visualizers
@@ -165,27 +198,10 @@ struct ContentView: View {
                         .foregroundColor(.secondary)
                         .frame(maxWidth: .infinity, alignment: .leading)
 
-                    WaveformView(
-                        samples: audioManager.inputWaveform,
-                        color: .orange,
-                        label: "Input (Raw)",
-                        level: audioManager.inputLevel
-                    )
-
-                    WaveformView(
-                        samples: audioManager.outputWaveform,
-                        color: .green,
-                        label: "Output (Processed)",
-                        level: audioManager.outputLevel
-                    )
-
-                    Divider()
-
-                    // Level Meters
-                    LevelMeterView(
-                        inputLevel: audioManager.inputLevel,
-                        outputLevel: audioManager.outputLevel
-                    )
+                    MeterPanel(meters: audioManager.meters,
+                               isVisible: audioManager.isMeterVisible)
+
+                    TelemetryView(monitor: audioManager.telemetry)
                 }
                 .padding(.vertical, 4)
             } else {
@@ -278,3 +294,42 @@ struct ContentView: View {
         }
     }
 }
+
+// Cycle times and glitch counts of the first virtual mic, folded away
+// unless someone is chasing a glitch
+struct TelemetryView: View {
+    @ObservedObject var monitor: TelemetryMonitor
+
+    var body: some View {
+        DisclosureGroup("Diagnostics") {
+            if let ring = monitor.latest {
+                VStack(alignment: .leading, spacing: 2) {
+                    row("Capture", ring.capture)
+                    row("Processing", ring.producer)
+                    row("Driver", ring.consumer)
+                    Text("Underruns \(ring.underruns)  Overruns \(ring.overruns)")
+                        .foregroundColor(ring.underruns + ring.overruns > 0 ? .orange : .secondary)
+                }
+                .font(.caption2.monospacedDigit())
+                .frame(maxWidth: .infinity, alignment: .leading)
+            } else {
+                Text("No shared memory")
+                    .font(.caption2)
+                    .foregroundColor(.secondary)
+            }
+        }
+        .font(.caption)
+    }
+
+    private func row(_ stage: String, _ stats: CycleStats) -> some View {
+        HStack {
+            Text(stage)
+                .frame(width: 70, alignment: .leading)
+            Text(String(format: "%.2f / %.2f / %.2f ms", stats.meanMs, stats.p99Ms, stats.maxMs))
+                .help("Mean, 99th percentile and longest cycle")
+            Spacer()
+            Text(String(format: "fill %.1f ms", stats.fillMs))
+        }
+        .foregroundColor(.secondary)
+    }
+}
@@ -2,6 +2,8 @@ import Foundation
 import CoreAudio
 import AVFoundation
 import AudioToolbox
+import MicNoiseGateDSP
+import SharedMemoryBridge
 
 struct AudioDevice: Identifiable, Hashable {
     let id: AudioDeviceID
@@ -13,10 +15,18 @@ class AudioManager: ObservableObject {
     @Published var inputDevices: [AudioDevice] = []
     @Published var selectedDeviceID: AudioDeviceID? {
         didSet {
-            // Restart capture if running with new device
+            // Move the first virtual mic to the new device if running
             if isNoiseSuppressionEnabled {
-                stopAudioCapture()
-                startAudioCapture()
+                updatePipelines()
+            }
+        }
+    }
+    // Sources for the virtual mics after the first, when the driver exposes
+    // more than one (nil leaves that mic silent)
+    @Published var additionalSourceIDs: [AudioDeviceID?] = [] {
+        didSet {
+            if isNoiseSuppressionEnabled {
+                updatePipelines()
             }
         }
     }
@@ -31,264 +41,183 @@ class AudioManager: ObservableObject {
     }
     @Published var isVirtualMicActive: Bool = false
 
-    // Waveform data - arrays of samples for visualization
-    @Published var inputWaveform: [Float] = Array(repeating: 0, count: 100)
-    @Published var outputWaveform: [Float] = Array(repeating: 0, count: 100)
-    @Published var inputLevel: Float = 0
-    @Published var outputLevel: Float = 0
+    // Set by the status item while the popover is open; the meter views
+    // only redraw, and the pipelines only measure, while it is
+    @Published var isMeterVisible = false {
+        didSet { updateMetering() }
+    }
+
+    // Levels and waveforms of the first virtual mic's pipeline. The meter
+    // views read them straight from the DSP engine at display rate.
+    let meters = MeterSnapshot()
+
+    // Cycle timing and glitch counts of every virtual mic, polled while
+    // capturing (see Telemetry.swift). Read on the setup queue, where a
+    // pipeline starting may replace a segment with one of another layout,
+    // and handed back to the main thread; the timer never waits on the
+    // queue, which can be busy building AudioUnits or a takeover.
+    private(set) lazy var telemetry = TelemetryMonitor { [weak self] deliver in
+        guard let self = self else { return deliver([]) }
+        let writers = (0..<max(self.pipelines.count, 1)).map { self.ringWriters[$0] }
+        self.setupQueue.async {
+            let rings = writers.map { $0?.telemetry() }
+            DispatchQueue.main.async { deliver(rings) }
+        }
+    }
 
-    var audioUnit: AudioComponentInstance?
-    private var rnnoiseProcessor: RNNoiseProcessor?
-    private var currentSampleRate: Double = 48000.0
+    // One capture pipeline per virtual mic, indexed like the driver's
+    // devices; nil where that mic has no source
+    private var pipelines: [CapturePipeline?] = []
 
-    // Shared memory for virtual mic output
-    private var sharedAudioBuffer: SharedAudioBufferWriter?
+    // Device enumeration and every pipeline start and stop run here, in
+    // order, so building AudioUnits never holds up the UI. A device switch
+    // on a running virtual mic starts the new pipeline and has it take over
+    // before the old one stops.
+    private let setupQueue = DispatchQueue(label: "MicNoiseGate audio setup", qos: .userInitiated)
+
+    // Long enough for the old pipeline to reach the crossfade and finish
+    // it; past this it is taken to have stalled
+    private static let takeoverTimeout: TimeInterval = 0.5
+
+    // Shared memory for each virtual mic, kept for the app's lifetime
+    private var ringWriters: [Int: SharedAudioBufferWriter] = [:]
 
     init() {
-        loadInputDevices()
+        // Shared memory first, so the driver can find the segment while the
+        // devices are still being looked at
+        ringWriters[0] = SharedAudioBufferWriter(device: 0)
+        setupQueue.async {
+            self.loadInputDevices()
+        }
         setupDeviceChangeListener()
-        // Initialize shared memory
-        sharedAudioBuffer = SharedAudioBufferWriter()
     }
 
     deinit {
         stopAudioCapture()
-        sharedAudioBuffer?.disconnect()
+        ringWriters.values.forEach { $0.disconnect() }
     }
 
-    // MARK: - Audio Capture with specific device
+    // MARK: - Audio Capture
 
     private func startAudioCapture() {
-        guard let deviceID = selectedDeviceID else {
-            print("No device selected")
-            return
-        }
-
-        // Stop any existing capture
-        stopAudioCapture()
-
-        // Initialize RNNoise processor
-        rnnoiseProcessor = RNNoiseProcessor()
-
-        // Create Audio Unit description for input
-        var desc = AudioComponentDescription(
-            componentType: kAudioUnitType_Output,
-            componentSubType: kAudioUnitSubType_HALOutput,
-            componentManufacturer: kAudioUnitManufacturer_Apple,
-            componentFlags: 0,
-            componentFlagsMask: 0
-        )
-
-        guard let component = AudioComponentFindNext(nil, &desc) else {
-            print("Could not find audio component")
-            return
-        }
-
-        var status = AudioComponentInstanceNew(component, &audioUnit)
-        guard status == noErr, let unit = audioUnit else {
-            print("Could not create audio unit: \(status)")
-            return
-        }
+        updatePipelines()
 
-        // Enable input
-        var enableInput: UInt32 = 1
-        status = AudioUnitSetProperty(
-            unit,
-            kAudioOutputUnitProperty_EnableIO,
-            kAudioUnitScope_Input,
-            1, // Input element
-            &enableInput,
-            UInt32(MemoryLayout<UInt32>.size)
-        )
-        if status != noErr {
-            print("Could not enable input: \(status)")
-        }
-
-        // Disable output (we just want to capture)
-        var disableOutput: UInt32 = 0
-        status = AudioUnitSetProperty(
-            unit,
-            kAudioOutputUnitProperty_EnableIO,
-            kAudioUnitScope_Output,
-            0, // Output element
-            &disableOutput,
-            UInt32(MemoryLayout<UInt32>.size)
-        )
-        if status != noErr {
-            print("Could not disable output: \(status)")
-        }
-
-        // Set the selected device
-        var currentDevice = deviceID
-        status = AudioUnitSetProperty(
-            unit,
-            kAudioOutputUnitProperty_CurrentDevice,
-            kAudioUnitScope_Global,
-            0,
-            &currentDevice,
-            UInt32(MemoryLayout<AudioDeviceID>.size)
-        )
-        if status != noErr {
-            print("Could not set device: \(status)")
-        }
-
-        // Get the device's format
-        var deviceFormat = AudioStreamBasicDescription()
-        var formatSize = UInt32(MemoryLayout<AudioStreamBasicDescription>.size)
-        status = AudioUnitGetProperty(
-            unit,
-            kAudioUnitProperty_StreamFormat,
-            kAudioUnitScope_Input,
-            1,
-            &deviceFormat,
-            &formatSize
-        )
-
-        if status == noErr {
-            // Store the sample rate for RNNoise processing
-            currentSampleRate = deviceFormat.mSampleRate
-            print("Device sample rate: \(currentSampleRate)")
-
-            // Set the same format for output scope of input element
-            status = AudioUnitSetProperty(
-                unit,
-                kAudioUnitProperty_StreamFormat,
-                kAudioUnitScope_Output,
-                1,
-                &deviceFormat,
-                formatSize
-            )
-        }
-
-        // Set up the render callback
-        var callbackStruct = AURenderCallbackStruct(
-            inputProc: audioInputCallback,
-            inputProcRefCon: Unmanaged.passUnretained(self).toOpaque()
-        )
-
-        status = AudioUnitSetProperty(
-            unit,
-            kAudioOutputUnitProperty_SetInputCallback,
-            kAudioUnitScope_Global,
-            0,
-            &callbackStruct,
-            UInt32(MemoryLayout<AURenderCallbackStruct>.size)
-        )
-        if status != noErr {
-            print("Could not set callback: \(status)")
-        }
-
-        // Initialize and start
-        status = AudioUnitInitialize(unit)
-        if status != noErr {
-            print("Could not initialize audio unit: \(status)")
-            return
-        }
-
-        status = AudioOutputUnitStart(unit)
-        if status != noErr {
-            print("Could not start audio unit: \(status)")
-            return
-        }
-
-        // Activate shared memory for virtual mic
-        sharedAudioBuffer?.setActive(true)
         DispatchQueue.main.async {
-            self.isVirtualMicActive = self.sharedAudioBuffer?.isConnected ?? false
+            self.updateMetering()
+            self.telemetry.start()
         }
-
-        print("Started capturing from device: \(deviceID)")
     }
 
     private func stopAudioCapture() {
-        // Deactivate shared memory
-        sharedAudioBuffer?.setActive(false)
-
-        if let unit = audioUnit {
-            AudioOutputUnitStop(unit)
-            AudioUnitUninitialize(unit)
-            AudioComponentInstanceDispose(unit)
-            audioUnit = nil
+        // Synchronous, so nothing writes the rings once this returns
+        let stopping = pipelines
+        pipelines = []
+        setupQueue.sync {
+            stopping.forEach { $0?.stop() }
         }
+        meters.reset()
 
         // Reset waveforms and virtual mic status
         DispatchQueue.main.async {
-            self.inputWaveform = Array(repeating: 0, count: 100)
-            self.outputWaveform = Array(repeating: 0, count: 100)
-            self.inputLevel = 0
-            self.outputLevel = 0
+            self.updateMetering()
+            self.telemetry.stop()
             self.isVirtualMicActive = false
         }
     }
 
-    fileprivate func processAudioSamples(_ samples: [Float]) {
-        guard !samples.isEmpty else { return }
-
-        // Calculate RMS level for input
-        let rms = sqrt(samples.map { $0 * $0 }.reduce(0, +) / Float(samples.count))
-        let inputLevelValue = min(rms * 5, 1.0) // Scale for visibility
-
-        // Downsample input for waveform display
-        let step = max(1, samples.count / 100)
-        var newWaveform: [Float] = []
-        for i in stride(from: 0, to: min(samples.count, step * 100), by: step) {
-            newWaveform.append(samples[i])
-        }
-
-        // Pad to 100 samples if needed
-        while newWaveform.count < 100 {
-            newWaveform.append(0)
+    // Bring the running pipelines in line with the source selection. Only
+    // virtual mics whose source changed are restarted; one that is running
+    // moves to its new source with a hot switch. The array changes here at
+    // once (main thread) and the pipelines follow on the setup queue; one
+    // that fails to start is dropped from it again.
+    private func updatePipelines() {
+        let sources = [selectedDeviceID] + additionalSourceIDs
+
+        while pipelines.count > sources.count {
+            let removed = pipelines.removeLast()
+            setupQueue.async {
+                removed?.stop()
+            }
         }
-        if newWaveform.count > 100 {
-            newWaveform = Array(newWaveform.prefix(100))
+        while pipelines.count < sources.count {
+            pipelines.append(nil)
         }
 
-        // Process through RNNoise
-        var processedSamples: [Float] = []
-        var outputLevelValue: Float = 0
-        var processedWaveform: [Float] = []
-
-        if let processor = rnnoiseProcessor {
-            processedSamples = processor.process(samples: samples, sampleRate: currentSampleRate)
-
-            if !processedSamples.isEmpty {
-                // Calculate RMS level for output
-                let outputRms = sqrt(processedSamples.map { $0 * $0 }.reduce(0, +) / Float(processedSamples.count))
-                outputLevelValue = min(outputRms * 5, 1.0)
-
-                // Downsample output for waveform display
-                let outputStep = max(1, processedSamples.count / 100)
-                for i in stride(from: 0, to: min(processedSamples.count, outputStep * 100), by: outputStep) {
-                    processedWaveform.append(processedSamples[i])
+        for (index, source) in sources.enumerated() where pipelines[index]?.deviceID != source {
+            let old = pipelines[index]
+            let pipeline = source.map {
+                CapturePipeline(deviceID: $0, output: ringWriter(for: index),
+                                meter: index == 0 ? meters : nil)
+            }
+            pipelines[index] = pipeline
+
+            setupQueue.async {
+                var started = false
+                if let old = old, old.isRunning, let pipeline = pipeline {
+                    started = self.hotSwitch(from: old, to: pipeline)
+                } else {
+                    old?.stop()
+                    started = pipeline?.start() ?? false
                 }
-
-                // Write processed audio to shared memory for virtual mic
-                processedSamples.withUnsafeBufferPointer { ptr in
-                    if let baseAddress = ptr.baseAddress {
-                        _ = sharedAudioBuffer?.writeMono(samples: baseAddress, frameCount: UInt32(processedSamples.count))
+                DispatchQueue.main.async {
+                    if !started, let pipeline = pipeline, self.pipelines.indices.contains(index),
+                       self.pipelines[index] === pipeline {
+                        self.pipelines[index] = nil
                     }
+                    self.publishVirtualMicActive()
                 }
             }
         }
 
-        // Pad output waveform to 100 samples if needed
-        while processedWaveform.count < 100 {
-            processedWaveform.append(0)
+        publishVirtualMicActive()
+    }
+
+    // Setup queue: start `new` over the ring `old` is writing, and stop
+    // `old` once `new` has faded in. Falls back to stopping `old` first when
+    // the new device needs another ring layout. Returns whether `new` runs.
+    private func hotSwitch(from old: CapturePipeline, to new: CapturePipeline) -> Bool {
+        guard new.start(takingOver: true) else {
+            old.stop()
+            return new.start()
         }
-        if processedWaveform.count > 100 {
-            processedWaveform = Array(processedWaveform.prefix(100))
+        if new.waitForTakeover(timeout: AudioManager.takeoverTimeout) {
+            old.stop()
+        } else {
+            // Its device stopped delivering; cut straight over
+            print("Device \(old.deviceID) didn't hand over in time")
+            old.stop(deactivating: false)
+            new.forceTakeover()
         }
+        print("Switched from device \(old.deviceID) to \(new.deviceID)")
+        return true
+    }
 
+    private func publishVirtualMicActive() {
+        let active = pipelines.contains { $0 != nil } &&
+                     ringWriters.values.contains { $0.isConnected }
         DispatchQueue.main.async {
-            self.inputWaveform = newWaveform
-            self.outputWaveform = processedWaveform
-            self.inputLevel = inputLevelValue
-            self.outputLevel = outputLevelValue
+            self.isVirtualMicActive = active
         }
     }
 
+    private func ringWriter(for index: Int) -> SharedAudioBufferWriter {
+        if let writer = ringWriters[index] {
+            return writer
+        }
+        let writer = SharedAudioBufferWriter(device: UInt32(index))
+        ringWriters[index] = writer
+        return writer
+    }
+
+    // Measure only while capturing with the popover open; otherwise the
+    // pipelines skip metering altogether (main thread)
+    private func updateMetering() {
+        meters.setEnabled(isMeterVisible && isNoiseSuppressionEnabled)
+    }
+
     // MARK: - Device Management
 
+    // Setup queue; the list is published on the main thread
     func loadInputDevices() {
         var propertyAddress = AudioObjectPropertyAddress(
             mSelector: kAudioHardwarePropertyDevices,
@@ -322,8 +251,14 @@ class AudioManager: ObservableObject {
         guard status == noErr else { return }
 
         var devices: [AudioDevice] = []
+        var virtualMicCount = 0
 
         for deviceID in deviceIDs {
+            // Our own virtual mics can't be a source; count them instead
+            if let uid = getDeviceUID(deviceID: deviceID), uid.hasPrefix(MNG_DEVICE_UID) {
+                virtualMicCount += 1
+                continue
+            }
             if let name = getDeviceName(deviceID: deviceID),
                hasInputChannels(deviceID: deviceID) {
                 devices.append(AudioDevice(id: deviceID, name: name, isInput: true))
@@ -336,6 +271,14 @@ class AudioManager: ObservableObject {
             if self.selectedDeviceID == nil, let first = devices.first {
                 self.selectedDeviceID = first.id
             }
+
+            // One source slot per extra virtual mic the driver exposes
+            let additional = max(0, virtualMicCount - 1)
+            if self.additionalSourceIDs.count != additional {
+                let kept = self.additionalSourceIDs.prefix(additional)
+                self.additionalSourceIDs = Array(kept) +
+                    Array(repeating: nil, count: additional - kept.count)
+            }
         }
     }
 
@@ -361,6 +304,28 @@ class AudioManager: ObservableObject {
         return status == noErr ? name as String : nil
     }
 
+    private func getDeviceUID(deviceID: AudioDeviceID) -> String? {
+        var propertyAddress = AudioObjectPropertyAddress(
+            mSelector: kAudioDevicePropertyDeviceUID,
+            mScope: kAudioObjectPropertyScopeGlobal,
+            mElement: kAudioObjectPropertyElementMain
+        )
+
+        var uid: CFString = "" as CFString
+        var dataSize = UInt32(MemoryLayout<CFString>.size)
+
+        let status = AudioObjectGetPropertyData(
+            deviceID,
+            &propertyAddress,
+            0,
+            nil,
+            &dataSize,
+            &uid
+        )
+
+        return status == noErr ? uid as String : nil
+    }
+
     private func hasInputChannels(deviceID: AudioDeviceID) -> Bool {
         var propertyAddress = AudioObjectPropertyAddress(
             mSelector: kAudioDevicePropertyStreamConfiguration,
@@ -407,62 +372,83 @@ class AudioManager: ObservableObject {
         AudioObjectAddPropertyListenerBlock(
             AudioObjectID(kAudioObjectSystemObject),
             &propertyAddress,
-            DispatchQueue.main
+            setupQueue
         ) { [weak self] _, _ in
             self?.loadInputDevices()
         }
     }
 }
 
-// Audio input callback function
-private func audioInputCallback(
-    inRefCon: UnsafeMutableRawPointer,
-    ioActionFlags: UnsafeMutablePointer<AudioUnitRenderActionFlags>,
-    inTimeStamp: UnsafePointer<AudioTimeStamp>,
-    inBusNumber: UInt32,
-    inNumberFrames: UInt32,
-    ioData: UnsafeMutablePointer<AudioBufferList>?
-) -> OSStatus {
-
-    let audioManager = Unmanaged<AudioManager>.fromOpaque(inRefCon).takeUnretainedValue()
-
-    guard let unit = audioManager.audioUnit else { return noErr }
-
-    // Allocate buffer for audio data
-    var bufferList = AudioBufferList(
-        mNumberBuffers: 1,
-        mBuffers: AudioBuffer(
-            mNumberChannels: 1,
-            mDataByteSize: inNumberFrames * 4,
-            mData: nil
-        )
-    )
-
-    // Allocate memory for the buffer
-    let bufferSize = Int(inNumberFrames) * MemoryLayout<Float>.size
-    let audioBuffer = UnsafeMutableRawPointer.allocate(byteCount: bufferSize, alignment: MemoryLayout<Float>.alignment)
-    defer { audioBuffer.deallocate() }
-
-    bufferList.mBuffers.mData = audioBuffer
-    bufferList.mBuffers.mDataByteSize = UInt32(bufferSize)
-
-    // Render audio into our buffer
-    let status = AudioUnitRender(
-        unit,
-        ioActionFlags,
-        inTimeStamp,
-        inBusNumber,
-        inNumberFrames,
-        &bufferList
-    )
-
-    if status == noErr {
-        // Convert to Float array
-        let floatPointer = audioBuffer.assumingMemoryBound(to: Float.self)
-        let samples = Array(UnsafeBufferPointer(start: floatPointer, count: Int(inNumberFrames)))
-
-        audioManager.processAudioSamples(samples)
+// One signal's meter, and the reading the UI last took from it
+//
+// The DSP engine's MNGMeter measures peak, RMS and a min/max envelope on
+// the processing thread and publishes whole readings through a lock-free
+// triple buffer. The meter views call refresh() once per display frame,
+// which copies the newest reading into storage allocated here, so drawing
+// never allocates or goes through SwiftUI's change tracking.
+final class MeterChannel {
+    static let points = Int(MNG_METER_POINTS)
+
+    fileprivate let meter = mng_meter_create()
+
+    // Main thread
+    private(set) var peak: Float = 0
+    private(set) var rms: Float = 0
+    let minimum = UnsafeMutablePointer<Float>.allocate(capacity: MeterChannel.points)
+    let maximum = UnsafeMutablePointer<Float>.allocate(capacity: MeterChannel.points)
+
+    // RMS scaled by 5 and clamped to 1, so speech fills the meter
+    var level: Float { min(rms * 5, 1) }
+
+    init() {
+        minimum.initialize(repeating: 0, count: MeterChannel.points)
+        maximum.initialize(repeating: 0, count: MeterChannel.points)
+    }
+
+    deinit {
+        mng_meter_destroy(meter)
+        minimum.deallocate()
+        maximum.deallocate()
     }
 
-    return noErr
+    // Main thread: take the newest reading; false if there was none
+    @discardableResult
+    func refresh() -> Bool {
+        return mng_meter_read(meter, &peak, &rms, minimum, maximum) != 0
+    }
+}
+
+// The meters of the pipeline the UI shows
+final class MeterSnapshot {
+    let input = MeterChannel()
+    let output = MeterChannel()
+
+    // Any thread
+    func setEnabled(_ enabled: Bool) {
+        mng_meter_set_enabled(input.meter, enabled ? 1 : 0)
+        mng_meter_set_enabled(output.meter, enabled ? 1 : 0)
+    }
+
+    // Publish silence; from the processing thread, or while no pipeline runs
+    func reset() {
+        mng_meter_reset(input.meter)
+        mng_meter_reset(output.meter)
+    }
+
+    // Processing thread. Real-time safe.
+    func updateInput(_ samples: UnsafeBufferPointer<Float>) {
+        guard let base = samples.baseAddress else { return }
+        mng_meter_update(input.meter, base, UInt32(samples.count))
+    }
+
+    func updateOutput(_ samples: UnsafeBufferPointer<Float>) {
+        guard let base = samples.baseAddress else { return }
+        mng_meter_update(output.meter, base, UInt32(samples.count))
+    }
+
+    // Main thread, once per display frame
+    func refresh() {
+        input.refresh()
+        output.refresh()
+    }
 }
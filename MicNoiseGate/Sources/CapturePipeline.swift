@@ -0,0 +1,772 @@
+import Foundation
+import CoreAudio
+import AudioToolbox
+import MicNoiseGateDSP
+import SharedMemoryBridge
+
+// One physical microphone feeding one virtual mic
+//
+// Owns the input unit for the device, the processing thread and the ring
+// of the virtual mic it feeds. The unit's input callback runs on the HAL's
+// real-time IO thread and only copies the raw signal into a private ring;
+// RNNoise runs on the pipeline's own thread, which the driver wakes through
+// the shared ring's doorbell each time it has consumed a period. Pipelines
+// for different microphones share nothing but the meters of the one the
+// UI is showing.
+//
+// A pipeline can also start by taking its virtual mic over from another
+// one that is still running (a device switch): it then crossfades into the
+// ring through the writer's handoff before writing it alone, and the old
+// pipeline is stopped only after that, so clients never see a gap.
+final class CapturePipeline {
+    let deviceID: AudioDeviceID
+
+    fileprivate var audioUnit: AudioComponentInstance?
+
+    // Preallocated render target for the input callback, sized from the
+    // unit's maximum frames per slice
+    fileprivate var captureArena: CaptureArena?
+
+    // Set while the unit runs; the input callback hands it the raw signal
+    fileprivate var worker: ProcessingWorker?
+
+    private let output: SharedAudioBufferWriter
+    private let meter: MeterSnapshot?
+
+    // Input rate of the device
+    private var sampleRate: Double = 48000.0
+
+    // This pipeline's producer token for the ring (see ProducerHandoff.hpp)
+    private var producerToken: UInt32 = 0
+
+    // Set while recording a capture trace (see CaptureTrace)
+    private var trace: CaptureTrace?
+
+    var isRunning: Bool {
+        return audioUnit != nil
+    }
+
+    // `meter` receives levels and waveforms, or nil to skip metering
+    init(deviceID: AudioDeviceID, output: SharedAudioBufferWriter, meter: MeterSnapshot?) {
+        self.deviceID = deviceID
+        self.output = output
+        self.meter = meter
+    }
+
+    deinit {
+        stop()
+    }
+
+    // Returns false if the input unit couldn't be started. With
+    // `takingOver`, another pipeline is writing the ring: this one fades in
+    // over it and keeps the ring's layout, and returns false (for a cold
+    // switch) if its device would need a different one.
+    func start(takingOver: Bool = false) -> Bool {
+        // Stop any existing capture
+        stop(deactivating: !takingOver)
+
+        // Create Audio Unit description for input
+        var desc = AudioComponentDescription(
+            componentType: kAudioUnitType_Output,
+            componentSubType: kAudioUnitSubType_HALOutput,
+            componentManufacturer: kAudioUnitManufacturer_Apple,
+            componentFlags: 0,
+            componentFlagsMask: 0
+        )
+
+        guard let component = AudioComponentFindNext(nil, &desc) else {
+            print("Could not find audio component")
+            return false
+        }
+
+        var status = AudioComponentInstanceNew(component, &audioUnit)
+        guard status == noErr, let unit = audioUnit else {
+            print("Could not create audio unit: \(status)")
+            return false
+        }
+
+        // Enable input
+        var enableInput: UInt32 = 1
+        status = AudioUnitSetProperty(
+            unit,
+            kAudioOutputUnitProperty_EnableIO,
+            kAudioUnitScope_Input,
+            1, // Input element
+            &enableInput,
+            UInt32(MemoryLayout<UInt32>.size)
+        )
+        if status != noErr {
+            print("Could not enable input: \(status)")
+        }
+
+        // Disable output (we just want to capture)
+        var disableOutput: UInt32 = 0
+        status = AudioUnitSetProperty(
+            unit,
+            kAudioOutputUnitProperty_EnableIO,
+            kAudioUnitScope_Output,
+            0, // Output element
+            &disableOutput,
+            UInt32(MemoryLayout<UInt32>.size)
+        )
+        if status != noErr {
+            print("Could not disable output: \(status)")
+        }
+
+        // Set the selected device
+        var currentDevice = deviceID
+        status = AudioUnitSetProperty(
+            unit,
+            kAudioOutputUnitProperty_CurrentDevice,
+            kAudioUnitScope_Global,
+            0,
+            &currentDevice,
+            UInt32(MemoryLayout<AudioDeviceID>.size)
+        )
+        if status != noErr {
+            print("Could not set device: \(status)")
+        }
+
+        // Get the device's format
+        sampleRate = 48000.0
+        var deviceFormat = AudioStreamBasicDescription()
+        var formatSize = UInt32(MemoryLayout<AudioStreamBasicDescription>.size)
+        status = AudioUnitGetProperty(
+            unit,
+            kAudioUnitProperty_StreamFormat,
+            kAudioUnitScope_Input,
+            1,
+            &deviceFormat,
+            &formatSize
+        )
+
+        if status == noErr {
+            // Store the sample rate for RNNoise processing
+            sampleRate = deviceFormat.mSampleRate
+            print("Device sample rate: \(sampleRate)")
+
+            // Set the same format for output scope of input element
+            status = AudioUnitSetProperty(
+                unit,
+                kAudioUnitProperty_StreamFormat,
+                kAudioUnitScope_Output,
+                1,
+                &deviceFormat,
+                formatSize
+            )
+        }
+
+        // Frame-aligned IO (`defaults write com.micnoisegate.app
+        // FrameAlignedIO -bool true`): each callback is whole RNNoise frames
+        let alignedFrames = UserDefaults.standard.bool(forKey: "FrameAlignedIO")
+            ? requestFrameAlignedBuffer() : nil
+
+        // Preallocate the render buffer before the callback can run
+        var maxFrames: UInt32 = 4096
+        var maxFramesSize = UInt32(MemoryLayout<UInt32>.size)
+        AudioUnitGetProperty(
+            unit,
+            kAudioUnitProperty_MaximumFramesPerSlice,
+            kAudioUnitScope_Global,
+            0,
+            &maxFrames,
+            &maxFramesSize
+        )
+        captureArena = CaptureArena(capacity: Int(maxFrames))
+        meter?.reset()
+
+        // Initialize RNNoise processor for this device's rate and buffer size.
+        // In driver mode (`defaults write com.micnoisegate.app DenoiseInDriver
+        // -bool true`) we only convert to 48kHz and the driver runs RNNoise.
+        // `PowerSaving` gates long non-speech stretches to silence, and
+        // `Suppressor` (rnnoise, gate or auto) picks the engine.
+        let denoiseInDriver = UserDefaults.standard.bool(forKey: "DenoiseInDriver")
+        // Int16 on the wire unless `defaults write com.micnoisegate.app
+        // WireFormat float32`
+        let wireFloat = UserDefaults.standard.string(forKey: "WireFormat") == "float32"
+        let sampleFormat = wireFloat ? MNG_SAMPLE_FLOAT32 : MNG_SAMPLE_INT16
+        // The device's real IO period: the unit's maximum slice can be far
+        // larger, so it only sizes buffers
+        let bufferFrames = ioBufferFrames()
+        let frames = ringFrames(bufferFrames: bufferFrames)
+        if takingOver {
+            // A new layout replaces the segment, which the driver would
+            // have to reconnect to
+            guard mng_shm_capacity_for(frames) <= output.capacityFrames,
+                  sampleFormat == output.sampleFormat else {
+                print("Device \(deviceID) needs another ring layout; switching cold")
+                stop(deactivating: false)
+                return false
+            }
+        } else {
+            output.setLayout(frames: frames, sampleFormat: sampleFormat)
+        }
+        let processingMode = denoiseInDriver ? MNG_PROCESSING_DRIVER : MNG_PROCESSING_APP
+        let captureLatency = captureLatencyFrames()
+        output.setProcessingMode(processingMode)
+        output.setCaptureLatency(frames: captureLatency)
+        let powerSaving = UserDefaults.standard.bool(forKey: "PowerSaving")
+        let suppressor = SuppressorMode(defaultsValue: UserDefaults.standard.string(forKey: "Suppressor"))
+        let processor = RNNoiseProcessor(sampleRate: sampleRate, maxFrames: Int(maxFrames),
+                                         denoise: !denoiseInDriver, powerSaving: powerSaving,
+                                         suppressor: suppressor)
+
+        // Everything a replay needs to set the pipeline up again
+        if let directory = CaptureTrace.directory {
+            let targetLatency = max(0, output.targetLatencyMs) * Double(kSampleRate) / 1000.0
+            let config = MNGTraceConfig(
+                inputRate: sampleRate, maxInputFrames: maxFrames,
+                alignedFrames: alignedFrames ?? 0, processingMode: processingMode,
+                powerSaving: powerSaving ? 1 : 0, suppressor: suppressor.rawValue,
+                ringFrames: output.capacityFrames, sampleFormat: output.sampleFormat,
+                targetLatencyFrames: UInt32(targetLatency.rounded()),
+                captureLatencyFrames: captureLatency, ioBufferFrames: bufferFrames)
+            trace = CaptureTrace(directory: directory, deviceID: deviceID, config: config)
+            if trace != nil {
+                output.beginRequestLog()
+            }
+        }
+        // Taking over, our bursts and the old pipeline's (taken as alike)
+        // have to be queued before its fade can start
+        let burstFrames = 2 * UInt32((Double(alignedFrames ?? bufferFrames) *
+                                      Double(kSampleRate) / sampleRate).rounded(.up))
+        producerToken = takingOver ? output.beginHandoff(burstFrames: burstFrames)
+                                   : output.claimProducer()
+        guard producerToken != 0,
+              let worker = ProcessingWorker(deviceID: deviceID, processor: processor,
+                                            sampleRate: sampleRate, callbackFrames: Int(maxFrames),
+                                            ioBufferFrames: Int(bufferFrames),
+                                            alignedFrames: alignedFrames.map { Int($0) },
+                                            output: output, token: producerToken,
+                                            meter: meter, trace: trace) else {
+            print("Could not allocate the processing ring")
+            stop(deactivating: !takingOver)
+            return false
+        }
+        self.worker = worker
+        worker.start()
+
+        // Set up the render callback
+        var callbackStruct = AURenderCallbackStruct(
+            inputProc: audioInputCallback,
+            inputProcRefCon: Unmanaged.passUnretained(self).toOpaque()
+        )
+
+        status = AudioUnitSetProperty(
+            unit,
+            kAudioOutputUnitProperty_SetInputCallback,
+            kAudioUnitScope_Global,
+            0,
+            &callbackStruct,
+            UInt32(MemoryLayout<AURenderCallbackStruct>.size)
+        )
+        if status != noErr {
+            print("Could not set callback: \(status)")
+        }
+
+        // Initialize and start
+        status = AudioUnitInitialize(unit)
+        if status != noErr {
+            print("Could not initialize audio unit: \(status)")
+            stop(deactivating: !takingOver)
+            return false
+        }
+
+        status = AudioOutputUnitStart(unit)
+        if status != noErr {
+            print("Could not start audio unit: \(status)")
+            stop(deactivating: !takingOver)
+            return false
+        }
+
+        // Activate shared memory for virtual mic
+        output.setActive(true)
+
+        print("Started capturing from device \(deviceID) into \(output.name)")
+        return true
+    }
+
+    // Wait the handoff from the pipeline this one replaces out, for up to
+    // `timeout` seconds; false if it never completed
+    func waitForTakeover(timeout: TimeInterval) -> Bool {
+        let deadline = Date(timeIntervalSinceNow: timeout)
+        while output.producerRole(producerToken) == .incoming && Date() < deadline {
+            usleep(10_000)
+        }
+        return output.producerRole(producerToken) != .incoming
+    }
+
+    // After the pipeline being replaced has stopped without fading out:
+    // take the ring over at once
+    func forceTakeover() {
+        if output.producerRole(producerToken) == .incoming {
+            output.abandonHandoff()
+        }
+    }
+
+    // `deactivating` tells the driver the mic has stopped, if this pipeline
+    // still owns the ring; a pipeline handing over to another leaves it on
+    func stop(deactivating: Bool = true) {
+        if deactivating && output.producerRole(producerToken) == .owner {
+            output.setActive(false)
+        }
+
+        if let unit = audioUnit {
+            AudioOutputUnitStop(unit)
+            AudioUnitUninitialize(unit)
+            AudioComponentInstanceDispose(unit)
+            audioUnit = nil
+        }
+
+        // The callback can no longer run, so the arena and worker can go
+        captureArena = nil
+        worker?.stop()
+        worker = nil
+        producerToken = 0
+
+        // Nothing records any more, so the file can be finished
+        if trace != nil {
+            trace = nil
+            output.endRequestLog()
+        }
+    }
+
+    // Ask the mic for an IO buffer of whole 10ms RNNoise frames, the fewest
+    // its range allows, so a callback carries exactly that many frames in
+    // and out of the denoiser and none wait in its FIFO. The buffer size is
+    // per process, so other apps using the mic keep theirs. Returns the
+    // size in effect, or nil if the device can't run one.
+    private func requestFrameAlignedBuffer() -> UInt32? {
+        guard sampleRate > 0, sampleRate.truncatingRemainder(dividingBy: 100) == 0 else { return nil }
+        let frame = UInt32(sampleRate / 100)
+
+        var address = AudioObjectPropertyAddress(
+            mSelector: kAudioDevicePropertyBufferFrameSizeRange,
+            mScope: kAudioObjectPropertyScopeGlobal,
+            mElement: kAudioObjectPropertyElementMain
+        )
+        var range = AudioValueRange()
+        var size = UInt32(MemoryLayout<AudioValueRange>.size)
+        guard AudioObjectGetPropertyData(deviceID, &address, 0, nil, &size, &range) == noErr else {
+            return nil
+        }
+        let minimum = UInt32(max(1, range.mMinimum.rounded(.up)))
+        var frames = (minimum + frame - 1) / frame * frame
+        guard Double(frames) <= range.mMaximum else { return nil }
+
+        address.mSelector = kAudioDevicePropertyBufferFrameSize
+        size = UInt32(MemoryLayout<UInt32>.size)
+        guard AudioObjectSetPropertyData(deviceID, &address, 0, nil, size, &frames) == noErr else {
+            print("Could not set a frame-aligned buffer of \(frames) frames")
+            return nil
+        }
+
+        // The HAL may settle on another size
+        var actual: UInt32 = 0
+        guard AudioObjectGetPropertyData(deviceID, &address, 0, nil, &size, &actual) == noErr,
+              actual > 0, actual % frame == 0 else {
+            return nil
+        }
+        print("Frame-aligned IO: \(actual) frames per callback")
+        return actual
+    }
+
+    // Ring capacity for an IO buffer of `bufferFrames`: the producer delay
+    // the worker advertises (one callback and an RNNoise frame), the
+    // highest target latency, a callback's worth of writing and the largest
+    // cycle the driver has served, which it can only do from half the ring.
+    // `defaults write com.micnoisegate.app RingFrames 16384` asks for more;
+    // anything under that minimum is raised to it.
+    private func ringFrames(bufferFrames: UInt32) -> UInt32 {
+        let callback = UInt32((Double(bufferFrames) * Double(kSampleRate) / sampleRate).rounded(.up))
+        let cycle = max(output.largestConsumerCycle, callback)
+        let needed = max(2 * callback + 480 + MNG_MAX_TARGET_LATENCY_FRAMES + cycle, 2 * cycle)
+
+        let requested = UInt32(clamping: max(0, UserDefaults.standard.integer(forKey: "RingFrames")))
+        return max(needed, requested)
+    }
+
+    // The device's IO buffer size at its own rate (512 if unknown)
+    private func ioBufferFrames() -> UInt32 {
+        var address = AudioObjectPropertyAddress(
+            mSelector: kAudioDevicePropertyBufferFrameSize,
+            mScope: kAudioObjectPropertyScopeGlobal,
+            mElement: kAudioObjectPropertyElementMain
+        )
+        var bufferFrames: UInt32 = 512
+        var size = UInt32(MemoryLayout<UInt32>.size)
+        AudioObjectGetPropertyData(deviceID, &address, 0, nil, &size, &bufferFrames)
+        return bufferFrames
+    }
+
+    // The microphone's latency and safety offset plus its input stream's
+    // latency, in 48kHz frames: how long before its timestamps the sound
+    // actually reached it
+    private func captureLatencyFrames() -> UInt32 {
+        func inputProperty(_ object: AudioObjectID, _ selector: AudioObjectPropertySelector) -> UInt32 {
+            var address = AudioObjectPropertyAddress(
+                mSelector: selector,
+                mScope: kAudioDevicePropertyScopeInput,
+                mElement: kAudioObjectPropertyElementMain
+            )
+            var value: UInt32 = 0
+            var size = UInt32(MemoryLayout<UInt32>.size)
+            let status = AudioObjectGetPropertyData(object, &address, 0, nil, &size, &value)
+            return status == noErr ? value : 0
+        }
+
+        var deviceFrames = inputProperty(deviceID, kAudioDevicePropertyLatency) +
+                           inputProperty(deviceID, kAudioDevicePropertySafetyOffset)
+
+        // The first input stream's latency comes on top
+        var address = AudioObjectPropertyAddress(
+            mSelector: kAudioDevicePropertyStreams,
+            mScope: kAudioDevicePropertyScopeInput,
+            mElement: kAudioObjectPropertyElementMain
+        )
+        var stream: AudioStreamID = 0
+        var size = UInt32(MemoryLayout<AudioStreamID>.size)
+        if AudioObjectGetPropertyData(deviceID, &address, 0, nil, &size, &stream) == noErr, size > 0 {
+            deviceFrames += inputProperty(stream, kAudioStreamPropertyLatency)
+        }
+
+        return UInt32((Double(deviceFrames) * Double(kSampleRate) / sampleRate).rounded())
+    }
+}
+
+// The pipeline's processing thread
+//
+// Drains the raw ring through RNNoise into the virtual mic's ring. Between
+// passes it sleeps on the shared ring's doorbell, so it runs right after
+// the driver has consumed a period; with no client reading, it wakes once
+// per input callback instead. When the shared ring is full it waits for
+// room rather than dropping audio.
+//
+// The thread runs under a time-constraint policy for the input callback's
+// period and inside the microphone's IO workgroup (see RealtimeThread).
+fileprivate final class ProcessingWorker {
+    private let deviceID: AudioDeviceID
+    private let processor: RNNoiseProcessor
+    private let output: SharedAudioBufferWriter
+    private let meter: MeterSnapshot?
+    private let trace: CaptureTrace?
+
+    // Our producer token. While it is incoming, processed audio feeds the
+    // handoff instead of the ring, and the meters and timing hints are left
+    // to the pipeline being replaced.
+    private let token: UInt32
+    private var wasIncoming = false
+
+    // Frames handed back by the handoff when we take over
+    private let leftover: UnsafeMutablePointer<Float>
+    private static let leftoverCapacity = 1024
+
+    // Raw input at the device rate, written by the input callback. Its
+    // timing anchor ties raw frames to capture host times.
+    private let rawRing: UnsafeMutablePointer<MNGSharedHeader>
+
+    // Largest block taken from the raw ring per process call
+    private let block: UnsafeMutablePointer<Float>
+    private let blockCapacity: Int
+
+    // Frames per callback with frame-aligned IO at 48kHz, where every block
+    // is whole RNNoise frames and the denoiser holds nothing back; 0
+    // otherwise (the resampler's output doesn't stay on frame edges)
+    private let frameAlignment: Int
+
+    private let sampleRate: Double
+
+    // The device's IO period (the aligned buffer when frame-aligned), in
+    // microseconds and in 48kHz frames
+    private let callbackMicroseconds: UInt32
+    private let callbackRingFrames: Double
+
+    // Length of one ring frame at 48kHz, and one raw frame, in host ticks
+    private let ticksPerRingFrame: Double
+    private let ticksPerRawFrame: Double
+
+    // Power saving had gated the output at the end of the last block
+    private var wasIdle = false
+
+    private var thread: Thread?
+    private let finished = DispatchSemaphore(value: 0)
+
+    init?(deviceID: AudioDeviceID, processor: RNNoiseProcessor, sampleRate: Double,
+          callbackFrames: Int, ioBufferFrames: Int, alignedFrames: Int?,
+          output: SharedAudioBufferWriter,
+          token: UInt32, meter: MeterSnapshot?, trace: CaptureTrace?) {
+        // Room for a few callbacks however large the device's buffer is
+        guard let ring = mng_ring_create(UInt32(max(4 * callbackFrames, Int(MNG_RING_FRAMES)))) else {
+            return nil
+        }
+
+        self.deviceID = deviceID
+        self.processor = processor
+        self.output = output
+        self.token = token
+        self.meter = meter
+        self.trace = trace
+        self.sampleRate = sampleRate
+        leftover = UnsafeMutablePointer<Float>.allocate(capacity: ProcessingWorker.leftoverCapacity)
+        leftover.initialize(repeating: 0, count: ProcessingWorker.leftoverCapacity)
+        rawRing = ring
+        blockCapacity = callbackFrames
+        block = UnsafeMutablePointer<Float>.allocate(capacity: callbackFrames)
+        block.initialize(repeating: 0, count: callbackFrames)
+        if let aligned = alignedFrames, sampleRate == Double(kSampleRate), aligned <= callbackFrames {
+            frameAlignment = aligned
+        } else {
+            frameAlignment = 0
+        }
+        let periodFrames = frameAlignment > 0 ? frameAlignment
+                                              : min(max(ioBufferFrames, 1), callbackFrames)
+        callbackMicroseconds = UInt32(Double(periodFrames) / sampleRate * 1_000_000)
+        callbackRingFrames = Double(periodFrames) * Double(kSampleRate) / sampleRate
+
+        var timebase = mach_timebase_info_data_t()
+        mach_timebase_info(&timebase)
+        let ticksPerSecond = 1e9 * Double(timebase.denom) / Double(timebase.numer)
+        ticksPerRingFrame = ticksPerSecond / Double(kSampleRate)
+        ticksPerRawFrame = ticksPerSecond / sampleRate
+    }
+
+    deinit {
+        mng_ring_destroy(rawRing)
+        block.deallocate()
+        leftover.deallocate()
+    }
+
+    func start() {
+        let thread = Thread { [self] in
+            run()
+            finished.signal()
+        }
+        thread.name = "MicNoiseGate processing"
+        thread.qualityOfService = .userInteractive
+        self.thread = thread
+        thread.start()
+    }
+
+    // Wait for the thread to finish (after the input unit has stopped)
+    func stop() {
+        guard let thread = thread else { return }
+        thread.cancel()
+        finished.wait()
+        self.thread = nil
+    }
+
+    // Input callback: hand over the raw signal captured from `hostTime`
+    // (0 if unknown). Real-time safe; drops the block if the thread has
+    // fallen a whole ring behind.
+    func enqueue(_ samples: UnsafePointer<Float>, frameCount: UInt32, hostTime: UInt64) {
+        trace?.recordInput(samples, frameCount: frameCount, hostTime: hostTime)
+
+        let start = mng_shm_load_write_index(rawRing)
+        guard mng_ring_write_mono(rawRing, samples, frameCount) != 0 else { return }
+
+        if hostTime != 0 {
+            mng_shm_store_anchor(rawRing, start, hostTime)
+        }
+    }
+
+    // Input callback: telemetry for a callback that began at host time
+    // `started`. Real-time safe.
+    func recordCaptureCycle(since started: UInt64) {
+        guard output.producerRole(token) == .owner else { return }
+        let backlog = mng_shm_load_write_index(rawRing) &- mng_shm_load_read_index(rawRing)
+        output.recordCaptureCycle(nanoseconds: HostTime.nanoseconds(since: started),
+                                  backlogFrames: backlog, capacityFrames: rawRing.pointee.bufferFrames)
+    }
+
+    private func run() {
+        // RNNoise takes a small fraction of real time; ask for a quarter of
+        // each period to leave the scheduler slack
+        let period = Double(callbackMicroseconds) / 1_000_000
+        if !RealtimeThread.promoteCurrent(period: period, computation: period / 4) {
+            print("Processing thread stays at QoS: time-constraint policy refused")
+        }
+        let membership = WorkgroupMembership(deviceID: deviceID)
+        defer { membership?.leave() }
+
+        while !Thread.current.isCancelled {
+            let seen = output.doorbell
+            drain()
+            if let trace = trace {
+                output.recordReads(into: trace)
+            }
+            output.waitForConsumption(since: seen, timeoutMicroseconds: callbackMicroseconds)
+        }
+    }
+
+    // Process everything the input callback has queued, in whole callbacks
+    // when frame-aligned
+    private func drain() {
+        let blockFrames = frameAlignment > 0 ? blockCapacity - blockCapacity % frameAlignment
+                                             : blockCapacity
+        while mng_ring_fill_level(rawRing) > 0 {
+            let position = mng_shm_load_read_index(rawRing)
+            let count = mng_ring_read(rawRing, block, UInt32(blockFrames))
+            guard count > 0 else { return }
+
+            process(UnsafeBufferPointer(start: block, count: Int(count)),
+                    hostTime: captureTime(ofRawFrame: position))
+        }
+    }
+
+    // When raw frame `position` was captured, from the raw ring's anchor
+    private func captureTime(ofRawFrame position: UInt64) -> UInt64 {
+        var anchorFrame: UInt64 = 0
+        var anchorHostTime: UInt64 = 0
+        guard mng_shm_load_anchor(rawRing, &anchorFrame, &anchorHostTime) != 0 else { return 0 }
+
+        let offset = Double(Int64(bitPattern: position &- anchorFrame)) * ticksPerRawFrame
+        let hostTime = Double(anchorHostTime) + offset
+        return hostTime > 0 ? UInt64(hostTime) : 0
+    }
+
+    private func process(_ samples: UnsafeBufferPointer<Float>, hostTime: UInt64) {
+        let started = mach_absolute_time()
+
+        switch output.producerRole(token) {
+        case .retired:
+            return
+        case .incoming:
+            // The pipeline we replace fades over to this
+            wasIncoming = true
+            processor.process(samples: samples) { processed in
+                guard let baseAddress = processed.baseAddress else { return }
+                output.feedHandoff(baseAddress, frameCount: UInt32(processed.count))
+            }
+            return
+        case .owner:
+            if wasIncoming {
+                wasIncoming = false
+                writeLeftover()
+            }
+        }
+
+        // While power saving gates the output there is nothing to draw, so
+        // the meters show silence once and then stay untouched
+        let idle = processor.isIdle
+        if idle && !wasIdle {
+            meter?.reset()
+        }
+        wasIdle = idle
+        if !idle {
+            meter?.updateInput(samples)
+        }
+
+        // Output starts with the frames already held back, captured before
+        // this block's first sample
+        let heldBack = processor.pendingFrames
+        let heldBackTicks = UInt64(Double(heldBack) * ticksPerRingFrame)
+        let startTime = hostTime > heldBackTicks ? hostTime - heldBackTicks : 0
+
+        // The newest frame can trail capture by one input callback and one
+        // RNNoise frame held back; the driver's target latency covers our
+        // wake-up on top. Frame-aligned blocks hold nothing back, unless an
+        // odd-sized callback has left frames waiting.
+        let holdsBack = processor.denoises && (frameAlignment == 0 || heldBack > 0)
+        output.setProducerDelay(frames: UInt32(callbackRingFrames.rounded(.up)) +
+                                (holdsBack ? 480 : 0))
+
+        processor.process(samples: samples) { processed in
+            guard let baseAddress = processed.baseAddress else { return }
+
+            // The denoised signal only exists inside the driver in driver mode
+            if processor.denoises && !idle {
+                meter?.updateOutput(processed)
+            }
+
+            // Fades towards the pipeline taking over from us, if any. The
+            // buffer is the processor's own (or our block), so writable.
+            let frameCount = UInt32(processed.count)
+            output.mixHandoff(UnsafeMutablePointer(mutating: baseAddress), frameCount: frameCount)
+
+            // Wait for the driver to make room rather than dropping audio.
+            // The wait isn't work, so it stays out of the cycle's time.
+            let busy = HostTime.nanoseconds(since: started)
+            _ = output.waitForSpace(frames: frameCount, timeoutMicroseconds: callbackMicroseconds)
+            _ = output.writeMono(samples: baseAddress, frameCount: frameCount, hostTime: startTime)
+            output.recordProducerCycle(nanoseconds: busy)
+        }
+    }
+
+    // Just taken over: what the old pipeline didn't fade through goes out
+    // first, so our signal carries on without a jump
+    private func writeLeftover() {
+        let capacity = UInt32(ProcessingWorker.leftoverCapacity)
+        while true {
+            let count = output.drainHandoff(into: leftover, capacity: capacity)
+            guard count > 0 else { return }
+            _ = output.waitForSpace(frames: count, timeoutMicroseconds: callbackMicroseconds)
+            _ = output.writeMono(samples: leftover, frameCount: count)
+        }
+    }
+}
+
+// Fixed render target for the input callback
+fileprivate final class CaptureArena {
+    let capacity: Int
+    let samples: UnsafeMutablePointer<Float>
+    let bufferList: UnsafeMutableAudioBufferListPointer
+
+    init(capacity: Int) {
+        self.capacity = capacity
+        samples = UnsafeMutablePointer<Float>.allocate(capacity: capacity)
+        samples.initialize(repeating: 0, count: capacity)
+        bufferList = AudioBufferList.allocate(maximumBuffers: 1)
+    }
+
+    deinit {
+        samples.deallocate()
+        free(bufferList.unsafeMutablePointer)
+    }
+
+    // Point the buffer list at the arena for a render of `frameCount` frames
+    func prepare(frameCount: UInt32) -> UnsafeMutablePointer<AudioBufferList> {
+        bufferList[0] = AudioBuffer(
+            mNumberChannels: 1,
+            mDataByteSize: frameCount * UInt32(MemoryLayout<Float>.size),
+            mData: UnsafeMutableRawPointer(samples)
+        )
+        return bufferList.unsafeMutablePointer
+    }
+}
+
+// Audio input callback function
+private func audioInputCallback(
+    inRefCon: UnsafeMutableRawPointer,
+    ioActionFlags: UnsafeMutablePointer<AudioUnitRenderActionFlags>,
+    inTimeStamp: UnsafePointer<AudioTimeStamp>,
+    inBusNumber: UInt32,
+    inNumberFrames: UInt32,
+    ioData: UnsafeMutablePointer<AudioBufferList>?
+) -> OSStatus {
+
+    let started = mach_absolute_time()
+    let pipeline = Unmanaged<CapturePipeline>.fromOpaque(inRefCon).takeUnretainedValue()
+
+    guard let unit = pipeline.audioUnit,
+          let arena = pipeline.captureArena,
+          Int(inNumberFrames) <= arena.capacity else { return noErr }
+
+    // Render audio straight into the preallocated arena
+    let status = AudioUnitRender(
+        unit,
+        ioActionFlags,
+        inTimeStamp,
+        inBusNumber,
+        inNumberFrames,
+        arena.prepare(frameCount: inNumberFrames)
+    )
+
+    if status == noErr, let worker = pipeline.worker {
+        let timeStamp = inTimeStamp.pointee
+        let hostTime = timeStamp.mFlags.contains(.hostTimeValid) ? timeStamp.mHostTime : 0
+        worker.enqueue(arena.samples, frameCount: inNumberFrames, hostTime: hostTime)
+        worker.recordCaptureCycle(since: started)
+    }
+
+    return noErr
+}
@@ -0,0 +1,55 @@
+import Foundation
+import MicNoiseGateDSP
+
+// A pipeline's capture trace, for replaying offline (Driver/replay)
+//
+// With `defaults write com.micnoisegate.app CaptureTrace ~/Desktop/traces`
+// every pipeline records what went into it and how the driver read its
+// ring: each input callback's rendered buffer with its host time, and each
+// client read the driver logged in the shared header. The trace goes to
+// capture-<device>-<unix time>.mngtrace in that directory. Recording only
+// copies into queues on the audio and processing threads; the DSP engine's
+// writer thread does the file IO (see MicNoiseGateDSP/TraceRecorder.hpp).
+final class CaptureTrace {
+    private let trace: OpaquePointer
+
+    // The directory from the `CaptureTrace` default, or nil if it isn't set
+    static var directory: URL? {
+        guard let path = UserDefaults.standard.string(forKey: "CaptureTrace"), !path.isEmpty else {
+            return nil
+        }
+        return URL(fileURLWithPath: (path as NSString).expandingTildeInPath, isDirectory: true)
+    }
+
+    // Starts a trace file for `deviceID` in `directory`; nil if it can't
+    // be created
+    init?(directory: URL, deviceID: UInt32, config: MNGTraceConfig) {
+        try? FileManager.default.createDirectory(at: directory, withIntermediateDirectories: true)
+        let name = "capture-\(deviceID)-\(Int(Date().timeIntervalSince1970)).mngtrace"
+        let url = directory.appendingPathComponent(name)
+
+        var config = config
+        guard let trace = mng_trace_create(url.path, &config) else {
+            print("Could not create capture trace \(url.path)")
+            return nil
+        }
+        self.trace = trace
+        print("Recording capture trace to \(url.path)")
+    }
+
+    // Writes out what is still queued; only once neither thread records
+    deinit {
+        mng_trace_destroy(trace)
+    }
+
+    // Input callback. Real-time safe.
+    func recordInput(_ samples: UnsafePointer<Float>, frameCount: UInt32, hostTime: UInt64) {
+        mng_trace_record_input(trace, samples, frameCount, hostTime)
+    }
+
+    // Processing thread: the reads logged in `header` since the last call.
+    // Real-time safe.
+    func recordReads(_ header: UnsafePointer<MNGSharedHeader>) {
+        mng_trace_record_reads(trace, header)
+    }
+}
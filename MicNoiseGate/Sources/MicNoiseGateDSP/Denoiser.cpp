@@ -0,0 +1,139 @@
+#include "Denoiser.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+#include "VectorMath.hpp"
+
+Denoiser::Denoiser(double inputRate, size_t maxInputFrames)
+    : maxInputFrames_(maxInputFrames) {
+    size_t resampledCapacity = maxInputFrames;
+    if (std::abs(inputRate - kSampleRate) > 1.0) {
+        resampler_ = std::make_unique<PolyphaseResampler>(inputRate, kSampleRate, maxInputFrames);
+        resampledCapacity = resampler_->maxOutputFrames(maxInputFrames);
+    }
+
+    // One callback at 48kHz, plus a frame's worth of leftovers
+    fifo_.assign(resampledCapacity + kFrameSize, 0.0f);
+    frame_.assign(kFrameSize, 0.0f);
+    gateFrame_.assign(kFrameSize, 0.0f);
+    resampled_.assign(resampledCapacity, 0.0f);
+}
+
+void Denoiser::setMode(Mode mode) {
+    mode_ = mode;
+    active_ = mode == Mode::SpectralGate ? static_cast<Suppressor*>(&spectralGate_) : &rnnoise_;
+    rnnoiseNanoseconds_ = 0.0;
+}
+
+size_t Denoiser::process(const float* input, size_t inputFrames, float* output, size_t capacity) {
+    if (!rnnoise_.ready() || inputFrames > maxInputFrames_) {
+        return 0;
+    }
+
+    if (resampler_) {
+        size_t count = resampler_->process(input, inputFrames, resampled_.data(), resampled_.size());
+        push(resampled_.data(), count);
+    } else {
+        push(input, inputFrames);
+    }
+
+    // The engines expect and return values in range [-32768, 32767]
+    // But our audio is in [-1, 1], so we scale in place
+    constexpr float kScaleUp = 32767.0f;
+    constexpr float kScaleDown = 1.0f / 32767.0f;
+
+    size_t produced = 0;
+    while (fifoCount_ >= kFrameSize && produced + kFrameSize <= capacity) {
+        pop(frame_.data(), kFrameSize);
+        float* out = output + produced;
+
+        if (gate_.shouldAnalyze(frame_.data(), kFrameSize)) {
+            vmath::scale(frame_.data(), kScaleUp, frame_.data(), kFrameSize);
+            voiceProbability_ = mode_ == Mode::Automatic && active_ == &rnnoise_
+                                    ? processAutomatic(frame_.data())
+                                    : active_->processFrame(frame_.data());
+            vmath::scale(frame_.data(), kScaleDown, out, kFrameSize);
+            gate_.update(voiceProbability_);
+        } else {
+            std::fill(out, out + kFrameSize, 0.0f);
+        }
+
+        // Fade to and from silence as the gate moves
+        if (gate_.enabled() || gateGain_.gain() != 1.0f) {
+            gateGain_.process(out, kFrameSize, gate_.isOpen() ? 1.0f : 0.0f);
+        }
+
+        produced += kFrameSize;
+    }
+
+    return produced;
+}
+
+float Denoiser::processAutomatic(float* frame) {
+    // The gate sees every frame too, so its noise floor and overlap are
+    // ready the moment it takes over and the switch doesn't click
+    std::memcpy(gateFrame_.data(), frame, kFrameSize * sizeof(float));
+    spectralGate_.processFrame(gateFrame_.data());
+
+    using Clock = std::chrono::steady_clock;
+    const auto start = Clock::now();
+    const float probability = rnnoise_.processFrame(frame);
+    const auto elapsed =
+        std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+
+    // Over about 32 frames, so one preempted frame doesn't decide it
+    rnnoiseNanoseconds_ += (elapsed - rnnoiseNanoseconds_) / 32.0;
+    if (rnnoiseNanoseconds_ > kAutomaticBudget) {
+        active_ = &spectralGate_;
+    }
+    return probability;
+}
+
+void Denoiser::reset() {
+    fifoStart_ = 0;
+    fifoCount_ = 0;
+    gate_.reset();
+    gateGain_.reset(1.0f);
+    voiceProbability_ = 0.0f;
+    if (resampler_) {
+        resampler_->reset();
+    }
+
+    rnnoise_.reset();
+    spectralGate_.reset();
+    setMode(mode_);
+}
+
+// Append to the FIFO in at most two contiguous copies
+void Denoiser::push(const float* samples, size_t count) {
+    const size_t capacity = fifo_.size();
+    count = std::min(count, capacity - fifoCount_);
+
+    size_t end = fifoStart_ + fifoCount_;
+    if (end >= capacity) {
+        end -= capacity;
+    }
+
+    size_t first = std::min(count, capacity - end);
+    std::memcpy(fifo_.data() + end, samples, first * sizeof(float));
+    std::memcpy(fifo_.data(), samples + first, (count - first) * sizeof(float));
+
+    fifoCount_ += count;
+}
+
+// Remove `count` samples from the front of the FIFO
+void Denoiser::pop(float* destination, size_t count) {
+    const size_t capacity = fifo_.size();
+    size_t first = std::min(count, capacity - fifoStart_);
+    std::memcpy(destination, fifo_.data() + fifoStart_, first * sizeof(float));
+    std::memcpy(destination + first, fifo_.data(), (count - first) * sizeof(float));
+
+    fifoStart_ += count;
+    if (fifoStart_ >= capacity) {
+        fifoStart_ -= capacity;
+    }
+    fifoCount_ -= count;
+}
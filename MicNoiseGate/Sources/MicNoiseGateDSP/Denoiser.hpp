@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "GainStage.hpp"
+#include "PolyphaseResampler.hpp"
+#include "SpectralGate.hpp"
+#include "Suppressor.hpp"
+#include "VoiceGate.hpp"
+
+// RNNoise frame wrapper
+//
+// RNNoise expects 480-sample frames of 48kHz Float32 scaled to the 16-bit
+// range. Input at other device rates goes through a PolyphaseResampler;
+// output stays at 48kHz, the rate of the shared ring. A circular FIFO holds
+// samples until a full frame is available.
+//
+// Frames go to one of two Suppressor engines: RNNoise, or the much cheaper
+// SpectralGate for machines where RNNoise can't keep up. In automatic mode
+// RNNoise's cost per frame is measured as it runs, and once its average
+// passes kAutomaticBudget the gate takes over for good (until reset()),
+// so quality drops a step instead of the audio glitching.
+//
+// All storage is allocated in the constructor for the largest callback the
+// caller will pass, so process() never allocates.
+class Denoiser {
+public:
+    static constexpr size_t kFrameSize = Suppressor::kFrameSize;
+    static constexpr double kSampleRate = 48000.0;
+
+    // Values match MNG_SUPPRESSOR_* in mng_dsp.h
+    enum class Mode { RNNoise = 0, SpectralGate = 1, Automatic = 2 };
+
+    // Average RNNoise time per 10ms frame, in nanoseconds, past which
+    // automatic mode falls back to the gate: a quarter of the frame, the
+    // share of its period the processing thread asks the scheduler for
+    static constexpr double kAutomaticBudget = 2.5e6;
+
+    Denoiser(double inputRate, size_t maxInputFrames);
+
+    Denoiser(const Denoiser&) = delete;
+    Denoiser& operator=(const Denoiser&) = delete;
+
+    // Largest number of samples one process() call can produce
+    size_t maxOutputFrames() const { return fifo_.size(); }
+
+    // Denoise `inputFrames` mono samples at the input rate (at most the
+    // constructor's maxInputFrames). Writes whole 48kHz frames to `output`
+    // and returns how many samples that was, possibly 0.
+    size_t process(const float* input, size_t inputFrames, float* output, size_t capacity);
+
+    // 48kHz samples waiting for a whole frame
+    size_t pendingFrames() const { return fifoCount_; }
+
+    // Drop buffered audio and start the engines from a fresh state; in
+    // automatic mode this goes back to RNNoise
+    void reset();
+
+    // Engine choice. Call before processing starts or from the processing
+    // thread.
+    void setMode(Mode mode);
+    Mode mode() const { return mode_; }
+
+    // The engine in use: RNNoise or SpectralGate, never Automatic
+    Mode activeEngine() const {
+        return active_ == &rnnoise_ ? Mode::RNNoise : Mode::SpectralGate;
+    }
+
+    // Power saving: during sustained non-speech, output silence and run
+    // RNNoise only often enough to notice speech coming back (see
+    // VoiceGate). Off by default.
+    void setPowerSaving(bool enabled) { gate_.setEnabled(enabled); }
+
+    // The gate has closed on non-speech and the output is silence
+    bool isIdle() const { return !gate_.isOpen(); }
+
+    // The active engine's voice probability for the last frame it analysed
+    float voiceProbability() const { return voiceProbability_; }
+
+private:
+    void push(const float* samples, size_t count);
+    void pop(float* destination, size_t count);
+
+    // Run RNNoise on `frame`, timing it and keeping the gate warm so it
+    // can take over from the next frame
+    float processAutomatic(float* frame);
+
+    RNNoiseSuppressor rnnoise_;
+    SpectralGate spectralGate_;
+    Suppressor* active_ = &rnnoise_;
+    Mode mode_ = Mode::RNNoise;
+    // Moving average of RNNoise's time per frame in automatic mode
+    double rnnoiseNanoseconds_ = 0.0;
+
+    size_t maxInputFrames_;
+
+    // Device rate -> 48kHz, null when the input already runs at 48kHz
+    std::unique_ptr<PolyphaseResampler> resampler_;
+
+    std::vector<float> fifo_;
+    size_t fifoStart_ = 0;
+    size_t fifoCount_ = 0;
+
+    VoiceGate gate_;
+    GainStage gateGain_;
+    float voiceProbability_ = 0.0f;
+
+    // One frame (processed in place), its copy for the gate in automatic
+    // mode, and the input at 48kHz
+    std::vector<float> frame_;
+    std::vector<float> gateFrame_;
+    std::vector<float> resampled_;
+};
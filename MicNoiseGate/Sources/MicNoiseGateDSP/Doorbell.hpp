@@ -0,0 +1,69 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+#include "shm_layout.h"
+
+#if defined(__APPLE__) && __has_include(<os/os_sync_wait_on_address.h>)
+#include <os/os_sync_wait_on_address.h>
+#define MNG_HAVE_OS_SYNC 1
+#else
+#define MNG_HAVE_OS_SYNC 0
+#endif
+
+// Cross-process wakeup on the header's doorbell word
+//
+// The consumer rings after it frees space; a producer that wants to know
+// sleeps until the word changes. On macOS 14.4 and later that is
+// os_sync_wait_on_address on the shared page, so the producer wakes as
+// soon as a period has been consumed. Older systems fall back to polling
+// the word every kPollInterval, which only costs latency.
+//
+// The consumer side is real-time safe: it makes the wake call only while
+// the producer has said it is waiting, so an idle doorbell costs one
+// atomic add.
+
+// Consumer: announce that readIndex moved
+inline void ringDoorbell(MNGSharedHeader* header) {
+    mng_shm_bump_doorbell(header);
+    if (!mng_shm_producer_waiting(header)) {
+        return;
+    }
+#if MNG_HAVE_OS_SYNC
+    if (__builtin_available(macOS 14.4, *)) {
+        os_sync_wake_by_address_any(&header->doorbell, sizeof(header->doorbell),
+                                    OS_SYNC_WAKE_BY_ADDRESS_SHARED);
+    }
+#endif
+}
+
+// Producer: sleep until the doorbell moves on from `seen` (a value read
+// before checking for work, so a ring in between isn't missed) or
+// `timeoutMicroseconds` pass. Not real-time safe.
+inline void waitOnDoorbell(MNGSharedHeader* header, uint32_t seen, uint32_t timeoutMicroseconds) {
+    constexpr auto kPollInterval = std::chrono::microseconds(1000);
+
+    mng_shm_set_producer_waiting(header, 1);
+
+#if MNG_HAVE_OS_SYNC
+    if (__builtin_available(macOS 14.4, *)) {
+        if (mng_shm_doorbell(header) == seen) {
+            os_sync_wait_on_address_with_timeout(&header->doorbell, seen, sizeof(header->doorbell),
+                                                 OS_SYNC_WAIT_ON_ADDRESS_SHARED,
+                                                 OS_CLOCK_MACH_ABSOLUTE_TIME,
+                                                 uint64_t(timeoutMicroseconds) * 1000);
+        }
+        mng_shm_set_producer_waiting(header, 0);
+        return;
+    }
+#endif
+
+    const auto deadline = std::chrono::steady_clock::now() +
+                          std::chrono::microseconds(timeoutMicroseconds);
+    while (mng_shm_doorbell(header) == seen && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(kPollInterval);
+    }
+    mng_shm_set_producer_waiting(header, 0);
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+
+// Output gain with a linear ramp on changes, so switching gain (muting,
+// gating, level trim) never steps the waveform
+class GainStage {
+public:
+    // Frames over which a gain change is spread (10ms at 48kHz)
+    static constexpr size_t kRampFrames = 480;
+
+    explicit GainStage(float gain = 1.0f) : current_(gain), target_(gain) {}
+
+    float gain() const { return current_; }
+
+    // Jump straight to `gain` (only when the output isn't audible)
+    void reset(float gain) {
+        current_ = gain;
+        target_ = gain;
+        remaining_ = 0;
+    }
+
+    // Apply gain in place, ramping from the current gain towards `target`
+    void process(float* samples, size_t count, float target) {
+        if (target != target_) {
+            target_ = target;
+            remaining_ = kRampFrames;
+        }
+
+        size_t ramp = std::min(count, remaining_);
+        if (ramp > 0) {
+            const float step = (target_ - current_) / float(remaining_);
+            for (size_t i = 0; i < ramp; ++i) {
+                samples[i] *= current_ + step * float(i + 1);
+            }
+            remaining_ -= ramp;
+            current_ = remaining_ == 0 ? target_ : current_ + step * float(ramp);
+        }
+
+        const float gain = current_;
+        for (size_t i = ramp; i < count; ++i) {
+            samples[i] *= gain;
+        }
+    }
+
+private:
+    float current_;
+    float target_;
+    size_t remaining_ = 0;
+};
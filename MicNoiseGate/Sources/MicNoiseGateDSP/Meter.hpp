@@ -0,0 +1,77 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+
+#include "TripleBuffer.hpp"
+#include "VectorMath.hpp"
+
+// Level and waveform measurement for the UI meters
+namespace meter {
+
+// Buckets in a reading's waveform envelope
+constexpr size_t kPoints = 100;
+
+// One block's meter data: peak and RMS, and the smallest and largest
+// sample of each of kPoints equal slices, for drawing the waveform
+struct Reading {
+    float peak = 0.0f;
+    float rms = 0.0f;
+    float minimum[kPoints] = {};
+    float maximum[kPoints] = {};
+};
+
+inline void measure(const float* samples, size_t count, Reading& reading) {
+    if (count == 0) {
+        reading = Reading();
+        return;
+    }
+
+    float lowest, highest;
+    vmath::minMax(samples, count, lowest, highest);
+    reading.peak = std::max(-lowest, highest);
+    reading.rms = std::sqrt(vmath::sumOfSquares(samples, count) / float(count));
+
+    // A block shorter than kPoints repeats its samples across buckets
+    for (size_t i = 0; i < kPoints; ++i) {
+        const size_t begin = std::min(i * count / kPoints, count - 1);
+        const size_t end = std::max(begin + 1, (i + 1) * count / kPoints);
+        vmath::minMax(samples + begin, end - begin, reading.minimum[i], reading.maximum[i]);
+    }
+}
+
+// Meter for one signal, measured on the audio side and read by the UI
+//
+// Disabled while nothing shows it, in which case update() returns at once.
+class ChannelMeter {
+public:
+    void setEnabled(bool enabled) { enabled_.store(enabled, std::memory_order_relaxed); }
+
+    // Audio side (one thread at a time). Real-time safe.
+    void update(const float* samples, size_t count) {
+        if (!enabled_.load(std::memory_order_relaxed)) {
+            return;
+        }
+        measure(samples, count, readings_.back());
+        readings_.publish();
+    }
+
+    // Publish silence; from the thread that calls update(), or while none does
+    void reset() {
+        readings_.back() = Reading();
+        readings_.publish();
+    }
+
+    // UI side: the newest reading, if there is one it hasn't seen
+    const Reading* read() {
+        return readings_.update() ? &readings_.front() : nullptr;
+    }
+
+private:
+    std::atomic<bool> enabled_{false};
+    TripleBuffer<Reading> readings_;
+};
+
+}  // namespace meter
@@ -0,0 +1,157 @@
+#include "PolyphaseResampler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <numeric>
+#include <utility>
+
+#include "VectorMath.hpp"
+
+namespace {
+
+using FilterBank = std::shared_ptr<const std::vector<float>>;
+
+constexpr double kCommonRates[] = {16000.0, 44100.0, 96000.0};
+constexpr double kRingRate = 48000.0;
+
+// L/M in lowest terms. Rates that don't reduce to a reasonable number of
+// phases are approximated; the driver's drift control absorbs the tiny
+// rate error that leaves.
+std::pair<uint32_t, uint32_t> reducedRatio(double inputRate, double outputRate) {
+    uint64_t up = uint64_t(std::llround(outputRate));
+    uint64_t down = uint64_t(std::llround(inputRate));
+    uint64_t divisor = std::max<uint64_t>(std::gcd(up, down), 1);
+    up /= divisor;
+    down /= divisor;
+
+    if (up > PolyphaseResampler::kMaxPhases) {
+        down = std::max<uint64_t>(
+            1, uint64_t(std::llround(double(down) * PolyphaseResampler::kMaxPhases / double(up))));
+        up = PolyphaseResampler::kMaxPhases;
+    }
+    return {uint32_t(std::max<uint64_t>(up, 1)), uint32_t(std::max<uint64_t>(down, 1))};
+}
+
+double besselI0(double x) {
+    double sum = 1.0;
+    double term = 1.0;
+    double half = x / 2.0;
+    for (int k = 1; k < 32; ++k) {
+        term *= (half / k) * (half / k);
+        sum += term;
+        if (term < sum * 1e-12) {
+            break;
+        }
+    }
+    return sum;
+}
+
+// Kaiser-windowed sinc low-pass at the lower of the two Nyquist rates,
+// split into phases
+FilterBank designFilterBank(uint32_t up, uint32_t down) {
+    constexpr size_t taps = PolyphaseResampler::kTapsPerPhase;
+    const size_t length = size_t(up) * taps;
+    const double center = double(length - 1) / 2.0;
+
+    // Cutoff in cycles per upsampled sample, with ~9% transition band
+    const double cutoff = 0.5 / double(std::max(up, down)) * 0.91;
+    const double beta = 8.0;
+    const double windowNorm = besselI0(beta);
+
+    std::vector<double> prototype(length);
+    for (size_t i = 0; i < length; ++i) {
+        double t = double(i) - center;
+        double x = 2.0 * cutoff * t;
+        double sinc = x == 0.0 ? 1.0 : std::sin(M_PI * x) / (M_PI * x);
+        double r = t / center;
+        double window = besselI0(beta * std::sqrt(std::max(0.0, 1.0 - r * r))) / windowNorm;
+        // Scale by L to make up for the zeros the upsampling inserts
+        prototype[i] = 2.0 * cutoff * sinc * window * double(up);
+    }
+
+    // Phase p uses prototype[p + k * L]; store it reversed in k
+    auto bank = std::make_shared<std::vector<float>>(length);
+    for (size_t phase = 0; phase < up; ++phase) {
+        for (size_t j = 0; j < taps; ++j) {
+            size_t k = taps - 1 - j;
+            (*bank)[phase * taps + j] = float(prototype[phase + k * up]);
+        }
+    }
+    return bank;
+}
+
+// Filter banks are shared by every resampler with the same ratio; the
+// common device rates are built once on first use
+FilterBank filterBank(uint32_t up, uint32_t down) {
+    static std::mutex mutex;
+    static std::map<std::pair<uint32_t, uint32_t>, FilterBank> cache;
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (cache.empty()) {
+        for (double rate : kCommonRates) {
+            for (auto [from, to] : {std::pair{rate, kRingRate}, std::pair{kRingRate, rate}}) {
+                auto key = reducedRatio(from, to);
+                cache[key] = designFilterBank(key.first, key.second);
+            }
+        }
+    }
+
+    auto& bank = cache[{up, down}];
+    if (!bank) {
+        bank = designFilterBank(up, down);
+    }
+    return bank;
+}
+
+}  // namespace
+
+PolyphaseResampler::PolyphaseResampler(double inputRate, double outputRate, size_t maxInputFrames)
+    : maxInputFrames_(maxInputFrames),
+      work_(kHistoryLength + maxInputFrames, 0.0f) {
+    std::tie(upFactor_, downFactor_) = reducedRatio(inputRate, outputRate);
+    filters_ = filterBank(upFactor_, downFactor_);
+    position_ = uint64_t(kHistoryLength) * upFactor_;
+}
+
+size_t PolyphaseResampler::process(const float* input, size_t inputFrames,
+                                   float* output, size_t capacity) {
+    const size_t count = std::min(inputFrames, maxInputFrames_);
+    float* work = work_.data();
+    const float* bank = filters_->data();
+
+    std::memcpy(work + kHistoryLength, input, count * sizeof(float));
+
+    const uint64_t available = kHistoryLength + count;
+    size_t produced = 0;
+
+    while (produced < capacity) {
+        // Newest input sample this output depends on
+        uint64_t newest = position_ / upFactor_;
+        if (newest >= available) {
+            break;
+        }
+
+        uint64_t phase = position_ - newest * upFactor_;
+        output[produced++] = vmath::dot(work + (newest - kHistoryLength),
+                                        bank + phase * kTapsPerPhase, kTapsPerPhase);
+        position_ += downFactor_;
+    }
+
+    // Keep the last kTapsPerPhase - 1 samples as history for the next call
+    std::memmove(work, work + count, kHistoryLength * sizeof(float));
+
+    const uint64_t consumed = uint64_t(count) * upFactor_;
+    const uint64_t start = uint64_t(kHistoryLength) * upFactor_;
+    position_ = position_ >= consumed + start ? position_ - consumed : start;
+
+    return produced;
+}
+
+void PolyphaseResampler::reset() {
+    std::fill(work_.begin(), work_.end(), 0.0f);
+    position_ = uint64_t(kHistoryLength) * upFactor_;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Stateful band-limited resampler using a polyphase FIR filter bank
+//
+// Conceptually upsamples by L, low-pass filters, and decimates by M, where
+// L/M is the reduced ratio of the two rates (160/147 for 44.1k -> 48k,
+// 3/1 for 16k -> 48k, 1/2 for 96k -> 48k). Only the filter phase that
+// lands on each output sample is evaluated, as one kTapsPerPhase dot
+// product, so the cost per output sample is fixed whatever the ratio. The
+// last few input samples are carried between calls so buffer edges join
+// seamlessly.
+//
+// Construction designs (or looks up) the filter bank and allocates; only
+// process() and reset() are real-time safe.
+class PolyphaseResampler {
+public:
+    // Taps evaluated per output sample
+    static constexpr size_t kTapsPerPhase = 32;
+
+    // Rates we have to approximate get at most this many phases
+    static constexpr uint32_t kMaxPhases = 1024;
+
+    PolyphaseResampler(double inputRate, double outputRate, size_t maxInputFrames);
+
+    // Output capacity needed for a call with `inputFrames` samples
+    size_t maxOutputFrames(size_t inputFrames) const {
+        return (inputFrames * upFactor_ + downFactor_ - 1) / downFactor_ + 1;
+    }
+
+    size_t maxInputFrames() const { return maxInputFrames_; }
+
+    // Fewest input frames the next call needs to produce `outputFrames`.
+    // When downsampling, exactly that many outputs come out.
+    size_t inputFramesFor(size_t outputFrames) const {
+        if (outputFrames == 0) {
+            return 0;
+        }
+        uint64_t newest = (position_ + uint64_t(outputFrames - 1) * downFactor_) / upFactor_;
+        return newest + 1 > kHistoryLength ? size_t(newest + 1 - kHistoryLength) : 0;
+    }
+
+    // Resample `inputFrames` mono samples (at most maxInputFrames()) into
+    // `output`. Returns the number of samples written.
+    size_t process(const float* input, size_t inputFrames, float* output, size_t capacity);
+
+    // Forget the carried history
+    void reset();
+
+private:
+    static constexpr size_t kHistoryLength = kTapsPerPhase - 1;
+
+    uint32_t upFactor_;    // L
+    uint32_t downFactor_;  // M
+    size_t maxInputFrames_;
+
+    // upFactor_ phases of kTapsPerPhase coefficients, each stored
+    // time-reversed so the dot product runs over input in ascending order.
+    // Shared by every resampler with the same ratio.
+    std::shared_ptr<const std::vector<float>> filters_;
+
+    // History followed by the current input
+    std::vector<float> work_;
+
+    // Position of the next output, in upsampled samples from work_[0]
+    uint64_t position_;
+};
@@ -0,0 +1,244 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+
+#include "SharedMemory.hpp"
+
+// Hands a virtual mic's ring from one producer to the next without a gap
+//
+// Every producer (one capture pipeline's processing thread) holds a token,
+// and only the owner's writes reach the ring. When the mic moves to a new
+// device, the new pipeline starts as the incoming producer while the old
+// one keeps writing:
+//
+//   1. begin() names the incoming token; the owner opens a private ring on
+//      its next block, and from then on the incoming producer feed()s its
+//      output there instead of into the shared ring.
+//   2. Once a burst's worth of it is queued (the margin given to begin();
+//      anything older is skipped), the owner mix()es it into its own
+//      blocks, fading from its signal to the incoming one over kFadeFrames.
+//   3. At the end of the fade the incoming producer becomes the owner. It
+//      drain()s what is left in the private ring into the shared ring, in
+//      order, then carries on writing there itself.
+//
+// The shared ring never stops being written and its active flag never
+// drops, so the driver keeps serving clients from the same timeline. If the
+// owner never gets to the fade (its device went away), the setup thread
+// stops it and abandon()s: the incoming producer takes over at once, with
+// a short fade-in instead of the crossfade.
+//
+// One handoff at a time, started and abandoned from one setup thread; the
+// processing threads only ever call the methods for their current role.
+class ProducerHandoff {
+public:
+    // Crossfade length (100ms at 48kHz)
+    static constexpr uint32_t kFadeFrames = 4800;
+
+    // Fade-in after an abandoned handoff (10ms)
+    static constexpr uint32_t kRampFrames = 480;
+
+    // Private ring, and the most backlog the fade may start with
+    static constexpr uint32_t kRingFrames = 16384;
+    static constexpr uint32_t kMaxMarginFrames = kRingFrames / 4;
+
+    enum class Role { Owner = 0, Incoming = 1, Retired = 2 };
+
+    ProducerHandoff()
+        : ring_(static_cast<SharedAudioBuffer*>(std::aligned_alloc(
+              kCacheLineSize, SharedAudioBuffer::totalSize(kRingFrames, MNG_SAMPLE_FLOAT32)))) {
+        if (ring_) {
+            mng_shm_initialize(ring_, kRingFrames, MNG_SAMPLE_FLOAT32);
+            mng_shm_set_active(ring_, 1);
+        }
+    }
+
+    ~ProducerHandoff() { std::free(ring_); }
+
+    ProducerHandoff(const ProducerHandoff&) = delete;
+    ProducerHandoff& operator=(const ProducerHandoff&) = delete;
+
+    // MARK: Setup thread
+
+    // Become the owner outright, for a producer starting on an idle ring
+    uint32_t claim() {
+        const uint32_t token = nextToken();
+        rampPosition_ = kRampFrames;
+        skipLeftover_ = false;
+        state_.store(kIdle, std::memory_order_relaxed);
+        incoming_.store(0, std::memory_order_relaxed);
+        owner_.store(token, std::memory_order_release);
+        return token;
+    }
+
+    // Start handing over to a new producer, which expects to write in
+    // bursts of up to `marginFrames`. Returns its token, or 0 if the
+    // private ring couldn't be allocated.
+    uint32_t begin(uint32_t marginFrames) {
+        if (!ring_) {
+            return 0;
+        }
+        const uint32_t token = nextToken();
+        margin_ = std::min(marginFrames, kMaxMarginFrames);
+        // Whoever sees the token sees the request, so the incoming
+        // producer can't feed the ring before the owner has opened it
+        state_.store(kRequested, std::memory_order_release);
+        incoming_.store(token, std::memory_order_release);
+        return token;
+    }
+
+    // The incoming producer hasn't taken over yet
+    bool pending() const {
+        const uint32_t incoming = incoming_.load(std::memory_order_acquire);
+        return incoming != 0 && owner_.load(std::memory_order_acquire) != incoming;
+    }
+
+    // Give the ring to the incoming producer now. Only once the owner's
+    // thread has stopped.
+    void abandon() {
+        if (!pending()) {
+            return;
+        }
+        rampPosition_ = 0;
+        skipLeftover_ = true;
+        state_.store(kIdle, std::memory_order_relaxed);
+        owner_.store(incoming_.load(std::memory_order_relaxed), std::memory_order_release);
+    }
+
+    // MARK: Processing threads
+
+    // Real-time safe, from any thread
+    Role role(uint32_t token) const {
+        if (owner_.load(std::memory_order_acquire) == token) {
+            return Role::Owner;
+        }
+        return incoming_.load(std::memory_order_acquire) == token ? Role::Incoming : Role::Retired;
+    }
+
+    // Owner: the block about to be written, faded towards the incoming
+    // producer's signal while a handoff runs. Real-time safe.
+    void mix(float* samples, uint32_t count) {
+        if (rampPosition_ < kRampFrames) {
+            fadeIn(samples, count);
+        }
+
+        const uint32_t state = state_.load(std::memory_order_acquire);
+        if (state == kRequested) {
+            // Nobody else touches the private ring until it opens
+            mng_shm_initialize(ring_, kRingFrames, MNG_SAMPLE_FLOAT32);
+            mng_shm_set_active(ring_, 1);
+            fadePosition_ = 0;
+            state_.store(kOpen, std::memory_order_release);
+            return;
+        }
+        if (state == kOpen) {
+            const uint64_t queued = ring_->fillLevel();
+            if (queued < margin_) {
+                return;
+            }
+            ring_->skip(queued - margin_);
+            state_.store(kMixing, std::memory_order_relaxed);
+        } else if (state != kMixing) {
+            return;
+        }
+
+        crossfade(samples, count);
+        if (fadePosition_ >= kFadeFrames) {
+            rampPosition_ = kRampFrames;
+            skipLeftover_ = false;
+            state_.store(kIdle, std::memory_order_relaxed);
+            owner_.store(incoming_.load(std::memory_order_relaxed), std::memory_order_release);
+        }
+    }
+
+    // Incoming: queue a block for the owner to fade to. Blocks from before
+    // the private ring opens, or that find it full, are dropped. Real-time
+    // safe.
+    void feed(const float* samples, uint32_t count) {
+        if (state_.load(std::memory_order_acquire) != kRequested) {
+            ring_->writeMono(samples, count);
+        }
+    }
+
+    // New owner, straight after taking over: the frames the old owner
+    // didn't fade through, up to `capacity` at a time; 0 once there are
+    // none. Real-time safe.
+    uint32_t drain(float* samples, uint32_t capacity) {
+        if (!ring_) {
+            return 0;
+        }
+        if (skipLeftover_) {
+            // Queued before the old owner stopped, so long stale
+            ring_->skip(ring_->fillLevel());
+            skipLeftover_ = false;
+            return 0;
+        }
+        return uint32_t(ring_->read(samples, capacity));
+    }
+
+private:
+    static constexpr uint32_t kIdle = 0;
+    static constexpr uint32_t kRequested = 1;
+    static constexpr uint32_t kOpen = 2;
+    static constexpr uint32_t kMixing = 3;
+
+    static constexpr uint32_t kChunkFrames = 512;
+
+    uint32_t nextToken() {
+        token_ = token_ == UINT32_MAX ? 1 : token_ + 1;
+        return token_;
+    }
+
+    // Linear, since the two mics usually hear the same voice: an
+    // equal-power curve would bump its level mid-fade. If the incoming
+    // producer falls behind, its share is silent until it catches up.
+    void crossfade(float* samples, uint32_t count) {
+        constexpr float kStep = 1.0f / float(kFadeFrames);
+        uint32_t done = 0;
+        while (done < count) {
+            const auto chunk = uint32_t(ring_->read(scratch_, std::min(kChunkFrames, count - done)));
+            if (chunk == 0) {
+                break;
+            }
+            float* out = samples + done;
+            const float start = float(fadePosition_);
+            for (uint32_t i = 0; i < chunk; ++i) {
+                const float share = std::min(1.0f, (start + float(i + 1)) * kStep);
+                out[i] += share * (scratch_[i] - out[i]);
+            }
+            fadePosition_ = std::min<uint64_t>(fadePosition_ + chunk, kFadeFrames);
+            done += chunk;
+        }
+
+        const float share = float(fadePosition_) * kStep;
+        for (uint32_t i = done; i < count; ++i) {
+            samples[i] *= 1.0f - share;
+        }
+    }
+
+    void fadeIn(float* samples, uint32_t count) {
+        constexpr float kStep = 1.0f / float(kRampFrames);
+        const uint32_t ramp = std::min(count, kRampFrames - rampPosition_);
+        for (uint32_t i = 0; i < ramp; ++i) {
+            samples[i] *= float(rampPosition_ + i + 1) * kStep;
+        }
+        rampPosition_ += ramp;
+    }
+
+    SharedAudioBuffer* ring_;
+    float scratch_[kChunkFrames] = {};
+
+    std::atomic<uint32_t> owner_{0};
+    std::atomic<uint32_t> incoming_{0};
+    std::atomic<uint32_t> state_{kIdle};
+
+    uint32_t token_ = 0;       // Setup thread
+    uint32_t margin_ = 0;      // Set before kRequested is published
+    uint64_t fadePosition_ = 0;
+
+    // Passed from owner to owner along with owner_
+    uint32_t rampPosition_ = kRampFrames;
+    bool skipLeftover_ = false;
+};
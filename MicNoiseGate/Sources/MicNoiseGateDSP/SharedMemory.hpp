@@ -0,0 +1,354 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "Doorbell.hpp"
+#include "VectorMath.hpp"
+#include "shm_layout.h"
+
+// Shared memory configuration (defined in shm_layout.h, shared with the app)
+constexpr const char* kSharedMemoryName = MNG_SHM_NAME;
+constexpr uint32_t kDefaultRingFrames = MNG_RING_FRAMES;  // Capacity unless the app picks one
+constexpr size_t kChannels = MNG_CHANNELS;                // Mono
+constexpr size_t kSampleRate = MNG_SAMPLE_RATE;           // 48kHz
+constexpr size_t kCacheLineSize = MNG_CACHE_LINE_SIZE;
+
+// Segment backing virtual mic `device`
+inline std::string sharedMemoryName(uint32_t device) {
+    char name[MNG_SHM_NAME_MAX];
+    mng_shm_device_name(device, name, sizeof(name));
+    return name;
+}
+
+static_assert(sizeof(MNGSharedHeader) % kCacheLineSize == 0,
+              "ring data must start on a cache line");
+
+// One consumer's position in a ring
+//
+// A ring read by several consumers (one per client of the virtual mic)
+// gives each its own cursor; the slowest one is published as the header's
+// readIndex so the producer never overwrites frames someone still needs.
+// The producer's writeIndex stays shared, so every frame is written once.
+struct RingCursor {
+    uint64_t position = 0;
+    uint64_t cachedWriteIndex = 0;  // Last writeIndex seen, saves reloading it
+};
+
+// How a ring's storage is laid out, as its header described it at one
+// moment. A consumer of a segment another process writes takes this when
+// it maps the segment and indexes the ring with it from then on, so a
+// header rewritten under it can't send a read past the mapping.
+struct RingLayout {
+    uint64_t frames = 0;
+    uint32_t sampleFormat = MNG_SAMPLE_FLOAT32;
+    uint32_t channels = 0;
+
+    bool operator==(const RingLayout& other) const {
+        return frames == other.frames && sampleFormat == other.sampleFormat &&
+               channels == other.channels;
+    }
+    bool operator!=(const RingLayout& other) const { return !(*this == other); }
+};
+
+// Lock-free ring buffer over the shared segment
+//
+// Adds the ring operations on top of the C header layout; it has no data
+// members of its own, so a pointer to the mapped segment can be used as a
+// SharedAudioBuffer directly.
+struct SharedAudioBuffer : MNGSharedHeader {
+    // Calculate total size for a ring of `frames` in `format`
+    static size_t totalSize(uint32_t frames = kDefaultRingFrames,
+                            uint32_t format = MNG_SAMPLE_FLOAT32) {
+        return mng_shm_total_size(frames, format);
+    }
+
+    // Ring capacity in frames, a power of two that the header validates
+    uint64_t capacity() const { return bufferFrames; }
+
+    // The header's layout as it is now
+    RingLayout layout() const { return {bufferFrames, sampleFormat, channels}; }
+
+    // Ring storage, as floats or Int16 depending on sampleFormat. Callers
+    // read and write floats either way; the ring converts.
+    float* audioData() { return mng_shm_audio(this); }
+    const float* audioData() const { return mng_shm_audio(const_cast<SharedAudioBuffer*>(this)); }
+    int16_t* int16Data() { return mng_shm_audio_int16(this); }
+    const int16_t* int16Data() const {
+        return mng_shm_audio_int16(const_cast<SharedAudioBuffer*>(this));
+    }
+
+    bool active() const { return mng_shm_is_active(this); }
+
+    // The header still matches this build (the app invalidates it while it
+    // re-initializes or replaces the segment). Whoever maps the segment
+    // checks it against the mapping's size; this only checks it is
+    // consistent with its own capacity.
+    bool isValid() const {
+        return mng_shm_validate(this, totalSize(bufferFrames, sampleFormat)) == MNGShmStatusValid;
+    }
+
+    // Valid, and still laid out as `expected` (a snapshot from when the
+    // segment was mapped)
+    bool isValid(const RingLayout& expected) const {
+        return mng_shm_validate(this, totalSize(uint32_t(expected.frames), expected.sampleFormat)) ==
+                   MNGShmStatusValid &&
+               layout() == expected;
+    }
+
+    // Get available frames to read (consumer side)
+    // Answers from the cached writeIndex while it covers `needed` frames and
+    // only reloads the producer's line when it doesn't.
+    uint64_t availableToRead(RingCursor& cursor, uint64_t needed = 1) const {
+        uint64_t available = cursor.cachedWriteIndex - cursor.position;
+        if (available < needed) {
+            cursor.cachedWriteIndex = mng_shm_load_write_index(this);
+            available = cursor.cachedWriteIndex - cursor.position;
+        }
+        return available;
+    }
+
+    // Exact fill level (consumer side), for latency control. Always loads
+    // the producer's index, so call it once per IO cycle at most.
+    uint64_t fillLevel(RingCursor& cursor) const {
+        cursor.cachedWriteIndex = mng_shm_load_write_index(this);
+        return cursor.cachedWriteIndex - cursor.position;
+    }
+
+    // Drop frames without copying them (consumer side)
+    void skip(RingCursor& cursor, uint64_t frameCount) const {
+        cursor.position += std::min(frameCount, availableToRead(cursor, frameCount));
+    }
+
+    // Start a new cursor at the newest frame, with nothing to read yet
+    void attach(RingCursor& cursor) const {
+        cursor.position = cursor.cachedWriteIndex = mng_shm_load_write_index(this);
+    }
+
+    // Move a cursor to `position`, kept between readIndex (frames before it
+    // may already be reused) and the newest frame
+    void seek(RingCursor& cursor, int64_t position) const {
+        const uint64_t oldest = mng_shm_load_read_index(this);
+        cursor.cachedWriteIndex = mng_shm_load_write_index(this);
+        cursor.position = uint64_t(std::clamp<int64_t>(position, int64_t(oldest),
+                                                       int64_t(cursor.cachedWriteIndex)));
+    }
+
+    // Read up to `frameCount` audio frames at `cursor` (consumer side)
+    // Returns the number of frames actually read; the caller decides what
+    // to put in the rest of its buffer. The producer only sees the cursor
+    // once it is published with publishReadIndex().
+    uint64_t read(RingCursor& cursor, float* samples, uint64_t frameCount) const {
+        return read(layout(), cursor, samples, frameCount);
+    }
+
+    // The same, indexing the ring as `ring` says rather than by the header
+    uint64_t read(const RingLayout& ring, RingCursor& cursor, float* samples,
+                  uint64_t frameCount) const {
+        if (ring.channels == 0 || ring.channels > kChannels) {
+            return 0;  // Header describes a layout we can't hold
+        }
+
+        // The producer's index is not to be trusted with more than one lap
+        frameCount = std::min({frameCount, availableToRead(cursor, frameCount), ring.frames});
+        if (frameCount == 0) {
+            return 0;
+        }
+
+        if (ring.channels == kChannels) {
+            copyFromRing<kChannels>(ring, samples, cursor.position, frameCount);
+        } else {
+            copyFromRing<kRuntimeChannels>(ring, samples, cursor.position, frameCount);
+        }
+
+        cursor.position += frameCount;
+        return frameCount;
+    }
+
+    // Let the producer reuse everything before `position`, waking it if it
+    // is waiting for room
+    void publishReadIndex(uint64_t position) {
+        if (position == readIndex) {
+            return;
+        }
+        mng_shm_store_read_index(this, position);
+        ringDoorbell(this);
+    }
+
+    // Single-reader versions that keep the cursor in the header itself
+    uint64_t availableToRead(uint64_t needed = 1) {
+        return consume([&](RingCursor& cursor) { return availableToRead(cursor, needed); });
+    }
+
+    uint64_t fillLevel() {
+        return consume([&](RingCursor& cursor) { return fillLevel(cursor); });
+    }
+
+    void skip(uint64_t frameCount) {
+        consume([&](RingCursor& cursor) { skip(cursor, frameCount); return 0; });
+    }
+
+    uint64_t read(float* samples, uint64_t frameCount) {
+        return read(layout(), samples, frameCount);
+    }
+
+    uint64_t read(const RingLayout& ring, float* samples, uint64_t frameCount) {
+        return consume([&](RingCursor& cursor) { return read(ring, cursor, samples, frameCount); });
+    }
+
+    // Get available space to write (producer side)
+    uint64_t availableToWrite(uint64_t needed = 1) {
+        uint64_t write = writeIndex;
+        uint64_t available = capacity() - (write - cachedReadIndex);
+        if (available < needed) {
+            cachedReadIndex = mng_shm_load_read_index(this);
+            available = capacity() - (write - cachedReadIndex);
+        }
+        return available;
+    }
+
+    // Write audio frames (producer - app side)
+    bool write(const float* samples, uint64_t frameCount) {
+        const RingLayout ring = layout();
+        if (ring.channels == 0 || ring.channels > kChannels) {
+            return false;  // Header describes a layout we can't hold
+        }
+        if (availableToWrite(frameCount) < frameCount) {
+            return false;  // Buffer full
+        }
+
+        uint64_t writePos = writeIndex;
+
+        if (ring.channels == kChannels) {
+            copyToRing<kChannels>(ring, samples, writePos, frameCount);
+        } else {
+            copyToRing<kRuntimeChannels>(ring, samples, writePos, frameCount);
+        }
+
+        mng_shm_store_write_index(this, writePos + frameCount);
+        return true;
+    }
+
+    // Write mono frames, duplicated into every channel (producer - app side)
+    bool writeMono(const float* samples, uint64_t frameCount) {
+        const RingLayout ring = layout();
+        if (ring.channels == 0 || ring.channels > kChannels) {
+            return false;
+        }
+        if (availableToWrite(frameCount) < frameCount) {
+            return false;  // Buffer full
+        }
+
+        uint64_t writePos = writeIndex;
+        uint64_t start, first, second;
+        splitAtWrap(ring, writePos, frameCount, start, first, second);
+
+        if (ring.channels == kChannels) {
+            fanOut<kChannels>(ring, samples, start * kChannels, first);
+            fanOut<kChannels>(ring, samples + first, 0, second);
+        } else {
+            fanOut<kRuntimeChannels>(ring, samples, start * ring.channels, first);
+            fanOut<kRuntimeChannels>(ring, samples + first, 0, second);
+        }
+
+        mng_shm_store_write_index(this, writePos + frameCount);
+        return true;
+    }
+
+private:
+    // Run `body` on the header's own consumer state and write back what it
+    // changed, publishing a moved read index
+    template <typename Body>
+    uint64_t consume(Body body) {
+        RingCursor cursor{readIndex, cachedWriteIndex};
+        uint64_t result = body(cursor);
+        cachedWriteIndex = cursor.cachedWriteIndex;
+        publishReadIndex(cursor.position);
+        return result;
+    }
+
+    // Template argument for the copy helpers meaning "use the runtime
+    // channel count from the layout"
+    static constexpr uint32_t kRuntimeChannels = 0;
+
+    // A request never spans more than one wrap of the ring, so it splits
+    // into at most two contiguous runs: [start, end of ring) and [0, rest).
+    static void splitAtWrap(const RingLayout& ring, uint64_t position, uint64_t frameCount,
+                            uint64_t& start, uint64_t& first, uint64_t& second) {
+        start = position & (ring.frames - 1);
+        first = ring.frames - start;
+        if (first > frameCount) {
+            first = frameCount;
+        }
+        second = frameCount - first;
+    }
+
+    // Move `count` contiguous samples between the caller's floats and ring
+    // sample `offset`: a memcpy for a Float32 ring, a vectorized narrow or
+    // widen for an Int16 one
+    void storeSamples(const RingLayout& ring, const float* samples, uint64_t offset,
+                      uint64_t count) {
+        if (ring.sampleFormat == MNG_SAMPLE_INT16) {
+            vmath::floatToInt16(samples, int16Data() + offset, count);
+        } else {
+            std::memcpy(audioData() + offset, samples, count * sizeof(float));
+        }
+    }
+
+    void loadSamples(const RingLayout& ring, float* samples, uint64_t offset,
+                     uint64_t count) const {
+        if (ring.sampleFormat == MNG_SAMPLE_INT16) {
+            vmath::int16ToFloat(int16Data() + offset, samples, count);
+        } else {
+            std::memcpy(samples, audioData() + offset, count * sizeof(float));
+        }
+    }
+
+    // With Channels known at compile time (the mono layout the app writes)
+    // the span sizes fold into constant-stride copies.
+    template <uint32_t Channels>
+    void copyToRing(const RingLayout& ring, const float* samples, uint64_t position,
+                    uint64_t frameCount) {
+        const uint64_t stride = Channels != kRuntimeChannels ? Channels : ring.channels;
+        uint64_t start, first, second;
+        splitAtWrap(ring, position, frameCount, start, first, second);
+
+        storeSamples(ring, samples, start * stride, first * stride);
+        if (second > 0) {
+            storeSamples(ring, samples + first * stride, 0, second * stride);
+        }
+    }
+
+    // Mono samples into every channel of the frames from ring sample `offset`
+    template <uint32_t Channels>
+    void fanOut(const RingLayout& ring, const float* samples, uint64_t offset,
+                uint64_t frameCount) {
+        const uint64_t stride = Channels != kRuntimeChannels ? Channels : ring.channels;
+        if (stride == 1) {
+            storeSamples(ring, samples, offset, frameCount);
+            return;
+        }
+        for (uint64_t i = 0; i < frameCount; ++i) {
+            for (uint64_t ch = 0; ch < stride; ++ch) {
+                storeSamples(ring, samples + i, offset + i * stride + ch, 1);
+            }
+        }
+    }
+
+    template <uint32_t Channels>
+    void copyFromRing(const RingLayout& ring, float* samples, uint64_t position,
+                      uint64_t frameCount) const {
+        const uint64_t stride = Channels != kRuntimeChannels ? Channels : ring.channels;
+        uint64_t start, first, second;
+        splitAtWrap(ring, position, frameCount, start, first, second);
+
+        loadSamples(ring, samples, start * stride, first * stride);
+        if (second > 0) {
+            loadSamples(ring, samples + first * stride, 0, second * stride);
+        }
+    }
+};
+
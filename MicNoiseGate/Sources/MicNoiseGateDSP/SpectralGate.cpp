@@ -0,0 +1,233 @@
+#include "SpectralGate.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "VectorMath.hpp"
+
+namespace {
+
+// Per-frame smoothing of the power the gains follow, and of the slower
+// copy the noise tracker takes its minimum of
+constexpr float kPowerSmoothing = 0.5f;
+constexpr float kNoiseSmoothing = 0.1f;
+
+// Noise-floor rise per frame (about 1dB a second at 100 frames a second)
+constexpr float kNoiseRise = 1.0023f;
+
+// The minimum of the smoothed power sits well below its mean; subtract
+// this multiple of it
+constexpr float kOverSubtraction = 4.0f;
+
+// Share of the way to the new gain covered per frame, opening and closing
+constexpr float kAttack = 0.7f;
+constexpr float kRelease = 0.15f;
+
+// Keeps silent bins from dividing by zero (the power is at 16-bit scale)
+constexpr float kPowerEpsilon = 1.0f;
+
+// Speech band that the probability is taken over (bins of 46.875Hz)
+constexpr size_t kSpeechFirstBin = 6;   // ~300Hz
+constexpr size_t kSpeechLastBin = 85;   // ~4kHz
+
+}  // namespace
+
+SpectralGate::SpectralGate()
+    : window_(kWindowSize),
+      cos_(kHalf + 1),
+      sin_(kHalf + 1),
+      bitReverse_(kHalf),
+      history_(kFrameSize),
+      overlap_(kFrameSize),
+      time_(kFftSize),
+      re_(kHalf),
+      im_(kHalf),
+      spectrumRe_(kBins),
+      spectrumIm_(kBins),
+      power_(kBins),
+      smoothed_(kBins),
+      averaged_(kBins),
+      noise_(kBins),
+      gain_(kBins) {
+    // w[n]^2 + w[n + kFrameSize]^2 = 1, so analysis and synthesis windows
+    // overlap-add back to unity
+    for (size_t n = 0; n < kWindowSize; ++n) {
+        window_[n] = float(std::sin(M_PI * (double(n) + 0.5) / double(kWindowSize)));
+    }
+    for (size_t k = 0; k <= kHalf; ++k) {
+        const double phase = 2.0 * M_PI * double(k) / double(kFftSize);
+        cos_[k] = float(std::cos(phase));
+        sin_[k] = float(std::sin(phase));
+    }
+    size_t bits = 0;
+    while ((size_t(1) << bits) < kHalf) {
+        ++bits;
+    }
+    for (size_t i = 0; i < kHalf; ++i) {
+        size_t reversed = 0;
+        for (size_t b = 0; b < bits; ++b) {
+            reversed |= ((i >> b) & 1) << (bits - 1 - b);
+        }
+        bitReverse_[i] = uint16_t(reversed);
+    }
+    reset();
+}
+
+void SpectralGate::reset() {
+    std::fill(history_.begin(), history_.end(), 0.0f);
+    std::fill(overlap_.begin(), overlap_.end(), 0.0f);
+    std::fill(smoothed_.begin(), smoothed_.end(), 0.0f);
+    std::fill(averaged_.begin(), averaged_.end(), 0.0f);
+    std::fill(noise_.begin(), noise_.end(), 0.0f);
+    std::fill(gain_.begin(), gain_.end(), 1.0f);
+    learnt_ = false;
+}
+
+float SpectralGate::processFrame(float* frame) {
+    // [previous frame | this frame], windowed and zero-padded
+    const float* window = window_.data();
+    float* time = time_.data();
+    for (size_t n = 0; n < kFrameSize; ++n) {
+        time[n] = history_[n] * window[n];
+        time[kFrameSize + n] = frame[n] * window[kFrameSize + n];
+    }
+    std::fill(time + kWindowSize, time + kFftSize, 0.0f);
+    std::copy(frame, frame + kFrameSize, history_.begin());
+
+    forward();
+    updateGains();
+    const float probability = speechProbability();
+    for (size_t k = 0; k < kBins; ++k) {
+        spectrumRe_[k] *= gain_[k];
+        spectrumIm_[k] *= gain_[k];
+    }
+    inverse();
+
+    // Out goes the previous frame: its second half of the last window
+    // plus its first half of this one
+    for (size_t n = 0; n < kFrameSize; ++n) {
+        frame[n] = overlap_[n] + time[n] * window[n];
+        overlap_[n] = time[kFrameSize + n] * window[kFrameSize + n];
+    }
+    return probability;
+}
+
+// Real FFT of time_ into spectrum{Re,Im}_: the even and odd samples go
+// through one half-size complex FFT, then get pulled apart
+void SpectralGate::forward() {
+    for (size_t n = 0; n < kHalf; ++n) {
+        re_[n] = time_[2 * n];
+        im_[n] = time_[2 * n + 1];
+    }
+    fft(re_.data(), im_.data(), false);
+
+    for (size_t k = 0; k <= kHalf; ++k) {
+        const size_t a = k % kHalf;
+        const size_t b = (kHalf - k) % kHalf;
+        // Even part E = (Z[k] + Z*[N/2-k]) / 2, odd part O = (Z[k] - Z*[N/2-k]) / 2i
+        const float evenRe = 0.5f * (re_[a] + re_[b]);
+        const float evenIm = 0.5f * (im_[a] - im_[b]);
+        const float oddRe = 0.5f * (im_[a] + im_[b]);
+        const float oddIm = -0.5f * (re_[a] - re_[b]);
+        // X[k] = E + e^(-2pi i k/N) O
+        spectrumRe_[k] = evenRe + cos_[k] * oddRe + sin_[k] * oddIm;
+        spectrumIm_[k] = evenIm + cos_[k] * oddIm - sin_[k] * oddRe;
+    }
+}
+
+// The reverse of forward(), from spectrum{Re,Im}_ back into time_
+void SpectralGate::inverse() {
+    for (size_t k = 0; k < kHalf; ++k) {
+        const size_t b = kHalf - k;
+        const float evenRe = 0.5f * (spectrumRe_[k] + spectrumRe_[b]);
+        const float evenIm = 0.5f * (spectrumIm_[k] - spectrumIm_[b]);
+        const float diffRe = 0.5f * (spectrumRe_[k] - spectrumRe_[b]);
+        const float diffIm = 0.5f * (spectrumIm_[k] + spectrumIm_[b]);
+        // O = (X[k] - X*[N/2-k]) / 2 * e^(2pi i k/N), Z = E + iO
+        const float oddRe = diffRe * cos_[k] - diffIm * sin_[k];
+        const float oddIm = diffRe * sin_[k] + diffIm * cos_[k];
+        re_[k] = evenRe - oddIm;
+        im_[k] = evenIm + oddRe;
+    }
+    fft(re_.data(), im_.data(), true);
+
+    const float scale = 1.0f / float(kHalf);
+    for (size_t n = 0; n < kHalf; ++n) {
+        time_[2 * n] = re_[n] * scale;
+        time_[2 * n + 1] = im_[n] * scale;
+    }
+}
+
+// Iterative radix-2 over a bit-reversed copy. Twiddles for the half-size
+// transform are every other entry of the full-size tables.
+void SpectralGate::fft(float* re, float* im, bool inverse) const {
+    for (size_t i = 0; i < kHalf; ++i) {
+        const size_t j = bitReverse_[i];
+        if (j > i) {
+            std::swap(re[i], re[j]);
+            std::swap(im[i], im[j]);
+        }
+    }
+
+    const float direction = inverse ? 1.0f : -1.0f;
+    for (size_t size = 2; size <= kHalf; size *= 2) {
+        const size_t half = size / 2;
+        const size_t stride = 2 * (kHalf / size);
+        for (size_t start = 0; start < kHalf; start += size) {
+            for (size_t j = 0; j < half; ++j) {
+                const float wr = cos_[j * stride];
+                const float wi = direction * sin_[j * stride];
+                const size_t top = start + j;
+                const size_t bottom = top + half;
+                const float tr = re[bottom] * wr - im[bottom] * wi;
+                const float ti = re[bottom] * wi + im[bottom] * wr;
+                re[bottom] = re[top] - tr;
+                im[bottom] = im[top] - ti;
+                re[top] += tr;
+                im[top] += ti;
+            }
+        }
+    }
+}
+
+// Noise floor and gain per bin. Branch-free selects, so the loops
+// vectorize.
+void SpectralGate::updateGains() {
+    for (size_t k = 0; k < kBins; ++k) {
+        power_[k] = spectrumRe_[k] * spectrumRe_[k] + spectrumIm_[k] * spectrumIm_[k];
+    }
+    if (!learnt_) {
+        std::copy(power_.begin(), power_.end(), smoothed_.begin());
+        std::copy(power_.begin(), power_.end(), averaged_.begin());
+        std::copy(power_.begin(), power_.end(), noise_.begin());
+        learnt_ = true;
+    }
+
+    for (size_t k = 0; k < kBins; ++k) {
+        const float power = power_[k] + kPowerSmoothing * (smoothed_[k] - power_[k]);
+        const float slow = averaged_[k] + kNoiseSmoothing * (power_[k] - averaged_[k]);
+        smoothed_[k] = power;
+        averaged_[k] = slow;
+        noise_[k] = std::min(noise_[k] * kNoiseRise, slow);
+
+        const float target =
+            std::max(kGainFloor, 1.0f - kOverSubtraction * noise_[k] / (power + kPowerEpsilon));
+        const float rate = target > gain_[k] ? kAttack : kRelease;
+        gain_[k] += rate * (target - gain_[k]);
+    }
+}
+
+// How much of the speech band's energy the gains let through, from 0 at
+// the gain floor to 1 fully open
+float SpectralGate::speechProbability() const {
+    const size_t count = kSpeechLastBin - kSpeechFirstBin + 1;
+    const float passed = vmath::dot(&gain_[kSpeechFirstBin], &power_[kSpeechFirstBin], count);
+    float total = 0.0f;
+    for (size_t k = kSpeechFirstBin; k <= kSpeechLastBin; ++k) {
+        total += power_[k];
+    }
+    if (total <= kPowerEpsilon * float(count)) {
+        return 0.0f;
+    }
+    return std::clamp((passed / total - kGainFloor) / (1.0f - kGainFloor), 0.0f, 1.0f);
+}
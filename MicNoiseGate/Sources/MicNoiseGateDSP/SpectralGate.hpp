@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Suppressor.hpp"
+
+// Spectral noise gate: the cheap fallback to RNNoise
+//
+// Each frame is windowed together with the one before it (a sqrt-Hann
+// window over 960 samples, zero-padded to a 1024-point FFT), and every bin
+// is scaled by a gain from its power over a running noise-floor estimate,
+// then overlap-added at a hop of one frame. Output therefore trails input
+// by one frame, the same as RNNoise, and nothing beyond the current frame
+// is ever looked at.
+//
+// The noise floor is a per-bin minimum of the smoothed power that follows
+// drops at once and creeps up by about 1dB a second, so it settles within
+// a few seconds of a new background. Gains open fast and close slowly, so
+// word onsets get through and the residual noise doesn't warble.
+//
+// Two half-size FFTs and a few passes over the bins: a small fraction of
+// RNNoise's cost, at the price of more residual noise and some "musical"
+// artefacts on busy backgrounds. All storage is allocated in the
+// constructor; processFrame() is real-time safe.
+class SpectralGate final : public Suppressor {
+public:
+    static constexpr size_t kWindowSize = 2 * kFrameSize;
+    static constexpr size_t kFftSize = 1024;
+    static constexpr size_t kBins = kFftSize / 2 + 1;
+
+    // Lowest gain a bin is pulled down to (-20dB), so the background is
+    // attenuated rather than chopped out
+    static constexpr float kGainFloor = 0.1f;
+
+    SpectralGate();
+
+    float processFrame(float* frame) override;
+    void reset() override;
+
+private:
+    // kHalf-point complex FFT in place on split real/imaginary arrays;
+    // the inverse is unscaled
+    void fft(float* re, float* im, bool inverse) const;
+
+    void forward();
+    void inverse();
+    void updateGains();
+    float speechProbability() const;
+
+    static constexpr size_t kHalf = kFftSize / 2;
+
+    std::vector<float> window_;
+    std::vector<float> cos_;
+    std::vector<float> sin_;
+    std::vector<uint16_t> bitReverse_;
+
+    // Previous input frame and the tail still to be overlap-added
+    std::vector<float> history_;
+    std::vector<float> overlap_;
+
+    std::vector<float> time_;
+    std::vector<float> re_;
+    std::vector<float> im_;
+    std::vector<float> spectrumRe_;
+    std::vector<float> spectrumIm_;
+
+    std::vector<float> power_;
+    std::vector<float> smoothed_;
+    std::vector<float> averaged_;
+    std::vector<float> noise_;
+    std::vector<float> gain_;
+    bool learnt_ = false;
+};
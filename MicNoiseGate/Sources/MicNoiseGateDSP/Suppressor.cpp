@@ -0,0 +1,25 @@
+#include "Suppressor.hpp"
+
+#include <rnnoise.h>
+
+RNNoiseSuppressor::RNNoiseSuppressor() : state_(rnnoise_create(nullptr)) {}
+
+RNNoiseSuppressor::~RNNoiseSuppressor() {
+    if (state_) {
+        rnnoise_destroy(state_);
+    }
+}
+
+float RNNoiseSuppressor::processFrame(float* frame) {
+    if (!state_) {
+        return 0.0f;
+    }
+    return rnnoise_process_frame(state_, frame, frame);
+}
+
+void RNNoiseSuppressor::reset() {
+    if (state_) {
+        rnnoise_destroy(state_);
+    }
+    state_ = rnnoise_create(nullptr);
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+
+struct DenoiseState;
+
+// One noise-suppression engine behind the Denoiser
+//
+// The Denoiser cuts 48kHz audio into kFrameSize-sample frames scaled to the
+// 16-bit range (RNNoise's convention) and hands each one to the active
+// engine, which suppresses it in place. Every engine delays its output by
+// exactly one frame, so the Denoiser can switch between them without the
+// timeline or the reported latency moving.
+//
+// processFrame() must be real-time safe.
+class Suppressor {
+public:
+    static constexpr size_t kFrameSize = 480;
+
+    virtual ~Suppressor() = default;
+
+    // Suppress one frame in place; returns the probability (0-1) that it
+    // holds speech
+    virtual float processFrame(float* frame) = 0;
+
+    // Forget everything learnt so far. May allocate.
+    virtual void reset() = 0;
+};
+
+// RNNoise's recurrent network: the best quality, and by far the most CPU
+class RNNoiseSuppressor final : public Suppressor {
+public:
+    RNNoiseSuppressor();
+    ~RNNoiseSuppressor() override;
+
+    RNNoiseSuppressor(const RNNoiseSuppressor&) = delete;
+    RNNoiseSuppressor& operator=(const RNNoiseSuppressor&) = delete;
+
+    // False if RNNoise failed to allocate its state
+    bool ready() const { return state_ != nullptr; }
+
+    float processFrame(float* frame) override;
+    void reset() override;
+
+private:
+    DenoiseState* state_ = nullptr;
+};
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+
+#include "mng_dsp.h"
+
+// Capture trace file (.mngtrace): written by TraceRecorder, replayed by
+// Driver/replay
+//
+// A TraceFileHeader, then records: each a TraceRecord followed by `size`
+// bytes of payload, in the recording machine's byte order. Records of one
+// type are in order, but inputs and reads come from different threads and
+// are written in batches, so a reader merges them by host time. Host times
+// are the recording machine's mach_absolute_time() ticks; the header
+// carries its timebase so they can be converted elsewhere.
+struct TraceFileHeader {
+    static constexpr uint32_t kMagic = 0x4D4E4754u;  // "MNGT"
+    static constexpr uint32_t kVersion = 1;
+
+    uint32_t magic = kMagic;
+    uint32_t version = kVersion;
+    uint32_t timebaseNumer = 0;
+    uint32_t timebaseDenom = 0;
+    MNGTraceConfig config = {};
+};
+
+enum class TraceRecordType : uint32_t {
+    Input = 1,  // TraceInput, then its frames as floats at the device rate
+    Read = 2,   // MNGReadRequest
+    Lost = 3,   // TraceLost
+};
+
+struct TraceRecord {
+    TraceRecordType type;
+    uint32_t size;
+};
+
+// One input callback's rendered buffer
+struct TraceInput {
+    uint64_t hostTime;  // Capture time of the first frame, 0 if unknown
+    uint32_t frameCount;
+    uint32_t reserved;
+};
+
+// Records of `type` that never made it into the file: the recorder fell
+// behind, or the driver's request log wrapped before it was read
+struct TraceLost {
+    TraceRecordType type;
+    uint32_t count;
+};
@@ -0,0 +1,126 @@
+#include "TraceRecorder.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <mach/mach_time.h>
+
+std::unique_ptr<TraceRecorder> TraceRecorder::create(const char* path,
+                                                     const MNGTraceConfig& config) {
+    FILE* file = std::fopen(path, "wb");
+    if (!file) {
+        return nullptr;
+    }
+
+    mach_timebase_info_data_t timebase;
+    mach_timebase_info(&timebase);
+    TraceFileHeader header;
+    header.timebaseNumer = timebase.numer;
+    header.timebaseDenom = timebase.denom;
+    header.config = config;
+    if (std::fwrite(&header, sizeof(header), 1, file) != 1) {
+        std::fclose(file);
+        return nullptr;
+    }
+    return std::unique_ptr<TraceRecorder>(new TraceRecorder(file));
+}
+
+TraceRecorder::TraceRecorder(FILE* file) : file_(file) {
+    writer_ = std::thread([this] { run(); });
+}
+
+TraceRecorder::~TraceRecorder() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wakeup_.notify_all();
+    writer_.join();
+    std::fclose(file_);
+}
+
+void TraceRecorder::recordInput(const float* samples, uint32_t frameCount, uint64_t hostTime) {
+    const TraceInput input = {hostTime, frameCount, 0};
+    const size_t sampleBytes = size_t(frameCount) * sizeof(float);
+    const TraceRecord record = {TraceRecordType::Input, uint32_t(sizeof(input) + sampleBytes)};
+    if (!inputs_.push(record, &input, sizeof(input), samples, sampleBytes)) {
+        lostInputs_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void TraceRecorder::recordReads(const MNGSharedHeader* header) {
+    uint64_t lost = 0;
+    const uint32_t count =
+        mng_request_log_read(header, &nextRead_, requests_, MNG_REQUEST_LOG_ENTRIES, &lost);
+    for (uint32_t i = 0; i < count; i++) {
+        const TraceRecord record = {TraceRecordType::Read, uint32_t(sizeof(MNGReadRequest))};
+        if (!reads_.push(record, &requests_[i], sizeof(MNGReadRequest))) {
+            lost++;
+        }
+    }
+    if (lost > 0) {
+        lostReads_.fetch_add(lost, std::memory_order_relaxed);
+    }
+}
+
+void TraceRecorder::run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stopping_) {
+        wakeup_.wait_for(lock, kFlushInterval, [this] { return stopping_; });
+        flush();
+    }
+    std::fflush(file_);
+}
+
+void TraceRecorder::flush() {
+    inputs_.writeTo(file_);
+    reads_.writeTo(file_);
+    writeLost(TraceRecordType::Input, lostInputs_, writtenLostInputs_);
+    writeLost(TraceRecordType::Read, lostReads_, writtenLostReads_);
+}
+
+void TraceRecorder::writeLost(TraceRecordType type, const std::atomic<uint64_t>& lost,
+                              uint64_t& written) {
+    const uint64_t total = lost.load(std::memory_order_relaxed);
+    if (total == written) {
+        return;
+    }
+    const TraceRecord record = {TraceRecordType::Lost, uint32_t(sizeof(TraceLost))};
+    const TraceLost payload = {type, uint32_t(std::min<uint64_t>(total - written, UINT32_MAX))};
+    std::fwrite(&record, sizeof(record), 1, file_);
+    std::fwrite(&payload, sizeof(payload), 1, file_);
+    written += payload.count;
+}
+
+bool TraceRecorder::Queue::push(const TraceRecord& record, const void* first, size_t firstSize,
+                                const void* second, size_t secondSize) {
+    const size_t size = sizeof(record) + firstSize + secondSize;
+    const size_t write = write_.load(std::memory_order_relaxed);
+    if (bytes_.size() - (write - read_.load(std::memory_order_acquire)) < size) {
+        return false;
+    }
+    copyIn(write, &record, sizeof(record));
+    copyIn(write + sizeof(record), first, firstSize);
+    if (secondSize > 0) {
+        copyIn(write + sizeof(record) + firstSize, second, secondSize);
+    }
+    write_.store(write + size, std::memory_order_release);
+    return true;
+}
+
+void TraceRecorder::Queue::copyIn(size_t position, const void* data, size_t size) {
+    const size_t offset = position & (bytes_.size() - 1);
+    const size_t head = std::min(size, bytes_.size() - offset);
+    const auto* source = static_cast<const unsigned char*>(data);
+    std::memcpy(bytes_.data() + offset, source, head);
+    std::memcpy(bytes_.data(), source + head, size - head);
+}
+
+void TraceRecorder::Queue::writeTo(FILE* file) {
+    const size_t read = read_.load(std::memory_order_relaxed);
+    const size_t size = write_.load(std::memory_order_acquire) - read;
+    const size_t offset = read & (bytes_.size() - 1);
+    const size_t head = std::min(size, bytes_.size() - offset);
+    std::fwrite(bytes_.data() + offset, 1, head, file);
+    std::fwrite(bytes_.data(), 1, size - head, file);
+    read_.store(read + size, std::memory_order_release);
+}
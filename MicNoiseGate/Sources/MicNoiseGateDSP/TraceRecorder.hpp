@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "TraceFormat.hpp"
+
+// Records a capture trace for offline replay
+//
+// The input callback hands over every rendered buffer with its host time,
+// and the processing thread the client reads the driver has logged in the
+// shared header since its last pass. Both only copy into a queue of their
+// own; a background thread writes the queues out to the file every
+// kFlushInterval. A record that finds its queue full is counted, and the
+// count goes into the file as a TraceLost record, so a replay knows where
+// the trace has holes.
+class TraceRecorder {
+public:
+    // Room for about five seconds of 48kHz input, and far more reads, if
+    // the writer stalls
+    static constexpr size_t kInputQueueBytes = size_t(1) << 20;
+    static constexpr size_t kReadQueueBytes = size_t(1) << 16;
+
+    static constexpr auto kFlushInterval = std::chrono::milliseconds(20);
+
+    // Opens `path` and writes the header; nullptr if it can't be created
+    static std::unique_ptr<TraceRecorder> create(const char* path, const MNGTraceConfig& config);
+
+    // Writes out everything still queued and closes the file
+    ~TraceRecorder();
+
+    TraceRecorder(const TraceRecorder&) = delete;
+    TraceRecorder& operator=(const TraceRecorder&) = delete;
+
+    // Input callback only. Real-time safe.
+    void recordInput(const float* samples, uint32_t frameCount, uint64_t hostTime);
+
+    // Processing thread only. Real-time safe.
+    void recordReads(const MNGSharedHeader* header);
+
+private:
+    // Single-producer, single-consumer byte queue. A record goes in whole
+    // or not at all, so the writer only ever sees complete ones.
+    class Queue {
+    public:
+        explicit Queue(size_t capacity) : bytes_(capacity) {}
+
+        bool push(const TraceRecord& record, const void* first, size_t firstSize,
+                  const void* second = nullptr, size_t secondSize = 0);
+
+        // Writer thread: append everything queued to `file`
+        void writeTo(FILE* file);
+
+    private:
+        void copyIn(size_t position, const void* data, size_t size);
+
+        std::vector<unsigned char> bytes_;
+        std::atomic<size_t> write_{0};
+        std::atomic<size_t> read_{0};
+    };
+
+    explicit TraceRecorder(FILE* file);
+
+    void run();
+    void flush();
+    void writeLost(TraceRecordType type, const std::atomic<uint64_t>& lost, uint64_t& written);
+
+    FILE* file_;
+    Queue inputs_{kInputQueueBytes};
+    Queue reads_{kReadQueueBytes};
+
+    // Counted by the producers, written out by the writer
+    std::atomic<uint64_t> lostInputs_{0};
+    std::atomic<uint64_t> lostReads_{0};
+    uint64_t writtenLostInputs_ = 0;
+    uint64_t writtenLostReads_ = 0;
+
+    // Processing thread: position in the driver's request log
+    uint64_t nextRead_ = 0;
+    MNGReadRequest requests_[MNG_REQUEST_LOG_ENTRIES] = {};
+
+    std::thread writer_;
+    std::mutex mutex_;
+    std::condition_variable wakeup_;
+    bool stopping_ = false;
+};
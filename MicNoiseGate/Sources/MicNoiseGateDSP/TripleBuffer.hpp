@@ -0,0 +1,43 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Lock-free triple buffer
+//
+// One writer fills the back slot and publishes it whole; one reader takes
+// the newest published slot whenever it likes. Neither side ever waits or
+// sees a half-written value, and values published faster than the reader
+// looks are simply replaced. The slots are swapped by index, so T is never
+// copied between the threads.
+template <typename T>
+class TripleBuffer {
+public:
+    // Writer: the slot to fill, then publish() it
+    T& back() { return slots_[back_]; }
+
+    void publish() {
+        back_ = state_.exchange(uint8_t(back_ | kFresh), std::memory_order_acq_rel) & kIndexMask;
+    }
+
+    // Reader: move to the newest value if one was published since the
+    // last call. Returns whether front() changed.
+    bool update() {
+        if ((state_.load(std::memory_order_relaxed) & kFresh) == 0) {
+            return false;
+        }
+        front_ = state_.exchange(front_, std::memory_order_acq_rel) & kIndexMask;
+        return true;
+    }
+
+    const T& front() const { return slots_[front_]; }
+
+private:
+    static constexpr uint8_t kIndexMask = 0x3;
+    static constexpr uint8_t kFresh = 0x4;
+
+    T slots_[3] = {};
+    uint8_t back_ = 0;                 // Writer only
+    uint8_t front_ = 1;                // Reader only
+    std::atomic<uint8_t> state_{2};    // The middle slot, plus kFresh
+};
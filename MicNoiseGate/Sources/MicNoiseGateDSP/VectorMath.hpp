@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Small vector kernels for the hot loops
+//
+// Written so the compiler vectorizes them at -O3 (NEON on arm64, AVX2 on
+// x86_64) without -ffast-math: reductions keep kLanes independent partial
+// sums instead of relying on the compiler to reassociate one accumulator.
+namespace vmath {
+
+constexpr size_t kLanes = 8;
+
+// Sum of a[i] * b[i]
+inline float dot(const float* a, const float* b, size_t count) {
+    float partial[kLanes] = {};
+    const size_t blocked = count - count % kLanes;
+    size_t i = 0;
+    for (; i < blocked; i += kLanes) {
+        for (size_t lane = 0; lane < kLanes; ++lane) {
+            partial[lane] += a[i + lane] * b[i + lane];
+        }
+    }
+    for (; i < count; ++i) {
+        partial[0] += a[i] * b[i];
+    }
+
+    float sum = 0.0f;
+    for (size_t lane = 0; lane < kLanes; ++lane) {
+        sum += partial[lane];
+    }
+    return sum;
+}
+
+// Sum of a[i]^2
+inline float sumOfSquares(const float* a, size_t count) {
+    return dot(a, a, count);
+}
+
+// Smallest and largest of a[0..count), both 0 for an empty block
+inline void minMax(const float* a, size_t count, float& minimum, float& maximum) {
+    if (count == 0) {
+        minimum = maximum = 0.0f;
+        return;
+    }
+
+    float lo[kLanes], hi[kLanes];
+    for (size_t lane = 0; lane < kLanes; ++lane) {
+        lo[lane] = hi[lane] = a[0];
+    }
+    const size_t blocked = count - count % kLanes;
+    size_t i = 0;
+    for (; i < blocked; i += kLanes) {
+        for (size_t lane = 0; lane < kLanes; ++lane) {
+            lo[lane] = a[i + lane] < lo[lane] ? a[i + lane] : lo[lane];
+            hi[lane] = a[i + lane] > hi[lane] ? a[i + lane] : hi[lane];
+        }
+    }
+    for (; i < count; ++i) {
+        lo[0] = a[i] < lo[0] ? a[i] : lo[0];
+        hi[0] = a[i] > hi[0] ? a[i] : hi[0];
+    }
+
+    minimum = lo[0];
+    maximum = hi[0];
+    for (size_t lane = 1; lane < kLanes; ++lane) {
+        minimum = lo[lane] < minimum ? lo[lane] : minimum;
+        maximum = hi[lane] > maximum ? hi[lane] : maximum;
+    }
+}
+
+// out[i] = in[i] * scale (in and out may be the same buffer)
+inline void scale(const float* in, float factor, float* out, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        out[i] = in[i] * factor;
+    }
+}
+
+// Full scale of Int16 samples, the scale RNNoise works on
+constexpr float kInt16Scale = 32767.0f;
+
+// [-1, 1] floats to Int16, rounded to nearest and saturated (NaN becomes
+// the negative limit). Rounds on a biased, non-negative copy so the
+// truncating convert rounds too, which keeps the loop free of branches.
+inline void floatToInt16(const float* in, int16_t* out, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        float biased = in[i] * kInt16Scale + 32768.5f;
+        biased = biased > 0.0f ? biased : 0.0f;
+        biased = biased < 65535.0f ? biased : 65535.0f;
+        out[i] = int16_t(int32_t(biased) - 32768);
+    }
+}
+
+// Int16 back to [-1, 1] floats: a widen, a convert and a multiply per lane
+inline void int16ToFloat(const int16_t* in, float* out, size_t count) {
+    constexpr float kScale = 1.0f / kInt16Scale;
+    for (size_t i = 0; i < count; ++i) {
+        out[i] = float(in[i]) * kScale;
+    }
+}
+
+}  // namespace vmath
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstddef>
+
+#include "VectorMath.hpp"
+
+// Voice-activity gate for the power-saving mode
+//
+// Follows RNNoise's per-frame voice probability. After a second without
+// speech the gate closes: the denoiser then emits silence and only runs
+// RNNoise on every kProbeInterval-th frame, or on a frame whose energy
+// jumps well above the background, to find out whether speech is back.
+// The first such frame with speech reopens the gate.
+//
+// Disabled, the gate stays open and costs nothing.
+class VoiceGate {
+public:
+    // Voice probability that counts as speech
+    static constexpr float kSpeechProbability = 0.5f;
+
+    // Non-speech frames (10ms each) before the gate closes
+    static constexpr size_t kHangoverFrames = 100;
+
+    // While closed, run RNNoise on one frame in this many
+    static constexpr size_t kProbeInterval = 4;
+
+    // Frame energy over the background that may be speech (12dB)
+    static constexpr float kOnsetEnergyRatio = 16.0f;
+
+    void setEnabled(bool enabled) {
+        enabled_ = enabled;
+        if (!enabled) {
+            reset();
+        }
+    }
+
+    bool enabled() const { return enabled_; }
+
+    bool isOpen() const { return open_; }
+
+    void reset() {
+        open_ = true;
+        quietFrames_ = 0;
+        sinceProbe_ = 0;
+        floor_ = -1.0f;
+    }
+
+    // Whether `frame` should go through RNNoise; if not, it is silenced
+    bool shouldAnalyze(const float* frame, size_t count) {
+        if (!enabled_ || open_) {
+            return true;
+        }
+
+        // Background energy, learnt from the first frame after closing:
+        // follows drops at once and rises slowly
+        const float energy = vmath::sumOfSquares(frame, count) / float(count);
+        if (floor_ < 0.0f) {
+            floor_ = energy;
+        }
+        const bool onset = energy > floor_ * kOnsetEnergyRatio + kSilenceEnergy;
+        floor_ = energy < floor_ ? energy : floor_ + kFloorRise * (energy - floor_);
+
+        if (onset || ++sinceProbe_ >= kProbeInterval) {
+            sinceProbe_ = 0;
+            return true;
+        }
+        return false;
+    }
+
+    // Feed the voice probability of an analysed frame
+    void update(float probability) {
+        if (probability >= kSpeechProbability) {
+            open_ = true;
+            quietFrames_ = 0;
+            return;
+        }
+        if (open_ && enabled_ && ++quietFrames_ >= kHangoverFrames) {
+            open_ = false;
+            sinceProbe_ = 0;
+            floor_ = -1.0f;
+        }
+    }
+
+private:
+    // Energy below which nothing counts as an onset (about -80dBFS)
+    static constexpr float kSilenceEnergy = 1e-8f;
+    static constexpr float kFloorRise = 0.05f;
+
+    bool enabled_ = false;
+    bool open_ = true;
+    size_t quietFrames_ = 0;
+    size_t sinceProbe_ = 0;
+    float floor_ = -1.0f;  // Negative until learnt
+};
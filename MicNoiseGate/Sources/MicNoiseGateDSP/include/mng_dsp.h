@@ -0,0 +1,237 @@
+#ifndef MNG_DSP_H
+#define MNG_DSP_H
+
+#include <stdint.h>
+
+#include "shm_layout.h"
+
+// C interface to the MicNoiseGate DSP engine (libmicnoisegate-dsp)
+//
+// The hot path lives in C++ so the app and the driver share one build of
+// it, compiled with -O3 and NEON/AVX2. Functions marked real-time safe
+// never allocate, lock or block; create/destroy must stay off the audio
+// thread.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// MARK: - Denoiser
+
+typedef struct MNGDenoiser MNGDenoiser;
+
+// RNNoise behind a resampler from `inputRate` to 48kHz and a frame FIFO.
+// Sized for callbacks of up to `maxInputFrames`. Returns NULL on failure.
+MNGDenoiser* mng_denoiser_create(double inputRate, uint32_t maxInputFrames);
+void mng_denoiser_destroy(MNGDenoiser* denoiser);
+
+// Largest number of 48kHz samples one process call can produce
+uint32_t mng_denoiser_max_output_frames(const MNGDenoiser* denoiser);
+
+// Denoise mono input at the input rate; writes whole 480-sample frames at
+// 48kHz to `output` and returns the count, possibly 0. Real-time safe.
+uint32_t mng_denoiser_process(MNGDenoiser* denoiser, const float* input, uint32_t frameCount,
+                              float* output, uint32_t capacity);
+
+// 48kHz samples taken in but not yet returned (short of a whole frame),
+// i.e. how far the newest output trails the newest input
+uint32_t mng_denoiser_pending_frames(const MNGDenoiser* denoiser);
+
+// Drop buffered audio and restart RNNoise. Real-time safe apart from the
+// RNNoise state reallocation, so call it with the audio unit stopped.
+void mng_denoiser_reset(MNGDenoiser* denoiser);
+
+// Power saving: after a second without speech, output silence and run
+// RNNoise on only a fraction of frames until speech returns. Call from the
+// processing thread or before it starts.
+void mng_denoiser_set_power_saving(MNGDenoiser* denoiser, int enabled);
+
+// Nonzero while power saving has gated the output to silence
+int mng_denoiser_is_idle(const MNGDenoiser* denoiser);
+
+// The suppressor's voice probability (0-1) for the last frame it analysed
+float mng_denoiser_voice_probability(const MNGDenoiser* denoiser);
+
+// Suppressor engines: RNNoise, the cheap spectral gate, or RNNoise until
+// its measured cost per frame gets too close to the frame's 10ms, then the
+// gate for the rest of the stream (until a reset)
+#define MNG_SUPPRESSOR_RNNOISE 0
+#define MNG_SUPPRESSOR_SPECTRAL_GATE 1
+#define MNG_SUPPRESSOR_AUTOMATIC 2
+
+// Choose the engine (RNNoise by default). Call from the processing thread
+// or before it starts.
+void mng_denoiser_set_suppressor(MNGDenoiser* denoiser, int mode);
+
+// The engine doing the work now: MNG_SUPPRESSOR_RNNOISE or
+// MNG_SUPPRESSOR_SPECTRAL_GATE
+int mng_denoiser_active_suppressor(const MNGDenoiser* denoiser);
+
+// MARK: - Resampler
+
+typedef struct MNGResampler MNGResampler;
+
+// Band-limited polyphase resampler for mono input of up to
+// `maxInputFrames` per call. Returns NULL on failure.
+MNGResampler* mng_resampler_create(double inputRate, double outputRate, uint32_t maxInputFrames);
+void mng_resampler_destroy(MNGResampler* resampler);
+
+// Output capacity needed for a call with `inputFrames` samples
+uint32_t mng_resampler_max_output_frames(const MNGResampler* resampler, uint32_t inputFrames);
+
+// Returns the number of samples written to `output`. Real-time safe.
+uint32_t mng_resampler_process(MNGResampler* resampler, const float* input, uint32_t frameCount,
+                               float* output, uint32_t capacity);
+
+void mng_resampler_reset(MNGResampler* resampler);
+
+// MARK: - Metering
+
+typedef struct MNGMeter MNGMeter;
+
+// Buckets in a meter's waveform envelope
+#define MNG_METER_POINTS 100u
+
+// Peak, RMS and per-bucket min/max of the latest block of one signal,
+// handed from the audio side to the UI through a lock-free triple buffer.
+// Starts disabled.
+MNGMeter* mng_meter_create(void);
+void mng_meter_destroy(MNGMeter* meter);
+
+// While disabled, updates return without measuring. Any thread.
+void mng_meter_set_enabled(MNGMeter* meter, int enabled);
+
+// Measure a block and publish it. Real-time safe; one thread at a time.
+void mng_meter_update(MNGMeter* meter, const float* samples, uint32_t count);
+
+// Publish silence. From the thread that updates, or while none does.
+void mng_meter_reset(MNGMeter* meter);
+
+// UI: copy out the newest reading if one was published since the last
+// call, and return 0 if not. `minimum` and `maximum` hold MNG_METER_POINTS.
+int mng_meter_read(MNGMeter* meter, float* peak, float* rms, float* minimum, float* maximum);
+
+// MARK: - Gain
+
+typedef struct MNGGain MNGGain;
+
+MNGGain* mng_gain_create(float gain);
+void mng_gain_destroy(MNGGain* gain);
+
+// Apply gain in place, ramping to `target` over 10ms when it changes.
+// Real-time safe.
+void mng_gain_process(MNGGain* gain, float* samples, uint32_t count, float target);
+
+// MARK: - Ring buffer (producer side)
+
+// Write interleaved frames in the header's channel layout. Returns 0 and
+// counts an overrun when the ring doesn't have room. Real-time safe.
+int mng_ring_write(MNGSharedHeader* header, const float* samples, uint32_t frameCount);
+
+// Write mono frames, duplicated into every channel. Same contract.
+int mng_ring_write_mono(MNGSharedHeader* header, const float* samples, uint32_t frameCount);
+
+// Sleep until the consumer frees space (rings the header's doorbell) or
+// `timeoutMicroseconds` pass. `seen` is mng_shm_doorbell() read before
+// looking for work, so a ring in between isn't missed. Not real-time safe.
+void mng_ring_wait_doorbell(MNGSharedHeader* header, uint32_t seen, uint32_t timeoutMicroseconds);
+
+// Wait on the doorbell until there is room for `frameCount` frames.
+// Returns 0 if there still isn't after `timeoutMicroseconds`. Not
+// real-time safe.
+int mng_ring_wait_for_space(MNGSharedHeader* header, uint32_t frameCount,
+                            uint32_t timeoutMicroseconds);
+
+// MARK: - Ring buffer (in-process)
+
+// A ring in the shared layout on the heap, for handing audio from one
+// thread of this process to another, holding at least `capacityFrames`
+// (rounded up to a power of two, see mng_shm_capacity_for). Returns NULL
+// on failure.
+MNGSharedHeader* mng_ring_create(uint32_t capacityFrames);
+void mng_ring_destroy(MNGSharedHeader* header);
+
+// Single consumer side: frames waiting, and read up to `frameCount` of them
+// (returns how many). Real-time safe.
+uint32_t mng_ring_fill_level(MNGSharedHeader* header);
+uint32_t mng_ring_read(MNGSharedHeader* header, float* samples, uint32_t frameCount);
+
+// MARK: - Producer handoff
+
+typedef struct MNGHandoff MNGHandoff;
+
+// Passes one virtual mic's ring between capture pipelines with a crossfade
+// and no gap in the writes (see ProducerHandoff.hpp). Producers hold a
+// token and ask for their role before every block.
+#define MNG_HANDOFF_OWNER 0
+#define MNG_HANDOFF_INCOMING 1
+#define MNG_HANDOFF_RETIRED 2
+
+MNGHandoff* mng_handoff_create(void);
+void mng_handoff_destroy(MNGHandoff* handoff);
+
+// Setup thread: a token that owns the ring outright, or one that takes it
+// over from the current owner (0 on failure), for a producer writing in
+// bursts of up to `marginFrames`
+uint32_t mng_handoff_claim(MNGHandoff* handoff);
+uint32_t mng_handoff_begin(MNGHandoff* handoff, uint32_t marginFrames);
+
+// Setup thread: whether the incoming producer is still waiting to take
+// over, and hand it the ring at once (only after the owner has stopped)
+int mng_handoff_pending(const MNGHandoff* handoff);
+void mng_handoff_abandon(MNGHandoff* handoff);
+
+// MNG_HANDOFF_* for `token`. Real-time safe.
+int mng_handoff_role(const MNGHandoff* handoff, uint32_t token);
+
+// Owner, on every block before writing it: fades towards the incoming
+// producer during a handoff. Real-time safe.
+void mng_handoff_mix(MNGHandoff* handoff, float* samples, uint32_t count);
+
+// Incoming: queue a block in place of writing it. Real-time safe.
+void mng_handoff_feed(MNGHandoff* handoff, const float* samples, uint32_t count);
+
+// New owner, before its first block: frames queued but not faded through,
+// to write first; returns 0 once there are none. Real-time safe.
+uint32_t mng_handoff_drain(MNGHandoff* handoff, float* samples, uint32_t capacity);
+
+// MARK: - Capture trace
+
+typedef struct MNGTrace MNGTrace;
+
+// What a replay needs to rebuild a pipeline the way it ran when the trace
+// was recorded
+typedef struct MNGTraceConfig {
+    double inputRate;
+    uint32_t maxInputFrames;
+    uint32_t alignedFrames;        // Frames per callback asked of the device, 0 if not aligned
+    uint32_t processingMode;       // MNG_PROCESSING_*
+    uint32_t powerSaving;
+    int32_t suppressor;            // MNG_SUPPRESSOR_*
+    uint32_t ringFrames;
+    uint32_t sampleFormat;         // MNG_SAMPLE_*
+    uint32_t targetLatencyFrames;
+    uint32_t captureLatencyFrames;
+    uint32_t ioBufferFrames;       // The device's IO buffer, at its rate
+} MNGTraceConfig;
+
+// Records a pipeline's input buffers and the driver's reads of its ring to
+// a .mngtrace file, for Driver/replay (see TraceRecorder.hpp). Returns NULL
+// if the file can't be created. Destroying it writes out what is queued.
+MNGTrace* mng_trace_create(const char* path, const MNGTraceConfig* config);
+void mng_trace_destroy(MNGTrace* trace);
+
+// Input callback: one rendered mono buffer, captured at `hostTime`.
+// Real-time safe.
+void mng_trace_record_input(MNGTrace* trace, const float* samples, uint32_t frameCount,
+                            uint64_t hostTime);
+
+// Processing thread: the reads the driver has logged in `header` since the
+// last call. Real-time safe.
+void mng_trace_record_reads(MNGTrace* trace, const MNGSharedHeader* header);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // MNG_DSP_H
@@ -0,0 +1,368 @@
+#include "mng_dsp.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <utility>
+
+#include "Denoiser.hpp"
+#include "GainStage.hpp"
+#include "Meter.hpp"
+#include "PolyphaseResampler.hpp"
+#include "ProducerHandoff.hpp"
+#include "SharedMemory.hpp"
+#include "TraceRecorder.hpp"
+
+// The opaque C handles are the C++ objects themselves
+struct MNGDenoiser : Denoiser {
+    using Denoiser::Denoiser;
+};
+
+struct MNGResampler : PolyphaseResampler {
+    using PolyphaseResampler::PolyphaseResampler;
+};
+
+struct MNGGain : GainStage {
+    using GainStage::GainStage;
+};
+
+struct MNGMeter : meter::ChannelMeter {};
+
+struct MNGHandoff : ProducerHandoff {};
+
+struct MNGTrace {
+    std::unique_ptr<TraceRecorder> recorder;
+};
+
+static_assert(MNG_METER_POINTS == meter::kPoints, "meter envelope size");
+static_assert(MNG_SUPPRESSOR_RNNOISE == int(Denoiser::Mode::RNNoise) &&
+                  MNG_SUPPRESSOR_SPECTRAL_GATE == int(Denoiser::Mode::SpectralGate) &&
+                  MNG_SUPPRESSOR_AUTOMATIC == int(Denoiser::Mode::Automatic),
+              "suppressor modes");
+static_assert(MNG_HANDOFF_OWNER == int(ProducerHandoff::Role::Owner) &&
+                  MNG_HANDOFF_INCOMING == int(ProducerHandoff::Role::Incoming) &&
+                  MNG_HANDOFF_RETIRED == int(ProducerHandoff::Role::Retired),
+              "handoff roles");
+
+// MARK: - Denoiser
+
+MNGDenoiser* mng_denoiser_create(double inputRate, uint32_t maxInputFrames) {
+    // Construction allocates beyond the object itself; nothing may
+    // unwind into the C caller
+    try {
+        return new MNGDenoiser(inputRate, maxInputFrames);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void mng_denoiser_destroy(MNGDenoiser* denoiser) {
+    delete denoiser;
+}
+
+uint32_t mng_denoiser_max_output_frames(const MNGDenoiser* denoiser) {
+    return denoiser ? uint32_t(denoiser->maxOutputFrames()) : 0;
+}
+
+uint32_t mng_denoiser_process(MNGDenoiser* denoiser, const float* input, uint32_t frameCount,
+                              float* output, uint32_t capacity) {
+    if (!denoiser || !input || !output) {
+        return 0;
+    }
+    return uint32_t(denoiser->process(input, frameCount, output, capacity));
+}
+
+uint32_t mng_denoiser_pending_frames(const MNGDenoiser* denoiser) {
+    return denoiser ? uint32_t(denoiser->pendingFrames()) : 0;
+}
+
+void mng_denoiser_reset(MNGDenoiser* denoiser) {
+    if (denoiser) {
+        denoiser->reset();
+    }
+}
+
+void mng_denoiser_set_power_saving(MNGDenoiser* denoiser, int enabled) {
+    if (denoiser) {
+        denoiser->setPowerSaving(enabled != 0);
+    }
+}
+
+int mng_denoiser_is_idle(const MNGDenoiser* denoiser) {
+    return denoiser && denoiser->isIdle() ? 1 : 0;
+}
+
+float mng_denoiser_voice_probability(const MNGDenoiser* denoiser) {
+    return denoiser ? denoiser->voiceProbability() : 0.0f;
+}
+
+void mng_denoiser_set_suppressor(MNGDenoiser* denoiser, int mode) {
+    if (denoiser && mode >= MNG_SUPPRESSOR_RNNOISE && mode <= MNG_SUPPRESSOR_AUTOMATIC) {
+        denoiser->setMode(Denoiser::Mode(mode));
+    }
+}
+
+int mng_denoiser_active_suppressor(const MNGDenoiser* denoiser) {
+    return denoiser ? int(denoiser->activeEngine()) : MNG_SUPPRESSOR_RNNOISE;
+}
+
+// MARK: - Resampler
+
+MNGResampler* mng_resampler_create(double inputRate, double outputRate, uint32_t maxInputFrames) {
+    try {
+        return new MNGResampler(inputRate, outputRate, maxInputFrames);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void mng_resampler_destroy(MNGResampler* resampler) {
+    delete resampler;
+}
+
+uint32_t mng_resampler_max_output_frames(const MNGResampler* resampler, uint32_t inputFrames) {
+    return resampler ? uint32_t(resampler->maxOutputFrames(inputFrames)) : 0;
+}
+
+uint32_t mng_resampler_process(MNGResampler* resampler, const float* input, uint32_t frameCount,
+                               float* output, uint32_t capacity) {
+    if (!resampler || !input || !output) {
+        return 0;
+    }
+    return uint32_t(resampler->process(input, frameCount, output, capacity));
+}
+
+void mng_resampler_reset(MNGResampler* resampler) {
+    if (resampler) {
+        resampler->reset();
+    }
+}
+
+// MARK: - Metering
+
+MNGMeter* mng_meter_create(void) {
+    try {
+        return new MNGMeter();
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void mng_meter_destroy(MNGMeter* meter) {
+    delete meter;
+}
+
+void mng_meter_set_enabled(MNGMeter* meter, int enabled) {
+    if (meter) {
+        meter->setEnabled(enabled != 0);
+    }
+}
+
+void mng_meter_update(MNGMeter* meter, const float* samples, uint32_t count) {
+    if (meter && samples) {
+        meter->update(samples, count);
+    }
+}
+
+void mng_meter_reset(MNGMeter* meter) {
+    if (meter) {
+        meter->reset();
+    }
+}
+
+int mng_meter_read(MNGMeter* meter, float* peak, float* rms, float* minimum, float* maximum) {
+    const meter::Reading* reading = meter ? meter->read() : nullptr;
+    if (!reading) {
+        return 0;
+    }
+    *peak = reading->peak;
+    *rms = reading->rms;
+    std::copy(reading->minimum, reading->minimum + meter::kPoints, minimum);
+    std::copy(reading->maximum, reading->maximum + meter::kPoints, maximum);
+    return 1;
+}
+
+// MARK: - Gain
+
+MNGGain* mng_gain_create(float gain) {
+    try {
+        return new MNGGain(gain);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void mng_gain_destroy(MNGGain* gain) {
+    delete gain;
+}
+
+void mng_gain_process(MNGGain* gain, float* samples, uint32_t count, float target) {
+    if (gain && samples) {
+        gain->process(samples, count, target);
+    }
+}
+
+// MARK: - Ring buffer
+
+int mng_ring_write(MNGSharedHeader* header, const float* samples, uint32_t frameCount) {
+    if (!header || !samples) {
+        return 0;
+    }
+    if (!static_cast<SharedAudioBuffer*>(header)->write(samples, frameCount)) {
+        mng_shm_note_overrun(header);
+        return 0;
+    }
+    return 1;
+}
+
+int mng_ring_write_mono(MNGSharedHeader* header, const float* samples, uint32_t frameCount) {
+    if (!header || !samples) {
+        return 0;
+    }
+    if (!static_cast<SharedAudioBuffer*>(header)->writeMono(samples, frameCount)) {
+        mng_shm_note_overrun(header);
+        return 0;
+    }
+    return 1;
+}
+
+void mng_ring_wait_doorbell(MNGSharedHeader* header, uint32_t seen, uint32_t timeoutMicroseconds) {
+    if (header) {
+        waitOnDoorbell(header, seen, timeoutMicroseconds);
+    }
+}
+
+int mng_ring_wait_for_space(MNGSharedHeader* header, uint32_t frameCount,
+                            uint32_t timeoutMicroseconds) {
+    if (!header) {
+        return 0;
+    }
+    auto* ring = static_cast<SharedAudioBuffer*>(header);
+    const auto deadline = std::chrono::steady_clock::now() +
+                          std::chrono::microseconds(timeoutMicroseconds);
+
+    for (;;) {
+        const uint32_t seen = mng_shm_doorbell(header);
+        if (ring->availableToWrite(frameCount) >= frameCount) {
+            return 1;
+        }
+        const auto left = std::chrono::duration_cast<std::chrono::microseconds>(
+            deadline - std::chrono::steady_clock::now()).count();
+        if (left <= 0) {
+            return 0;
+        }
+        waitOnDoorbell(header, seen, uint32_t(left));
+    }
+}
+
+// MARK: - Ring buffer (in-process)
+
+MNGSharedHeader* mng_ring_create(uint32_t capacityFrames) {
+    const uint32_t frames = mng_shm_capacity_for(capacityFrames);
+    auto* header = static_cast<MNGSharedHeader*>(
+        std::aligned_alloc(kCacheLineSize, SharedAudioBuffer::totalSize(frames)));
+    if (header) {
+        mng_shm_initialize(header, frames, MNG_SAMPLE_FLOAT32);
+        mng_shm_set_active(header, 1);
+    }
+    return header;
+}
+
+void mng_ring_destroy(MNGSharedHeader* header) {
+    std::free(header);
+}
+
+uint32_t mng_ring_fill_level(MNGSharedHeader* header) {
+    return header ? uint32_t(static_cast<SharedAudioBuffer*>(header)->fillLevel()) : 0;
+}
+
+uint32_t mng_ring_read(MNGSharedHeader* header, float* samples, uint32_t frameCount) {
+    if (!header || !samples) {
+        return 0;
+    }
+    return uint32_t(static_cast<SharedAudioBuffer*>(header)->read(samples, frameCount));
+}
+
+// MARK: - Producer handoff
+
+MNGHandoff* mng_handoff_create(void) {
+    try {
+        return new MNGHandoff();
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void mng_handoff_destroy(MNGHandoff* handoff) {
+    delete handoff;
+}
+
+uint32_t mng_handoff_claim(MNGHandoff* handoff) {
+    return handoff ? handoff->claim() : 0;
+}
+
+uint32_t mng_handoff_begin(MNGHandoff* handoff, uint32_t marginFrames) {
+    return handoff ? handoff->begin(marginFrames) : 0;
+}
+
+int mng_handoff_pending(const MNGHandoff* handoff) {
+    return handoff && handoff->pending() ? 1 : 0;
+}
+
+void mng_handoff_abandon(MNGHandoff* handoff) {
+    if (handoff) {
+        handoff->abandon();
+    }
+}
+
+int mng_handoff_role(const MNGHandoff* handoff, uint32_t token) {
+    return handoff ? int(handoff->role(token)) : MNG_HANDOFF_OWNER;
+}
+
+void mng_handoff_mix(MNGHandoff* handoff, float* samples, uint32_t count) {
+    if (handoff && samples) {
+        handoff->mix(samples, count);
+    }
+}
+
+void mng_handoff_feed(MNGHandoff* handoff, const float* samples, uint32_t count) {
+    if (handoff && samples) {
+        handoff->feed(samples, count);
+    }
+}
+
+uint32_t mng_handoff_drain(MNGHandoff* handoff, float* samples, uint32_t capacity) {
+    return handoff && samples ? handoff->drain(samples, capacity) : 0;
+}
+
+MNGTrace* mng_trace_create(const char* path, const MNGTraceConfig* config) {
+    if (!path || !config) {
+        return nullptr;
+    }
+    // Also starts the writer thread, which can fail with system_error
+    try {
+        auto recorder = TraceRecorder::create(path, *config);
+        return recorder ? new MNGTrace{std::move(recorder)} : nullptr;
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void mng_trace_destroy(MNGTrace* trace) {
+    delete trace;
+}
+
+void mng_trace_record_input(MNGTrace* trace, const float* samples, uint32_t frameCount,
+                            uint64_t hostTime) {
+    if (trace && samples) {
+        trace->recorder->recordInput(samples, frameCount, hostTime);
+    }
+}
+
+void mng_trace_record_reads(MNGTrace* trace, const MNGSharedHeader* header) {
+    if (trace && header) {
+        trace->recorder->recordReads(header);
+    }
+}
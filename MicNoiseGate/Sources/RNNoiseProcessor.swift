@@ -1,126 +1,142 @@
 import Foundation
-import CRNNoise
-import Accelerate
+import MicNoiseGateDSP
 
 /// RNNoise processor wrapper
 /// RNNoise expects:
 /// - Sample rate: 48000 Hz
 /// - Frame size: 480 samples
 /// - Format: Float32
-class RNNoiseProcessor {
-    private var denoiseState: OpaquePointer?
-    private let frameSize = 480  // RNNoise frame size
-    private let targetSampleRate: Double = 48000.0
-
-    // Buffer for accumulating samples
-    private var inputBuffer: [Float] = []
-    private var outputBuffer: [Float] = []
-
-    // Resampling state
-    private var currentSampleRate: Double = 48000.0
-
-    init() {
-        denoiseState = rnnoise_create(nil)
-    }
-
-    deinit {
-        if let state = denoiseState {
-            rnnoise_destroy(state)
+///
+/// The processing itself (polyphase resampling to 48kHz, the frame FIFO and
+/// RNNoise) runs in the C++ DSP engine; see MicNoiseGateDSP/Denoiser.hpp.
+/// Output stays at 48kHz, the rate of the shared ring buffer.
+///
+/// With `denoise` off the processor only converts to 48kHz and passes each
+/// callback straight through, for when the driver runs RNNoise itself.
+///
+/// With `powerSaving` on, sustained non-speech gates the output to silence
+/// and RNNoise runs on only a fraction of frames until speech returns (see
+/// MicNoiseGateDSP/VoiceGate.hpp).
+///
+/// `suppressor` picks the engine: RNNoise, the much cheaper spectral gate
+/// for machines that can't afford RNNoise (see MicNoiseGateDSP/SpectralGate.hpp),
+/// or RNNoise until its measured cost per frame gets too high and then the
+/// gate. Both delay the output by one frame, so switching doesn't move it.
+///
+/// All storage is allocated up front for the largest callback the input
+/// unit can deliver, so `process` never allocates on the audio thread.
+enum SuppressorMode: Int32 {
+    case rnnoise = 0      // MNG_SUPPRESSOR_RNNOISE
+    case spectralGate = 1 // MNG_SUPPRESSOR_SPECTRAL_GATE
+    case automatic = 2    // MNG_SUPPRESSOR_AUTOMATIC
+
+    /// From the `Suppressor` default: "rnnoise", "gate" or "auto"
+    /// (anything else, or nothing, is automatic)
+    init(defaultsValue: String?) {
+        switch defaultsValue {
+        case "rnnoise": self = .rnnoise
+        case "gate": self = .spectralGate
+        default: self = .automatic
         }
     }
+}
 
-    /// Process audio samples through RNNoise
-    /// - Parameters:
-    ///   - samples: Input audio samples (Float32)
-    ///   - sampleRate: Sample rate of input audio
-    /// - Returns: Processed audio samples with noise reduced
-    func process(samples: [Float], sampleRate: Double) -> [Float] {
-        guard let state = denoiseState else {
-            return samples
-        }
-
-        // Resample if needed
-        var workingSamples = samples
-        if abs(sampleRate - targetSampleRate) > 1.0 {
-            workingSamples = resample(samples, from: sampleRate, to: targetSampleRate)
-        }
-
-        // Add to input buffer
-        inputBuffer.append(contentsOf: workingSamples)
-
-        // Process complete frames
-        var processedSamples: [Float] = []
-
-        while inputBuffer.count >= frameSize {
-            // Extract frame
-            let frame = Array(inputBuffer.prefix(frameSize))
-            inputBuffer.removeFirst(frameSize)
-
-            // Process through RNNoise
-            var outputFrame = [Float](repeating: 0, count: frameSize)
-            frame.withUnsafeBufferPointer { inputPtr in
-                outputFrame.withUnsafeMutableBufferPointer { outputPtr in
-                    // RNNoise expects and returns values in range [-32768, 32767]
-                    // But our audio is in [-1, 1], so we scale
-                    var scaledInput = frame.map { $0 * 32767.0 }
-                    var scaledOutput = [Float](repeating: 0, count: frameSize)
-
-                    scaledInput.withUnsafeMutableBufferPointer { scaledInputPtr in
-                        scaledOutput.withUnsafeMutableBufferPointer { scaledOutputPtr in
-                            rnnoise_process_frame(state, scaledOutputPtr.baseAddress, scaledInputPtr.baseAddress)
-                        }
-                    }
-
-                    // Scale back to [-1, 1]
-                    for i in 0..<frameSize {
-                        outputPtr[i] = scaledOutput[i] / 32767.0
-                    }
-                }
-            }
-
-            processedSamples.append(contentsOf: outputFrame)
+final class RNNoiseProcessor {
+    let denoises: Bool
+
+    private let denoiser: OpaquePointer?
+    private let resampler: OpaquePointer?
+    private let maxFrames: Int
+
+    // 48kHz output handed to the caller
+    private let processed: UnsafeMutablePointer<Float>
+    private let processedCapacity: Int
+
+    init(sampleRate: Double, maxFrames: Int, denoise: Bool = true, powerSaving: Bool = false,
+         suppressor: SuppressorMode = .rnnoise) {
+        self.maxFrames = maxFrames
+        self.denoises = denoise
+
+        if denoise {
+            denoiser = mng_denoiser_create(sampleRate, UInt32(maxFrames))
+            mng_denoiser_set_power_saving(denoiser, powerSaving ? 1 : 0)
+            mng_denoiser_set_suppressor(denoiser, suppressor.rawValue)
+            resampler = nil
+            processedCapacity = Int(mng_denoiser_max_output_frames(denoiser))
+        } else if abs(sampleRate - 48000.0) > 1.0 {
+            denoiser = nil
+            resampler = mng_resampler_create(sampleRate, 48000.0, UInt32(maxFrames))
+            processedCapacity = Int(mng_resampler_max_output_frames(resampler, UInt32(maxFrames)))
+        } else {
+            denoiser = nil
+            resampler = nil
+            processedCapacity = 0
         }
 
-        // Resample back if needed
-        if abs(sampleRate - targetSampleRate) > 1.0 && !processedSamples.isEmpty {
-            processedSamples = resample(processedSamples, from: targetSampleRate, to: sampleRate)
-        }
+        processed = UnsafeMutablePointer<Float>.allocate(capacity: max(processedCapacity, 1))
+        processed.initialize(repeating: 0, count: max(processedCapacity, 1))
+    }
 
-        return processedSamples
+    deinit {
+        mng_denoiser_destroy(denoiser)
+        mng_resampler_destroy(resampler)
+        processed.deallocate()
     }
 
-    /// Simple linear resampling
-    private func resample(_ samples: [Float], from sourceSR: Double, to targetSR: Double) -> [Float] {
-        let ratio = targetSR / sourceSR
-        let outputLength = Int(Double(samples.count) * ratio)
+    /// 48kHz samples held back waiting for a whole RNNoise frame; the next
+    /// output starts with them
+    var pendingFrames: Int {
+        guard let denoiser = denoiser else { return 0 }
+        return Int(mng_denoiser_pending_frames(denoiser))
+    }
 
-        guard outputLength > 0 else { return [] }
+    /// Power saving has gated the output to silence
+    var isIdle: Bool {
+        guard let denoiser = denoiser else { return false }
+        return mng_denoiser_is_idle(denoiser) != 0
+    }
 
-        var output = [Float](repeating: 0, count: outputLength)
+    /// The engine doing the work now; in automatic mode this turns from
+    /// RNNoise to the gate if RNNoise falls behind. Call from the
+    /// processing thread.
+    var activeSuppressor: SuppressorMode? {
+        guard let denoiser = denoiser else { return nil }
+        return SuppressorMode(rawValue: mng_denoiser_active_suppressor(denoiser))
+    }
 
-        for i in 0..<outputLength {
-            let srcIndex = Double(i) / ratio
-            let srcIndexInt = Int(srcIndex)
-            let frac = Float(srcIndex - Double(srcIndexInt))
+    /// Process audio samples through RNNoise
+    /// - Parameters:
+    ///   - samples: Input audio samples (Float32) at the device sample rate,
+    ///     at most `maxFrames` long
+    ///   - output: Receives the processed samples with noise reduced, at
+    ///     48kHz. The buffer is only valid during the call.
+    func process(samples: UnsafeBufferPointer<Float>, output: (UnsafeBufferPointer<Float>) -> Void) {
+        guard let input = samples.baseAddress, samples.count <= maxFrames else {
+            return
+        }
 
-            if srcIndexInt + 1 < samples.count {
-                output[i] = samples[srcIndexInt] * (1 - frac) + samples[srcIndexInt + 1] * frac
-            } else if srcIndexInt < samples.count {
-                output[i] = samples[srcIndexInt]
-            }
+        let count: UInt32
+        if let denoiser = denoiser {
+            count = mng_denoiser_process(denoiser, input, UInt32(samples.count),
+                                         processed, UInt32(processedCapacity))
+        } else if let resampler = resampler {
+            count = mng_resampler_process(resampler, input, UInt32(samples.count),
+                                          processed, UInt32(processedCapacity))
+        } else if !denoises {
+            // Already at 48kHz and nothing to do
+            output(samples)
+            return
+        } else {
+            return
         }
+        guard count > 0 else { return }
 
-        return output
+        output(UnsafeBufferPointer(start: processed, count: Int(count)))
     }
 
     /// Reset the processor state
     func reset() {
-        inputBuffer.removeAll()
-        outputBuffer.removeAll()
-
-        if let state = denoiseState {
-            rnnoise_destroy(state)
-        }
-        denoiseState = rnnoise_create(nil)
+        mng_denoiser_reset(denoiser)
+        mng_resampler_reset(resampler)
     }
 }
@@ -0,0 +1,69 @@
+import Foundation
+import CoreAudio
+import os
+
+// Scheduling for the pipelines' processing threads
+//
+// A processing thread has to get through each block within the
+// microphone's IO period, which QoS alone doesn't promise under load. So
+// it asks for a time-constraint policy with that period, and joins the
+// microphone's IO workgroup so the scheduler treats it as part of the
+// device's deadline and keeps it on the performance cores with the HAL's
+// own thread.
+enum RealtimeThread {
+    // Make the calling thread a time-constraint thread that needs about
+    // `computation` of every `period` seconds. Returns false if refused.
+    static func promoteCurrent(period: Double, computation: Double) -> Bool {
+        var timebase = mach_timebase_info_data_t()
+        mach_timebase_info(&timebase)
+        let ticksPerSecond = 1e9 * Double(timebase.denom) / Double(timebase.numer)
+
+        var policy = thread_time_constraint_policy_data_t(
+            period: UInt32(period * ticksPerSecond),
+            computation: UInt32(computation * ticksPerSecond),
+            constraint: UInt32(period * ticksPerSecond),
+            preemptible: 1
+        )
+        // THREAD_TIME_CONSTRAINT_POLICY_COUNT doesn't import into Swift
+        let count = mach_msg_type_number_t(
+            MemoryLayout<thread_time_constraint_policy_data_t>.size / MemoryLayout<integer_t>.size
+        )
+        let status = withUnsafeMutablePointer(to: &policy) { pointer in
+            pointer.withMemoryRebound(to: integer_t.self, capacity: Int(count)) {
+                thread_policy_set(pthread_mach_thread_np(pthread_self()),
+                                  thread_policy_flavor_t(THREAD_TIME_CONSTRAINT_POLICY),
+                                  $0, count)
+            }
+        }
+        return status == KERN_SUCCESS
+    }
+}
+
+// The calling thread's membership of a device's IO workgroup
+final class WorkgroupMembership {
+    private let workgroup: os_workgroup_t
+    private var token = os_workgroup_join_token_s()
+
+    // Join `deviceID`'s IO workgroup; nil if the device has none or it was
+    // cancelled (the device stopped)
+    init?(deviceID: AudioDeviceID) {
+        var address = AudioObjectPropertyAddress(
+            mSelector: kAudioDevicePropertyIOThreadOSWorkgroup,
+            mScope: kAudioObjectPropertyScopeGlobal,
+            mElement: kAudioObjectPropertyElementMain
+        )
+        var object: Unmanaged<os_workgroup_t>?
+        var size = UInt32(MemoryLayout<Unmanaged<os_workgroup_t>?>.size)
+        guard AudioObjectGetPropertyData(deviceID, &address, 0, nil, &size, &object) == noErr,
+              let object = object else { return nil }
+
+        // The HAL hands the workgroup over retained
+        workgroup = object.takeRetainedValue()
+        guard os_workgroup_join(workgroup, &token) == 0 else { return nil }
+    }
+
+    // Leave, from the thread that joined
+    func leave() {
+        os_workgroup_leave(workgroup, &token)
+    }
+}
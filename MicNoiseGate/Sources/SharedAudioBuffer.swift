@@ -1,60 +1,88 @@
 import Foundation
 import Darwin
 import SharedMemoryBridge
+import MicNoiseGateDSP
 
-// Constants matching the C++ header
-let kSharedMemoryName = "/micnoisegate_audio"
-let kRingBufferFrames: UInt32 = 4096
-let kChannels: UInt32 = 2
-let kSampleRate: UInt32 = 48000
+// Constants from the shared layout header (shm_layout.h)
+let kChannels: UInt32 = MNG_CHANNELS
+let kSampleRate: UInt32 = MNG_SAMPLE_RATE
 
 // Lock-free ring buffer writer for shared memory
-// Matches the C++ SharedAudioBuffer struct layout
+// The layout comes from MNGSharedHeader in shm_layout.h, which the driver
+// includes too, so there are no hand-maintained offsets on either side.
+// The ring operations themselves are the DSP engine's SharedAudioBuffer,
+// the same code the driver reads with.
 final class SharedAudioBufferWriter {
 
-    // Offsets in the shared memory structure (matching C++ layout)
-    private enum Offset {
-        static let writeIndex: Int = 0                    // std::atomic<uint64_t>
-        static let readIndex: Int = 8                     // std::atomic<uint64_t>
-        static let isActive: Int = 16                     // std::atomic<bool>
-        static let sampleRate: Int = 24                   // uint32_t (aligned)
-        static let channels: Int = 28                     // uint32_t
-        static let bufferFrames: Int = 32                 // uint32_t
-        static let padding: Int = 36                      // uint8_t[32]
-        static let audioData: Int = 68                    // float[]
-    }
+    // Segment of the virtual mic this writer feeds
+    let name: String
 
     private var fd: Int32 = -1
     private var buffer: UnsafeMutableRawPointer?
+    private var header: UnsafeMutablePointer<MNGSharedHeader>?
     private var bufferSize: Int = 0
 
+    // Wire the mapping into RAM so paging can never stall a write, with
+    // `defaults write com.micnoisegate.app LockSharedMemory -bool true`.
+    // Off by default: it counts against the process's locked-memory limit.
+    private let lockMemory = UserDefaults.standard.bool(forKey: "LockSharedMemory")
+    private var isLocked = false
+
+    // Ring capacity in frames, a power of two, and the samples' wire format
+    // (MNG_SAMPLE_INT16 or MNG_SAMPLE_FLOAT32); see setLayout
+    private(set) var capacityFrames: UInt32 = MNG_RING_FRAMES
+    private(set) var sampleFormat: UInt32 = MNG_SAMPLE_INT16
+
+    // Largest cycle the driver had served from a header we since replaced
+    private var previousConsumerCycleFrames: UInt32 = 0
+
+    // Ring fill level the driver steers to, in milliseconds. 0 leaves it at
+    // the driver's default; the driver clamps anything else to 10-20ms.
+    // Set with `defaults write com.micnoisegate.app TargetLatencyMs 12`.
+    var targetLatencyMs: Double = UserDefaults.standard.double(forKey: "TargetLatencyMs") {
+        didSet { applyTargetLatency() }
+    }
+
+    private var processingMode: UInt32 = MNG_PROCESSING_APP
+
+    // Pipelines recording a capture trace; the driver logs its reads while
+    // there are any (see beginRequestLog)
+    private var requestLogUsers = 0
+
+    // Last timing hints published, in 48kHz frames, so they are only
+    // stored when they change and survive a header re-initialization
+    private var producerDelayFrames: UInt32 = 0
+    private var captureLatencyFrames: UInt32 = 0
+
+    // Who may write, and the crossfade when that changes; outlives the
+    // segment, so a reconnect doesn't lose track of the producer
+    private let handoff = mng_handoff_create()
+
     var isConnected: Bool {
         return buffer != nil
     }
 
-    init() {
+    // `device` is the virtual mic's index (0 for the first)
+    init(device: UInt32 = 0) {
+        name = SharedAudioBufferWriter.segmentName(device: device)
         connect()
     }
 
     deinit {
         disconnect()
-    }
-
-    // Calculate total buffer size
-    private static func calculateTotalSize() -> Int {
-        return Offset.audioData + Int(kRingBufferFrames * kChannels) * MemoryLayout<Float>.size
+        mng_handoff_destroy(handoff)
     }
 
     // Connect to shared memory (create if needed)
     func connect() {
         guard buffer == nil else { return }
 
-        bufferSize = SharedAudioBufferWriter.calculateTotalSize()
+        bufferSize = mng_shm_total_size(capacityFrames, sampleFormat)
 
         // Create shared memory using wrapper
         // O_CREAT = 0x200, O_RDWR = 0x2
         // S_IRUSR|S_IWUSR|S_IRGRP|S_IWGRP|S_IROTH|S_IWOTH = 0o666 = 438
-        fd = shm_open_wrapper(kSharedMemoryName, 0x202, 438)
+        fd = shm_open_wrapper(name, 0x202, 438)
         guard fd != -1 else {
             let errnum = get_errno()
             if let errStr = strerror_wrapper(errnum) {
@@ -63,8 +91,27 @@ final class SharedAudioBufferWriter {
             return
         }
 
+        // A segment can only be sized once, and the driver indexes a mapping
+        // by the layout it was mapped with. Unless one left behind already
+        // holds a valid header for this exact layout (Float32 and Int16
+        // rings can be the same size), invalidate its header so the driver
+        // lets go of it, and replace it.
+        var existingSize = fstat_size_wrapper(fd)
+        if existingSize > 0 && (existingSize != bufferSize || !segmentHasLayout(size: existingSize)) {
+            print("SharedAudioBuffer: Replacing shared memory of \(existingSize) bytes")
+            retireSegment(size: existingSize)
+            close_wrapper(fd)
+            shm_unlink_wrapper(name)
+            fd = shm_open_wrapper(name, 0x202, 438)
+            existingSize = 0
+            guard fd != -1 else {
+                print("SharedAudioBuffer: Failed to recreate shared memory")
+                return
+            }
+        }
+
         // Set size
-        if ftruncate_wrapper(fd, Int(bufferSize)) == -1 {
+        if existingSize <= 0 && ftruncate_wrapper(fd, Int(bufferSize)) == -1 {
             let errnum = get_errno()
             if let errStr = strerror_wrapper(errnum) {
                 print("SharedAudioBuffer: Failed to set size: \(String(cString: errStr))")
@@ -89,27 +136,137 @@ final class SharedAudioBufferWriter {
             return
         }
 
+        header = buffer?.bindMemory(to: MNGSharedHeader.self, capacity: 1)
+        if let header = header, mng_shm_validate(header, bufferSize) == MNGShmStatusValid {
+            rememberConsumerCycle(header)
+        }
+
+        // Fault the ring's pages in now rather than on the first writes
+        // from the processing thread; initializing the header covers its
+        // own. Whatever an earlier producer left there becomes silence.
+        if let buf = buffer {
+            let headerSize = MemoryLayout<MNGSharedHeader>.size
+            prefault_wrapper(buf + headerSize, bufferSize - headerSize)
+            if lockMemory {
+                isLocked = mlock_wrapper(buf, bufferSize) == 0
+                if !isLocked, let errStr = strerror_wrapper(get_errno()) {
+                    print("SharedAudioBuffer: Failed to lock memory: \(String(cString: errStr))")
+                }
+            }
+        }
+
         // Initialize header
         initializeHeader()
 
-        print("SharedAudioBuffer: Connected to shared memory (\(bufferSize) bytes)")
+        print("SharedAudioBuffer: Connected to \(name) (\(bufferSize) bytes)")
     }
 
-    // Initialize the header fields
+    // Initialize the header fields and publish the magic for the driver
     private func initializeHeader() {
-        guard let buf = buffer else { return }
+        guard let header = header else { return }
+
+        mng_shm_initialize(header, capacityFrames, sampleFormat)
+        mng_shm_set_processing_mode(header, processingMode)
+        mng_shm_set_producer_delay_frames(header, producerDelayFrames)
+        mng_shm_set_capture_latency_frames(header, captureLatencyFrames)
+        mng_request_log_set_enabled(header, requestLogUsers > 0 ? 1 : 0)
+        applyTargetLatency()
+    }
+
+    // Whether the segment open on `fd`, `size` bytes long, has a valid header
+    // for the ring we're about to lay out, so initializing it in place
+    // leaves the driver's view of it as it is
+    private func segmentHasLayout(size: Int) -> Bool {
+        // PROT_READ = 0x1
+        let mapping = mmap_wrapper(nil, size, 0x1, 0x1, fd, 0)
+        guard let mapping = mapping, mapping != UnsafeMutableRawPointer(bitPattern: -1) else { return false }
+        defer { munmap_wrapper(mapping, size) }
+
+        let old = mapping.bindMemory(to: MNGSharedHeader.self, capacity: 1)
+        return size >= MemoryLayout<MNGSharedHeader>.size &&
+            mng_shm_validate(old, size) == MNGShmStatusValid &&
+            old.pointee.bufferFrames == capacityFrames && old.pointee.sampleFormat == sampleFormat
+    }
 
-        // Initialize write/read indices to 0
-        buf.storeBytes(of: UInt64(0), toByteOffset: Offset.writeIndex, as: UInt64.self)
-        buf.storeBytes(of: UInt64(0), toByteOffset: Offset.readIndex, as: UInt64.self)
+    // Invalidate the header of the segment open on `fd`, `size` bytes long,
+    // noting what the driver recorded in it first
+    private func retireSegment(size: Int) {
+        let mapping = mmap_wrapper(nil, size, 0x3, 0x1, fd, 0)
+        guard let mapping = mapping, mapping != UnsafeMutableRawPointer(bitPattern: -1) else { return }
 
-        // Set isActive to false initially
-        buf.storeBytes(of: UInt8(0), toByteOffset: Offset.isActive, as: UInt8.self)
+        let old = mapping.bindMemory(to: MNGSharedHeader.self, capacity: 1)
+        if size >= MemoryLayout<MNGSharedHeader>.size && mng_shm_validate(old, size) == MNGShmStatusValid {
+            rememberConsumerCycle(old)
+            mng_shm_invalidate(old)
+        }
+        munmap_wrapper(mapping, size)
+    }
 
-        // Set format parameters
-        buf.storeBytes(of: kSampleRate, toByteOffset: Offset.sampleRate, as: UInt32.self)
-        buf.storeBytes(of: kChannels, toByteOffset: Offset.channels, as: UInt32.self)
-        buf.storeBytes(of: kRingBufferFrames, toByteOffset: Offset.bufferFrames, as: UInt32.self)
+    private func rememberConsumerCycle(_ header: UnsafeMutablePointer<MNGSharedHeader>) {
+        previousConsumerCycleFrames = max(previousConsumerCycleFrames, mng_shm_max_cycle_frames(header))
+    }
+
+    // Most ring frames the driver has read for one client in one cycle,
+    // from this segment and the ones it replaced; 0 if it hasn't read yet
+    var largestConsumerCycle: UInt32 {
+        guard let header = header else { return previousConsumerCycleFrames }
+        return max(previousConsumerCycleFrames, mng_shm_max_cycle_frames(header))
+    }
+
+    // Lay the ring out for at least `frames` (rounded up to a power of two,
+    // within MNG_MIN_RING_FRAMES and MNG_MAX_RING_FRAMES) in `format`. Int16
+    // halves the bytes the driver reads per frame. A new layout replaces
+    // the segment, and the driver follows to the new one, so call it before
+    // starting to write.
+    func setLayout(frames: UInt32, sampleFormat format: UInt32) {
+        let capacity = mng_shm_capacity_for(frames)
+        guard capacity != capacityFrames || format != sampleFormat else { return }
+        capacityFrames = capacity
+        sampleFormat = format
+        guard isConnected else { return }
+
+        disconnect()
+        connect()
+    }
+
+    private func applyTargetLatency() {
+        guard let header = header else { return }
+
+        let frames = max(0, targetLatencyMs) * Double(kSampleRate) / 1000.0
+        mng_shm_set_target_latency_frames(header, UInt32(frames.rounded()))
+    }
+
+    // Tell the driver who runs RNNoise (MNG_PROCESSING_APP or
+    // MNG_PROCESSING_DRIVER); in driver mode we write the raw signal
+    func setProcessingMode(_ mode: UInt32) {
+        processingMode = mode
+        guard let header = header else { return }
+
+        mng_shm_set_processing_mode(header, mode)
+    }
+
+    // Have the driver log every client read into the header's request log
+    // until the matching endRequestLog(), for a capture trace. Setup
+    // thread only.
+    func beginRequestLog() {
+        requestLogUsers += 1
+        guard let header = header else { return }
+
+        mng_request_log_set_enabled(header, 1)
+    }
+
+    func endRequestLog() {
+        requestLogUsers = max(0, requestLogUsers - 1)
+        guard let header = header else { return }
+
+        mng_request_log_set_enabled(header, requestLogUsers > 0 ? 1 : 0)
+    }
+
+    // Processing thread: hand `trace` the reads logged since its last
+    // call. Real-time safe.
+    func recordReads(into trace: CaptureTrace) {
+        guard let header = header else { return }
+        trace.recordReads(header)
     }
 
     // Disconnect from shared memory
@@ -119,9 +276,14 @@ final class SharedAudioBufferWriter {
 
         let mapFailed = UnsafeMutableRawPointer(bitPattern: -1)
         if let buf = buffer, buf != mapFailed {
+            if isLocked {
+                munlock_wrapper(buf, bufferSize)
+                isLocked = false
+            }
             munmap_wrapper(buf, bufferSize)
         }
         buffer = nil
+        header = nil
 
         if fd != -1 {
             close_wrapper(fd)
@@ -133,86 +295,193 @@ final class SharedAudioBufferWriter {
 
     // Set the active flag (producer is running)
     func setActive(_ active: Bool) {
-        guard let buf = buffer else { return }
+        guard let header = header else { return }
 
         // Atomic store with release semantics
-        let value: UInt8 = active ? 1 : 0
-        buf.storeBytes(of: value, toByteOffset: Offset.isActive, as: UInt8.self)
-        OSMemoryBarrier()
+        mng_shm_set_active(header, active ? 1 : 0)
     }
 
-    // Get available space in buffer (frames)
-    private func availableToWrite() -> UInt64 {
-        guard let buf = buffer else { return 0 }
+    // Write audio to the ring buffer in its channel layout (kChannels,
+    // currently mono; the driver fans it out to the client's format)
+    // frameCount: number of frames (not samples)
+    // Returns false (and counts an overrun) when the ring doesn't have room
+    func write(samples: UnsafePointer<Float>, frameCount: UInt32) -> Bool {
+        guard let header = header else { return false }
+        return mng_ring_write(header, samples, frameCount) != 0
+    }
 
-        OSMemoryBarrier()
-        let writePos = buf.load(fromByteOffset: Offset.writeIndex, as: UInt64.self)
-        let readPos = buf.load(fromByteOffset: Offset.readIndex, as: UInt64.self)
+    // Write mono audio, duplicated into every ring channel
+    // hostTime: mach_absolute_time() at which the first frame was captured,
+    // or 0 if unknown. The driver maps its clients' timestamps onto the
+    // ring through it.
+    func writeMono(samples: UnsafePointer<Float>, frameCount: UInt32, hostTime: UInt64 = 0) -> Bool {
+        guard let header = header else { return false }
 
-        return UInt64(kRingBufferFrames) - (writePos - readPos)
+        let start = mng_shm_load_write_index(header)
+        guard mng_ring_write_mono(header, samples, frameCount) != 0 else { return false }
+
+        if hostTime != 0 {
+            mng_shm_store_anchor(header, start, hostTime)
+        }
+        return true
     }
 
-    // Write interleaved stereo audio to the ring buffer
-    // samples: pointer to interleaved float samples (L, R, L, R, ...)
-    // frameCount: number of frames (not samples)
-    func write(samples: UnsafePointer<Float>, frameCount: UInt32) -> Bool {
-        guard let buf = buffer else { return false }
-        guard availableToWrite() >= UInt64(frameCount) else {
-            // Buffer full, skip
-            return false
+    // Doorbell value to pass to waitForConsumption(since:), read before
+    // looking for work to do
+    var doorbell: UInt32 {
+        guard let header = header else { return 0 }
+        return mng_shm_doorbell(header)
+    }
+
+    // Sleep until the driver consumes from the ring (rings the doorbell
+    // past `seen`) or the timeout passes. Not for the audio thread.
+    func waitForConsumption(since seen: UInt32, timeoutMicroseconds: UInt32) {
+        guard let header = header else {
+            usleep(timeoutMicroseconds)
+            return
         }
+        mng_ring_wait_doorbell(header, seen, timeoutMicroseconds)
+    }
 
-        let writePos = buf.load(fromByteOffset: Offset.writeIndex, as: UInt64.self)
-        let audioDataPtr = buf.advanced(by: Offset.audioData).assumingMemoryBound(to: Float.self)
+    // Wait for room for `frames` frames; false if there still isn't any
+    // after the timeout. Not for the audio thread.
+    func waitForSpace(frames: UInt32, timeoutMicroseconds: UInt32) -> Bool {
+        guard let header = header else { return false }
+        return mng_ring_wait_for_space(header, frames, timeoutMicroseconds) != 0
+    }
 
-        let channels = Int(kChannels)
-        let bufferFrames = Int(kRingBufferFrames)
+    // Most the newest frame in the ring can trail the capture timeline: one
+    // input callback (the device's IO buffer) plus the RNNoise frame the
+    // processor may hold back (processing thread)
+    func setProducerDelay(frames: UInt32) {
+        guard frames != producerDelayFrames else { return }
+        producerDelayFrames = frames
+        guard let header = header else { return }
 
-        for i in 0..<Int(frameCount) {
-            let index = Int((writePos + UInt64(i)) % UInt64(bufferFrames))
-            for ch in 0..<channels {
-                audioDataPtr[index * channels + ch] = samples[i * channels + ch]
-            }
-        }
+        mng_shm_set_producer_delay_frames(header, frames)
+    }
 
-        // Update write index with release semantics
-        OSMemoryBarrier()
-        buf.storeBytes(of: writePos + UInt64(frameCount), toByteOffset: Offset.writeIndex, as: UInt64.self)
+    // The physical microphone's own latency, reported on by the driver
+    func setCaptureLatency(frames: UInt32) {
+        guard frames != captureLatencyFrames else { return }
+        captureLatencyFrames = frames
+        guard let header = header else { return }
 
-        return true
+        mng_shm_set_capture_latency_frames(header, frames)
+    }
+
+    // MARK: - Producer handoff (ProducerHandoff.hpp)
+
+    enum ProducerRole {
+        case owner     // Writes the ring
+        case incoming  // Taking over; feeds the crossfade instead
+        case retired   // Replaced; drops its output
+    }
+
+    // Token for a producer that owns the ring outright. Only while no other
+    // producer runs.
+    func claimProducer() -> UInt32 {
+        return mng_handoff_claim(handoff)
     }
 
-    // Write mono audio converted to stereo
-    func writeMono(samples: UnsafePointer<Float>, frameCount: UInt32) -> Bool {
-        guard let buf = buffer else { return false }
-        guard availableToWrite() >= UInt64(frameCount) else {
-            return false
+    // Token for a producer that takes over from the one writing now, with
+    // a crossfade, writing in bursts of up to `burstFrames`; 0 if it can't
+    func beginHandoff(burstFrames: UInt32) -> UInt32 {
+        return mng_handoff_begin(handoff, burstFrames)
+    }
+
+    var isHandoffPending: Bool {
+        return mng_handoff_pending(handoff) != 0
+    }
+
+    // Hand the ring to the incoming producer without the crossfade, once
+    // the old one has stopped
+    func abandonHandoff() {
+        mng_handoff_abandon(handoff)
+    }
+
+    // Real-time safe
+    func producerRole(_ token: UInt32) -> ProducerRole {
+        guard token != 0 else { return .retired }
+        switch mng_handoff_role(handoff, token) {
+        case MNG_HANDOFF_OWNER: return .owner
+        case MNG_HANDOFF_INCOMING: return .incoming
+        default: return .retired
         }
+    }
+
+    // Owner, before writing each block: fades it towards the incoming
+    // producer while a handoff runs. Real-time safe.
+    func mixHandoff(_ samples: UnsafeMutablePointer<Float>, frameCount: UInt32) {
+        mng_handoff_mix(handoff, samples, frameCount)
+    }
+
+    // Incoming, in place of writing a block. Real-time safe.
+    func feedHandoff(_ samples: UnsafePointer<Float>, frameCount: UInt32) {
+        mng_handoff_feed(handoff, samples, frameCount)
+    }
 
-        let writePos = buf.load(fromByteOffset: Offset.writeIndex, as: UInt64.self)
-        let audioDataPtr = buf.advanced(by: Offset.audioData).assumingMemoryBound(to: Float.self)
+    // New owner, before its first block: queued frames the old producer
+    // didn't fade through; 0 once there are none. Real-time safe.
+    func drainHandoff(into samples: UnsafeMutablePointer<Float>, capacity: UInt32) -> UInt32 {
+        return mng_handoff_drain(handoff, samples, capacity)
+    }
+
+    // MARK: - Telemetry (MNGCycleTelemetry in shm_layout.h)
+
+    // Input callback: a capture cycle that took `nanoseconds` and left
+    // `backlogFrames` of a `capacityFrames` ring for the processing thread.
+    // Real-time safe.
+    func recordCaptureCycle(nanoseconds: UInt64, backlogFrames: UInt64, capacityFrames: UInt32) {
+        guard let block = telemetryBlock(\.captureTelemetry) else { return }
+        mng_telemetry_record(block, nanoseconds, backlogFrames, capacityFrames)
+    }
+
+    // Processing thread: a block that took `nanoseconds` to produce, just
+    // written to the ring. Real-time safe.
+    func recordProducerCycle(nanoseconds: UInt64) {
+        guard let header = header, let block = telemetryBlock(\.producerTelemetry) else { return }
+        let fill = mng_shm_load_write_index(header) &- mng_shm_load_read_index(header)
+        mng_telemetry_record(block, nanoseconds, fill, capacityFrames)
+    }
 
-        let channels = Int(kChannels)
-        let bufferFrames = Int(kRingBufferFrames)
+    // Every loop's telemetry plus the glitch counters, from any thread
+    func telemetry() -> RingTelemetry? {
+        guard let header = header else { return nil }
 
-        for i in 0..<Int(frameCount) {
-            let index = Int((writePos + UInt64(i)) % UInt64(bufferFrames))
-            let sample = samples[i]
-            // Duplicate mono to stereo
-            audioDataPtr[index * channels + 0] = sample
-            audioDataPtr[index * channels + 1] = sample
+        func load(_ key: KeyPath<MNGSharedHeader, MNGCycleTelemetry>) -> CycleStats {
+            var snapshot = MNGCycleTelemetry()
+            if let block = telemetryBlock(key) {
+                mng_telemetry_load(block, &snapshot)
+            }
+            return CycleStats(snapshot)
         }
+        return RingTelemetry(capture: load(\.captureTelemetry),
+                             producer: load(\.producerTelemetry),
+                             consumer: load(\.consumerTelemetry),
+                             overruns: mng_shm_overrun_count(header),
+                             underruns: mng_shm_underrun_count(header))
+    }
 
-        // Update write index with release semantics
-        OSMemoryBarrier()
-        buf.storeBytes(of: writePos + UInt64(frameCount), toByteOffset: Offset.writeIndex, as: UInt64.self)
+    // Address of a telemetry block inside the mapped header
+    private func telemetryBlock(_ key: KeyPath<MNGSharedHeader, MNGCycleTelemetry>)
+        -> UnsafeMutablePointer<MNGCycleTelemetry>? {
+        guard let header = header,
+              let offset = MemoryLayout<MNGSharedHeader>.offset(of: key) else { return nil }
+        return (UnsafeMutableRawPointer(header) + offset).assumingMemoryBound(to: MNGCycleTelemetry.self)
+    }
 
-        return true
+    static func segmentName(device: UInt32) -> String {
+        var name = [CChar](repeating: 0, count: Int(MNG_SHM_NAME_MAX))
+        mng_shm_device_name(device, &name, name.count)
+        return String(cString: name)
     }
 
-    // Remove the shared memory (for cleanup/uninstall)
+    // Remove every virtual mic's shared memory (for cleanup/uninstall)
     static func remove() {
-        shm_unlink_wrapper(kSharedMemoryName)
+        for device in 0..<MNG_MAX_DEVICES {
+            shm_unlink_wrapper(segmentName(device: device))
+        }
         print("SharedAudioBuffer: Removed shared memory")
     }
 }
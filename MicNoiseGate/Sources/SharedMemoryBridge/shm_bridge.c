@@ -26,10 +26,30 @@ int ftruncate_wrapper(int fd, long length) {
     return ftruncate(fd, (off_t)length);
 }
 
+long fstat_size_wrapper(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        return -1;
+    }
+    return (long)st.st_size;
+}
+
 int close_wrapper(int fd) {
     return close(fd);
 }
 
+int mlock_wrapper(const void *addr, size_t len) {
+    return mlock(addr, len);
+}
+
+int munlock_wrapper(const void *addr, size_t len) {
+    return munlock(addr, len);
+}
+
+void prefault_wrapper(void *addr, size_t len) {
+    memset(addr, 0, len);
+}
+
 const char *strerror_wrapper(int errnum) {
     return strerror(errnum);
 }
@@ -2,6 +2,7 @@
 #define SHM_BRIDGE_H
 
 #include <stddef.h>
+#include "shm_layout.h"
 
 // Wrapper functions for POSIX shared memory
 // Needed because Swift can't directly call variadic functions
@@ -11,7 +12,13 @@ int shm_unlink_wrapper(const char *name);
 void *mmap_wrapper(void *addr, size_t len, int prot, int flags, int fd, long offset);
 int munmap_wrapper(void *addr, size_t len);
 int ftruncate_wrapper(int fd, long length);
+long fstat_size_wrapper(int fd);
 int close_wrapper(int fd);
+int mlock_wrapper(const void *addr, size_t len);
+int munlock_wrapper(const void *addr, size_t len);
+// Zero `len` bytes at `addr`, so every page of a fresh mapping is resident
+// and writable before real-time code touches it
+void prefault_wrapper(void *addr, size_t len);
 const char *strerror_wrapper(int errnum);
 int get_errno(void);
 
@@ -0,0 +1,521 @@
+#ifndef SHM_LAYOUT_H
+#define SHM_LAYOUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Shared memory layout between the app (producer) and the driver (consumer)
+//
+// This header is the only definition of the segment: the app imports it
+// through the SharedMemoryBridge module and the driver includes it from
+// SharedMemory.hpp. Bump MNG_SHM_VERSION whenever anything below changes;
+// a reader that sees a different magic, version or size refuses to map.
+
+#define MNG_SHM_NAME        "/micnoisegate_audio"
+#define MNG_SHM_NAME_MAX    32u          // Buffer size for a device's name (PSHMNAMLEN + 1)
+#define MNG_SHM_MAGIC       0x4D4E4741u  // "MNGA"
+#define MNG_SHM_VERSION     13u
+
+// Ring capacity in frames: a power of two the app picks at connect time
+// (bufferFrames) from its input device's IO buffer, so positions wrap with
+// a mask
+#define MNG_RING_FRAMES     4096u        // Default capacity
+#define MNG_MIN_RING_FRAMES 256u
+#define MNG_MAX_RING_FRAMES 65536u
+#define MNG_CHANNELS        1u           // Mono; the driver fans out per client format
+#define MNG_SAMPLE_RATE     48000u       // 48kHz
+
+// Range the driver keeps the ring fill level in, in frames at 48kHz
+#define MNG_MIN_TARGET_LATENCY_FRAMES     480u   // 10ms
+#define MNG_MAX_TARGET_LATENCY_FRAMES     960u   // 20ms
+#define MNG_DEFAULT_TARGET_LATENCY_FRAMES 720u   // 15ms
+
+// Sample format of the ring data (sampleFormat). Int16 holds the same
+// voice in half the bytes; full scale is +-32767, the scale RNNoise works on.
+#define MNG_SAMPLE_FLOAT32  0u
+#define MNG_SAMPLE_INT16    1u
+
+// Who runs RNNoise. In driver mode the app writes raw (resampled) mic audio
+// and the driver denoises it on a worker thread of its own.
+#define MNG_PROCESSING_APP    0u
+#define MNG_PROCESSING_DRIVER 1u
+
+// The driver can expose several virtual mics, each backed by its own
+// segment. Device UIDs are MNG_DEVICE_UID, MNG_DEVICE_UID "_2", ...
+#define MNG_MAX_DEVICES     8u
+#define MNG_DEVICE_UID      "MicNoiseGate_VirtualMic"
+
+// Apple Silicon uses 128-byte cache lines (64 on Intel, where this just
+// costs a little padding)
+#define MNG_CACHE_LINE_SIZE 128
+
+#define MNG_CACHE_ALIGNED __attribute__((aligned(MNG_CACHE_LINE_SIZE)))
+
+// Buckets in each telemetry histogram
+#define MNG_TELEMETRY_BUCKETS 16u
+
+// Timing of one real-time loop, for monitoring
+//
+// Each block has a single writer that records every cycle; anyone can read
+// it, field by field, so a snapshot may mix two neighbouring cycles. The
+// histograms are cumulative: duration bucket i counts cycles that took
+// [2^i, 2^(i+1)) microseconds (bucket 0 includes anything shorter, the
+// last anything longer), fill bucket i cycles that left the ring between
+// i and i+1 sixteenths full.
+typedef struct MNG_CACHE_ALIGNED MNGCycleTelemetry {
+    uint64_t cycles;
+    uint64_t totalNanoseconds;
+    uint64_t maxNanoseconds;
+    uint64_t lastFillFrames;
+    uint64_t durationHistogram[MNG_TELEMETRY_BUCKETS];
+    uint64_t fillHistogram[MNG_TELEMETRY_BUCKETS];
+} MNGCycleTelemetry;
+
+// Entries in the request log (at least a few cycles of every client)
+#define MNG_REQUEST_LOG_ENTRIES 64u
+
+// One client read, as the driver's OnReadClientInput saw it
+typedef struct MNGReadRequest {
+    uint64_t hostTime;          // mach_absolute_time() when the read began
+    uint64_t ioStartHostTime;   // Host time of the device's sample 0
+    double sampleTime;          // HAL sample time of the block's first frame
+    uint32_t frameCount;        // At the client's rate
+    uint32_t sampleRate;
+    uint32_t channels;
+    uint32_t client;            // The driver's slot for the client
+} MNGReadRequest;
+
+// The driver's client reads, for capture traces
+//
+// Only written while the app has set `enabled`. The driver is the single
+// writer: it fills entry `count % MNG_REQUEST_LOG_ENTRIES` and then
+// publishes `count`. Readers keep their own position and copy entries
+// out; an entry can be overwritten while it is copied, so they check
+// `count` again afterwards and drop anything that may have been.
+typedef struct MNG_CACHE_ALIGNED MNGRequestLog {
+    uint32_t enabled;           // Set by the app while it records (atomic)
+    uint32_t reserved;
+    uint64_t count;             // Entries written so far (atomic)
+    MNGReadRequest entries[MNG_REQUEST_LOG_ENTRIES];
+} MNGRequestLog;
+
+// Segment header, followed directly by the ring data in sampleFormat
+//
+// The producer and consumer each own one cache line holding their index
+// plus a cached copy of the other side's index, so in steady state the
+// lines don't bounce between cores every cycle.
+typedef struct MNG_CACHE_ALIGNED MNGSharedHeader {
+    // Format block - written by the producer before it publishes `magic`
+    uint32_t magic;
+    uint32_t version;
+    uint32_t headerSize;        // sizeof(MNGSharedHeader)
+    uint32_t totalSize;         // Header plus ring data, in bytes
+    uint32_t sampleRate;
+    uint32_t channels;
+    uint32_t bufferFrames;      // Ring capacity, a power of two
+    uint32_t isActive;          // Is the producer active? (atomic)
+    uint32_t targetLatencyFrames;  // Fill level the driver steers to, 0 = default (atomic)
+    uint32_t processingMode;    // MNG_PROCESSING_APP or MNG_PROCESSING_DRIVER (atomic)
+    uint32_t producerDelayFrames;   // Most the newest frame can trail the anchor timeline (atomic)
+    uint32_t captureLatencyFrames;  // Physical mic latency ahead of the app (atomic)
+    uint32_t sampleFormat;      // MNG_SAMPLE_FLOAT32 or MNG_SAMPLE_INT16
+
+    // Producer line
+    MNG_CACHE_ALIGNED uint64_t writeIndex;  // Writer position (atomic)
+    uint64_t cachedReadIndex;               // Producer's last view of readIndex
+    uint64_t overrunCount;                  // Writes dropped because the ring was full
+    uint64_t anchorSequence;                // Odd while the anchor is being rewritten
+    uint64_t anchorSampleTime;              // Ring frame captured at anchorHostTime
+    uint64_t anchorHostTime;                // mach_absolute_time() units, 0 = none yet
+
+    // Consumer line
+    MNG_CACHE_ALIGNED uint64_t readIndex;   // Reader position (atomic)
+    uint64_t cachedWriteIndex;              // Consumer's last view of writeIndex
+    uint64_t underrunCount;                 // Reads that came up short
+    uint32_t doorbell;                      // Bumped whenever readIndex moves (atomic, wait address)
+    uint32_t producerWaiting;               // Set while the producer sleeps on doorbell (atomic)
+    uint32_t maxCycleFrames;                // Most ring frames a client read in one cycle (atomic)
+
+    // Telemetry, one block per writer
+    MNGCycleTelemetry captureTelemetry;     // App input callback; fill of its hand-off ring
+    MNGCycleTelemetry producerTelemetry;    // App processing thread, per block written
+    MNGCycleTelemetry consumerTelemetry;    // Driver, per IO cycle; fill behind the slowest client
+
+    MNGRequestLog requestLog;               // Driver, per client read while tracing
+} MNGSharedHeader;
+
+typedef enum MNGShmStatus {
+    MNGShmStatusValid = 0,
+    MNGShmStatusNotReady,       // Magic not published yet (or invalidated)
+    MNGShmStatusBadVersion,
+    MNGShmStatusBadSize,
+    MNGShmStatusBadFormat,
+    MNGShmStatusMisaligned,
+} MNGShmStatus;
+
+// Bytes per sample of `sampleFormat`, 0 for one this build doesn't know
+static inline size_t mng_shm_sample_bytes(uint32_t sampleFormat) {
+    switch (sampleFormat) {
+    case MNG_SAMPLE_FLOAT32: return sizeof(float);
+    case MNG_SAMPLE_INT16: return sizeof(int16_t);
+    default: return 0;
+    }
+}
+
+// Size of the whole segment for a ring of `bufferFrames` in `sampleFormat`
+static inline size_t mng_shm_total_size(uint32_t bufferFrames, uint32_t sampleFormat) {
+    return sizeof(MNGSharedHeader) +
+           (size_t)bufferFrames * MNG_CHANNELS * mng_shm_sample_bytes(sampleFormat);
+}
+
+static inline int mng_shm_valid_capacity(uint32_t bufferFrames) {
+    return bufferFrames >= MNG_MIN_RING_FRAMES && bufferFrames <= MNG_MAX_RING_FRAMES &&
+           (bufferFrames & (bufferFrames - 1u)) == 0;
+}
+
+// The capacity that holds at least `frames`: the next power of two, within
+// MNG_MIN_RING_FRAMES and MNG_MAX_RING_FRAMES
+static inline uint32_t mng_shm_capacity_for(uint32_t frames) {
+    uint32_t capacity = MNG_MIN_RING_FRAMES;
+    while (capacity < frames && capacity < MNG_MAX_RING_FRAMES) {
+        capacity <<= 1;
+    }
+    return capacity;
+}
+
+// Segment name for virtual mic `device` (0-based): MNG_SHM_NAME for the
+// first, then MNG_SHM_NAME "_2", "_3", ... `size` should be MNG_SHM_NAME_MAX.
+static inline void mng_shm_device_name(uint32_t device, char *out, size_t size) {
+    if (device == 0) {
+        snprintf(out, size, "%s", MNG_SHM_NAME);
+    } else {
+        snprintf(out, size, "%s_%u", MNG_SHM_NAME, device + 1);
+    }
+}
+
+// Ring data, starting on the cache line after the header
+static inline float *mng_shm_audio(MNGSharedHeader *header) {
+    return (float *)((char *)header + sizeof(MNGSharedHeader));
+}
+
+static inline int16_t *mng_shm_audio_int16(MNGSharedHeader *header) {
+    return (int16_t *)((char *)header + sizeof(MNGSharedHeader));
+}
+
+// Index accessors - the owning side reads its own index plainly and uses
+// these to publish it or to observe the other side's
+static inline uint64_t mng_shm_load_write_index(const MNGSharedHeader *header) {
+    return __atomic_load_n(&header->writeIndex, __ATOMIC_ACQUIRE);
+}
+
+static inline void mng_shm_store_write_index(MNGSharedHeader *header, uint64_t value) {
+    __atomic_store_n(&header->writeIndex, value, __ATOMIC_RELEASE);
+}
+
+static inline uint64_t mng_shm_load_read_index(const MNGSharedHeader *header) {
+    return __atomic_load_n(&header->readIndex, __ATOMIC_ACQUIRE);
+}
+
+static inline void mng_shm_store_read_index(MNGSharedHeader *header, uint64_t value) {
+    __atomic_store_n(&header->readIndex, value, __ATOMIC_RELEASE);
+}
+
+static inline int mng_shm_is_active(const MNGSharedHeader *header) {
+    return __atomic_load_n(&header->isActive, __ATOMIC_ACQUIRE) != 0;
+}
+
+static inline void mng_shm_set_active(MNGSharedHeader *header, int active) {
+    __atomic_store_n(&header->isActive, active ? 1u : 0u, __ATOMIC_RELEASE);
+}
+
+static inline uint32_t mng_shm_target_latency_frames(const MNGSharedHeader *header) {
+    return __atomic_load_n(&header->targetLatencyFrames, __ATOMIC_RELAXED);
+}
+
+static inline void mng_shm_set_target_latency_frames(MNGSharedHeader *header, uint32_t frames) {
+    __atomic_store_n(&header->targetLatencyFrames, frames, __ATOMIC_RELAXED);
+}
+
+static inline uint32_t mng_shm_processing_mode(const MNGSharedHeader *header) {
+    return __atomic_load_n(&header->processingMode, __ATOMIC_ACQUIRE);
+}
+
+static inline void mng_shm_set_processing_mode(MNGSharedHeader *header, uint32_t mode) {
+    __atomic_store_n(&header->processingMode, mode, __ATOMIC_RELEASE);
+}
+
+static inline uint32_t mng_shm_producer_delay_frames(const MNGSharedHeader *header) {
+    return __atomic_load_n(&header->producerDelayFrames, __ATOMIC_RELAXED);
+}
+
+static inline void mng_shm_set_producer_delay_frames(MNGSharedHeader *header, uint32_t frames) {
+    __atomic_store_n(&header->producerDelayFrames, frames, __ATOMIC_RELAXED);
+}
+
+static inline uint32_t mng_shm_capture_latency_frames(const MNGSharedHeader *header) {
+    return __atomic_load_n(&header->captureLatencyFrames, __ATOMIC_RELAXED);
+}
+
+static inline void mng_shm_set_capture_latency_frames(MNGSharedHeader *header, uint32_t frames) {
+    __atomic_store_n(&header->captureLatencyFrames, frames, __ATOMIC_RELAXED);
+}
+
+// Glitch counters - each has a single writer (overruns: producer,
+// underruns: consumer) and can be read from either side
+static inline void mng_shm_note_overrun(MNGSharedHeader *header) {
+    __atomic_store_n(&header->overrunCount, header->overrunCount + 1, __ATOMIC_RELAXED);
+}
+
+static inline void mng_shm_note_underrun(MNGSharedHeader *header) {
+    __atomic_store_n(&header->underrunCount, header->underrunCount + 1, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t mng_shm_overrun_count(const MNGSharedHeader *header) {
+    return __atomic_load_n(&header->overrunCount, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t mng_shm_underrun_count(const MNGSharedHeader *header) {
+    return __atomic_load_n(&header->underrunCount, __ATOMIC_RELAXED);
+}
+
+// Timing anchor: ring frame `sampleTime` was captured at host time
+// `hostTime`. The producer restamps it with every write, and readers
+// extrapolate from it at the nominal rate to find the ring position for
+// any host time. The pair can't be stored in one atomic, so a sequence
+// count (odd while it changes) guards it.
+static inline void mng_shm_store_anchor(MNGSharedHeader *header, uint64_t sampleTime, uint64_t hostTime) {
+    uint64_t sequence = header->anchorSequence;
+    __atomic_store_n(&header->anchorSequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&header->anchorSampleTime, sampleTime, __ATOMIC_RELAXED);
+    __atomic_store_n(&header->anchorHostTime, hostTime, __ATOMIC_RELAXED);
+    __atomic_store_n(&header->anchorSequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+// Returns 0 when there is no anchor yet, or the producer kept restamping
+// it while we looked (the caller just tries again next cycle)
+static inline int mng_shm_load_anchor(const MNGSharedHeader *header,
+                                      uint64_t *sampleTime, uint64_t *hostTime) {
+    for (int attempt = 0; attempt < 4; attempt++) {
+        uint64_t before = __atomic_load_n(&header->anchorSequence, __ATOMIC_ACQUIRE);
+        if (before & 1u) {
+            continue;
+        }
+        uint64_t sample = __atomic_load_n(&header->anchorSampleTime, __ATOMIC_RELAXED);
+        uint64_t host = __atomic_load_n(&header->anchorHostTime, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&header->anchorSequence, __ATOMIC_RELAXED) == before) {
+            *sampleTime = sample;
+            *hostTime = host;
+            return host != 0;
+        }
+    }
+    return 0;
+}
+
+// Largest cycle the consumer serves, so the producer can size the next
+// ring to hold it. Only the consumer raises it.
+static inline uint32_t mng_shm_max_cycle_frames(const MNGSharedHeader *header) {
+    return __atomic_load_n(&header->maxCycleFrames, __ATOMIC_RELAXED);
+}
+
+static inline void mng_shm_note_cycle_frames(MNGSharedHeader *header, uint32_t frames) {
+    if (frames > header->maxCycleFrames) {
+        __atomic_store_n(&header->maxCycleFrames, frames, __ATOMIC_RELAXED);
+    }
+}
+
+// Doorbell: the consumer bumps it each time it frees space, so a producer
+// with nowhere to write can sleep on it (see Doorbell.hpp). Both sides use
+// sequentially consistent operations, so either the consumer sees
+// producerWaiting and wakes it, or the producer sees the new value and
+// doesn't sleep.
+static inline uint32_t mng_shm_doorbell(const MNGSharedHeader *header) {
+    return __atomic_load_n(&header->doorbell, __ATOMIC_SEQ_CST);
+}
+
+static inline void mng_shm_bump_doorbell(MNGSharedHeader *header) {
+    __atomic_fetch_add(&header->doorbell, 1u, __ATOMIC_SEQ_CST);
+}
+
+static inline int mng_shm_producer_waiting(const MNGSharedHeader *header) {
+    return __atomic_load_n(&header->producerWaiting, __ATOMIC_SEQ_CST) != 0;
+}
+
+static inline void mng_shm_set_producer_waiting(MNGSharedHeader *header, int waiting) {
+    __atomic_store_n(&header->producerWaiting, waiting ? 1u : 0u, __ATOMIC_SEQ_CST);
+}
+
+// Record one cycle that took `nanoseconds` and left `fillFrames` in a ring
+// of `capacityFrames`. Real-time safe; only from the block's writer.
+static inline void mng_telemetry_record(MNGCycleTelemetry *telemetry, uint64_t nanoseconds,
+                                        uint64_t fillFrames, uint32_t capacityFrames) {
+    const uint64_t micros = nanoseconds / 1000u;
+    uint32_t duration = micros ? 63u - (uint32_t)__builtin_clzll(micros) : 0u;
+    uint32_t fill = capacityFrames
+        ? (uint32_t)(fillFrames * MNG_TELEMETRY_BUCKETS / capacityFrames) : 0u;
+    if (duration >= MNG_TELEMETRY_BUCKETS) {
+        duration = MNG_TELEMETRY_BUCKETS - 1u;
+    }
+    if (fill >= MNG_TELEMETRY_BUCKETS) {
+        fill = MNG_TELEMETRY_BUCKETS - 1u;
+    }
+
+    __atomic_store_n(&telemetry->cycles, telemetry->cycles + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&telemetry->totalNanoseconds, telemetry->totalNanoseconds + nanoseconds,
+                     __ATOMIC_RELAXED);
+    if (nanoseconds > telemetry->maxNanoseconds) {
+        __atomic_store_n(&telemetry->maxNanoseconds, nanoseconds, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&telemetry->lastFillFrames, fillFrames, __ATOMIC_RELAXED);
+    __atomic_store_n(&telemetry->durationHistogram[duration],
+                     telemetry->durationHistogram[duration] + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&telemetry->fillHistogram[fill], telemetry->fillHistogram[fill] + 1,
+                     __ATOMIC_RELAXED);
+}
+
+// Copy a block for reporting, from any thread or process
+static inline void mng_telemetry_load(const MNGCycleTelemetry *telemetry, MNGCycleTelemetry *out) {
+    out->cycles = __atomic_load_n(&telemetry->cycles, __ATOMIC_RELAXED);
+    out->totalNanoseconds = __atomic_load_n(&telemetry->totalNanoseconds, __ATOMIC_RELAXED);
+    out->maxNanoseconds = __atomic_load_n(&telemetry->maxNanoseconds, __ATOMIC_RELAXED);
+    out->lastFillFrames = __atomic_load_n(&telemetry->lastFillFrames, __ATOMIC_RELAXED);
+    for (uint32_t i = 0; i < MNG_TELEMETRY_BUCKETS; i++) {
+        out->durationHistogram[i] = __atomic_load_n(&telemetry->durationHistogram[i], __ATOMIC_RELAXED);
+        out->fillHistogram[i] = __atomic_load_n(&telemetry->fillHistogram[i], __ATOMIC_RELAXED);
+    }
+}
+
+// Mark the segment as not (yet) valid for readers
+static inline void mng_shm_invalidate(MNGSharedHeader *header) {
+    __atomic_store_n(&header->magic, 0u, __ATOMIC_RELEASE);
+}
+
+// Producer: reset the header of a segment
+// mng_shm_total_size(bufferFrames, sampleFormat) long and publish it.
+// `magic` is stored last with release semantics so a reader that sees it
+// also sees every other field.
+static inline void mng_shm_initialize(MNGSharedHeader *header, uint32_t bufferFrames,
+                                      uint32_t sampleFormat) {
+    mng_shm_invalidate(header);
+
+    header->version = MNG_SHM_VERSION;
+    header->headerSize = (uint32_t)sizeof(MNGSharedHeader);
+    header->totalSize = (uint32_t)mng_shm_total_size(bufferFrames, sampleFormat);
+    header->sampleRate = MNG_SAMPLE_RATE;
+    header->channels = MNG_CHANNELS;
+    header->bufferFrames = bufferFrames;
+    header->isActive = 0;
+    header->targetLatencyFrames = 0;
+    header->processingMode = MNG_PROCESSING_APP;
+    header->producerDelayFrames = 0;
+    header->captureLatencyFrames = 0;
+    header->sampleFormat = sampleFormat;
+
+    header->writeIndex = 0;
+    header->cachedReadIndex = 0;
+    header->overrunCount = 0;
+    header->anchorSequence = 0;
+    header->anchorSampleTime = 0;
+    header->anchorHostTime = 0;
+    header->readIndex = 0;
+    header->cachedWriteIndex = 0;
+    header->underrunCount = 0;
+    header->doorbell = 0;
+    header->producerWaiting = 0;
+    header->maxCycleFrames = 0;
+    memset(&header->captureTelemetry, 0, sizeof(header->captureTelemetry));
+    memset(&header->producerTelemetry, 0, sizeof(header->producerTelemetry));
+    memset(&header->consumerTelemetry, 0, sizeof(header->consumerTelemetry));
+    memset(&header->requestLog, 0, sizeof(header->requestLog));
+
+    __atomic_store_n(&header->magic, MNG_SHM_MAGIC, __ATOMIC_RELEASE);
+}
+
+// Request log: the app turns it on for as long as it records a trace
+static inline int mng_request_log_enabled(const MNGSharedHeader *header) {
+    return __atomic_load_n(&header->requestLog.enabled, __ATOMIC_RELAXED) != 0;
+}
+
+static inline void mng_request_log_set_enabled(MNGSharedHeader *header, int enabled) {
+    __atomic_store_n(&header->requestLog.enabled, enabled ? 1u : 0u, __ATOMIC_RELAXED);
+}
+
+// Driver: log one read. Real-time safe; only from the IO thread.
+static inline void mng_request_log_append(MNGSharedHeader *header, const MNGReadRequest *request) {
+    MNGRequestLog *log = &header->requestLog;
+    const uint64_t count = log->count;
+    memcpy(&log->entries[count % MNG_REQUEST_LOG_ENTRIES], request, sizeof(*request));
+    __atomic_store_n(&log->count, count + 1, __ATOMIC_RELEASE);
+}
+
+// Copy the entries logged since `*next` (0 to start with) into `out`, up
+// to `capacity`, and move `*next` past them. Returns how many were copied;
+// `*lost` gets how many were overwritten before they could be. Real-time
+// safe; one caller per `next`.
+static inline uint32_t mng_request_log_read(const MNGSharedHeader *header, uint64_t *next,
+                                            MNGReadRequest *out, uint32_t capacity,
+                                            uint64_t *lost) {
+    const MNGRequestLog *log = &header->requestLog;
+    uint64_t count = __atomic_load_n(&log->count, __ATOMIC_ACQUIRE);
+    *lost = 0;
+    if (count < *next) {
+        *next = 0;  // The header was re-initialized
+    }
+    if (count - *next > MNG_REQUEST_LOG_ENTRIES) {
+        *lost = count - MNG_REQUEST_LOG_ENTRIES - *next;
+        *next = count - MNG_REQUEST_LOG_ENTRIES;
+    }
+
+    uint32_t copied = 0;
+    for (uint64_t i = *next; i < count && copied < capacity; i++, copied++) {
+        memcpy(&out[copied], &log->entries[i % MNG_REQUEST_LOG_ENTRIES], sizeof(*out));
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    // The entry being written now reuses the slot of the oldest one still
+    // in the log; anything at or before it may be torn
+    const uint64_t latest = __atomic_load_n(&log->count, __ATOMIC_RELAXED);
+    const uint64_t oldestIntact = latest >= MNG_REQUEST_LOG_ENTRIES
+        ? latest - MNG_REQUEST_LOG_ENTRIES + 1 : 0;
+    uint32_t dropped = 0;
+    if (*next < oldestIntact) {
+        dropped = (uint32_t)(oldestIntact - *next < copied ? oldestIntact - *next : copied);
+        memmove(out, out + dropped, (copied - dropped) * sizeof(*out));
+    }
+    *lost += dropped;
+    *next += copied;
+    return copied - dropped;
+}
+
+// Consumer: check that a mapping of `mappedSize` bytes holds a header this
+// build understands before touching the ring
+static inline MNGShmStatus mng_shm_validate(const MNGSharedHeader *header, size_t mappedSize) {
+    if (mappedSize < sizeof(MNGSharedHeader)) {
+        return MNGShmStatusBadSize;
+    }
+    if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != MNG_SHM_MAGIC) {
+        return MNGShmStatusNotReady;
+    }
+    if (header->version != MNG_SHM_VERSION) {
+        return MNGShmStatusBadVersion;
+    }
+    if (header->channels == 0 || header->channels > MNG_CHANNELS ||
+        !mng_shm_valid_capacity(header->bufferFrames) ||
+        mng_shm_sample_bytes(header->sampleFormat) == 0) {
+        return MNGShmStatusBadFormat;
+    }
+    if (header->headerSize != sizeof(MNGSharedHeader) ||
+        header->totalSize != mng_shm_total_size(header->bufferFrames, header->sampleFormat) ||
+        mappedSize < header->totalSize) {
+        return MNGShmStatusBadSize;
+    }
+    if (((uintptr_t)header % MNG_CACHE_LINE_SIZE) != 0) {
+        return MNGShmStatusMisaligned;
+    }
+    return MNGShmStatusValid;
+}
+
+#endif
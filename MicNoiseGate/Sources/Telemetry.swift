@@ -0,0 +1,201 @@
+import Foundation
+import Network
+import SharedMemoryBridge
+
+// Real-time telemetry of the virtual mics
+//
+// The capture callback, the processing thread and the driver each record
+// every cycle into their own MNGCycleTelemetry block in the shared segment
+// (see shm_layout.h). TelemetryMonitor reads the blocks once a second for
+// the menu, and can hand them on to a fleet-monitoring agent:
+//
+//   defaults write com.micnoisegate.app TelemetryJSONPath /tmp/micnoisegate.json
+//   defaults write com.micnoisegate.app TelemetryStatsd localhost:8125
+//
+// rewrites the JSON file every second and sends statsd gauges and counters
+// over UDP.
+
+enum HostTime {
+    private static let nanosecondsPerTick: Double = {
+        var timebase = mach_timebase_info_data_t()
+        mach_timebase_info(&timebase)
+        return Double(timebase.numer) / Double(timebase.denom)
+    }()
+
+    // Ticks since `start` in nanoseconds. Real-time safe.
+    static func nanoseconds(since start: UInt64) -> UInt64 {
+        return UInt64(Double(mach_absolute_time() &- start) * nanosecondsPerTick)
+    }
+}
+
+// One loop's block, summarised
+struct CycleStats {
+    let cycles: UInt64
+    let meanMs: Double
+    let maxMs: Double
+    // Upper edge of the histogram bucket holding the 99th percentile
+    let p99Ms: Double
+    // Ring fill after the last cycle
+    let fillMs: Double
+    let durationHistogram: [UInt64]
+    let fillHistogram: [UInt64]
+
+    init(_ block: MNGCycleTelemetry) {
+        var block = block
+        cycles = block.cycles
+        meanMs = cycles > 0 ? Double(block.totalNanoseconds) / Double(cycles) / 1e6 : 0
+        maxMs = Double(block.maxNanoseconds) / 1e6
+        fillMs = Double(block.lastFillFrames) * 1000 / Double(kSampleRate)
+        durationHistogram = withUnsafeBytes(of: &block.durationHistogram) { Array($0.bindMemory(to: UInt64.self)) }
+        fillHistogram = withUnsafeBytes(of: &block.fillHistogram) { Array($0.bindMemory(to: UInt64.self)) }
+
+        // Bucket i holds [2^i, 2^(i+1)) microseconds
+        var seen: UInt64 = 0
+        var p99: Double = 0
+        for (bucket, count) in durationHistogram.enumerated() where count > 0 {
+            seen += count
+            p99 = Double(1 << (bucket + 1)) / 1000
+            if Double(seen) >= Double(cycles) * 0.99 { break }
+        }
+        p99Ms = p99
+    }
+
+    var json: [String: Any] {
+        return [
+            "cycles": cycles,
+            "mean_ms": meanMs,
+            "max_ms": maxMs,
+            "p99_ms": p99Ms,
+            "fill_ms": fillMs,
+            "duration_histogram_us": durationHistogram,
+            "fill_histogram": fillHistogram,
+        ]
+    }
+}
+
+// Telemetry of one virtual mic's segment
+struct RingTelemetry {
+    let capture: CycleStats
+    let producer: CycleStats
+    let consumer: CycleStats
+    let overruns: UInt64
+    let underruns: UInt64
+
+    var json: [String: Any] {
+        return [
+            "capture": capture.json,
+            "processing": producer.json,
+            "driver": consumer.json,
+            "overruns": overruns,
+            "underruns": underruns,
+        ]
+    }
+}
+
+final class TelemetryMonitor: ObservableObject {
+    // The first virtual mic's telemetry, for the menu
+    @Published private(set) var latest: RingTelemetry?
+
+    // Fetches the current telemetry of every virtual mic, nil where it has
+    // no segment, and hands it to the callback on the main thread
+    private let source: (@escaping ([RingTelemetry?]) -> Void) -> Void
+
+    private var timer: Timer?
+    private var polling = false  // A fetch is outstanding; skip ticks until it lands
+    private let jsonPath = UserDefaults.standard.string(forKey: "TelemetryJSONPath")
+    private let statsd = StatsdClient(address: UserDefaults.standard.string(forKey: "TelemetryStatsd"))
+
+    init(source: @escaping (@escaping ([RingTelemetry?]) -> Void) -> Void) {
+        self.source = source
+    }
+
+    // Main thread
+    func start() {
+        guard timer == nil else { return }
+        timer = Timer.scheduledTimer(withTimeInterval: 1, repeats: true) { [weak self] _ in
+            self?.poll()
+        }
+        poll()
+    }
+
+    func stop() {
+        timer?.invalidate()
+        timer = nil
+    }
+
+    private func poll() {
+        guard !polling else { return }
+        polling = true
+        source { [weak self] rings in
+            self?.polling = false
+            self?.publish(rings)
+        }
+    }
+
+    // Main thread. A fetch that lands after stop() is dropped.
+    private func publish(_ rings: [RingTelemetry?]) {
+        guard timer != nil else { return }
+        latest = rings.first ?? nil
+
+        if let path = jsonPath {
+            let devices = rings.map { $0?.json ?? [:] }
+            let document: [String: Any] = ["timestamp": Date().timeIntervalSince1970, "devices": devices]
+            if let data = try? JSONSerialization.data(withJSONObject: document, options: [.sortedKeys]) {
+                try? data.write(to: URL(fileURLWithPath: (path as NSString).expandingTildeInPath),
+                                options: .atomic)
+            }
+        }
+        statsd?.send(rings)
+    }
+}
+
+// statsd over UDP: gauges for the cycle times and fill, counters for
+// cycles and glitches (as the change since the last report)
+final class StatsdClient {
+    private let connection: NWConnection
+    private var lastCounts: [String: UInt64] = [:]
+
+    // `address` is host:port
+    init?(address: String?) {
+        guard let address = address, let colon = address.lastIndex(of: ":"),
+              let port = NWEndpoint.Port(String(address[address.index(after: colon)...])) else {
+            return nil
+        }
+        let host = NWEndpoint.Host(String(address[..<colon]))
+        connection = NWConnection(host: host, port: port, using: .udp)
+        connection.start(queue: DispatchQueue(label: "MicNoiseGate statsd"))
+    }
+
+    deinit {
+        connection.cancel()
+    }
+
+    func send(_ rings: [RingTelemetry?]) {
+        var lines: [String] = []
+        for (device, ring) in rings.enumerated() {
+            guard let ring = ring else { continue }
+            let prefix = "micnoisegate.mic\(device)"
+            for (stage, stats) in [("capture", ring.capture), ("processing", ring.producer),
+                                   ("driver", ring.consumer)] {
+                lines.append("\(prefix).\(stage).mean_ms:\(stats.meanMs)|g")
+                lines.append("\(prefix).\(stage).max_ms:\(stats.maxMs)|g")
+                lines.append("\(prefix).\(stage).p99_ms:\(stats.p99Ms)|g")
+                lines.append("\(prefix).\(stage).fill_ms:\(stats.fillMs)|g")
+                lines.append(counter("\(prefix).\(stage).cycles", stats.cycles))
+            }
+            lines.append(counter("\(prefix).overruns", ring.overruns))
+            lines.append(counter("\(prefix).underruns", ring.underruns))
+        }
+        guard !lines.isEmpty else { return }
+        connection.send(content: lines.joined(separator: "\n").data(using: .utf8),
+                        completion: .idempotent)
+    }
+
+    // A statsd counter line for the growth of cumulative `value`; a restart
+    // of the writer (value going down) counts from zero
+    private func counter(_ name: String, _ value: UInt64) -> String {
+        let last = lastCounts[name] ?? 0
+        lastCounts[name] = value
+        return "\(name):\(value >= last ? value - last : value)|c"
+    }
+}
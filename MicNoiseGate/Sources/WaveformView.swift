@@ -1,10 +1,43 @@
 import SwiftUI
 
+// Waveforms and level bars of the shown pipeline
+//
+// A TimelineView on the animation schedule redraws the panel once per
+// display frame (it runs off the display link), pulling the newest meter
+// readings straight from the DSP engine's triple buffers first. Nothing is
+// published per audio block, and while the popover is hidden the timeline
+// is paused, so the panel costs nothing.
+struct MeterPanel: View {
+    let meters: MeterSnapshot
+    let isVisible: Bool
+
+    var body: some View {
+        TimelineView(.animation(minimumInterval: nil, paused: !isVisible)) { timeline in
+            let _ = meters.refresh()
+
+            VStack(spacing: 12) {
+                WaveformView(channel: meters.input, color: .orange,
+                             label: "Input (Raw)", frame: timeline.date)
+
+                WaveformView(channel: meters.output, color: .green,
+                             label: "Output (Processed)", frame: timeline.date)
+
+                Divider()
+
+                // Level Meters
+                LevelMeterView(input: meters.input, output: meters.output, frame: timeline.date)
+            }
+        }
+    }
+}
+
+// Waveform envelope of the latest block: the band between each slice's
+// smallest and largest sample, drawn straight into a Canvas
 struct WaveformView: View {
-    let samples: [Float]
+    let channel: MeterChannel
     let color: Color
     let label: String
-    let level: Float
+    let frame: Date  // Display frame being drawn; a new one redraws
 
     var body: some View {
         VStack(alignment: .leading, spacing: 4) {
@@ -14,75 +47,54 @@ struct WaveformView: View {
                     .foregroundColor(.secondary)
                 Spacer()
                 // Level indicator
-                Text("\(Int(level * 100))%")
+                Text("\(Int(channel.level * 100))%")
                     .font(.caption2)
                     .foregroundColor(color)
                     .monospacedDigit()
             }
 
-            GeometryReader { geometry in
-                let width = geometry.size.width
-                let height = geometry.size.height
-                let midY = height / 2
-
-                ZStack {
-                    // Background
-                    RoundedRectangle(cornerRadius: 4)
-                        .fill(Color.gray.opacity(0.1))
-
-                    // Center line
-                    Path { path in
-                        path.move(to: CGPoint(x: 0, y: midY))
-                        path.addLine(to: CGPoint(x: width, y: midY))
-                    }
-                    .stroke(Color.gray.opacity(0.3), lineWidth: 0.5)
-
-                    // Waveform
-                    Path { path in
-                        guard samples.count > 1 else { return }
-
-                        let stepX = width / CGFloat(samples.count - 1)
-
-                        path.move(to: CGPoint(x: 0, y: midY))
-
-                        for (index, sample) in samples.enumerated() {
-                            let x = CGFloat(index) * stepX
-                            let normalizedSample = CGFloat(sample) * 3 // Scale for visibility
-                            let y = midY - (normalizedSample * midY * 0.8)
-                            path.addLine(to: CGPoint(x: x, y: y))
-                        }
-                    }
-                    .stroke(color, lineWidth: 1.5)
-
-                    // Filled area under waveform
-                    Path { path in
-                        guard samples.count > 1 else { return }
-
-                        let stepX = width / CGFloat(samples.count - 1)
-
-                        path.move(to: CGPoint(x: 0, y: midY))
-
-                        for (index, sample) in samples.enumerated() {
-                            let x = CGFloat(index) * stepX
-                            let normalizedSample = CGFloat(sample) * 3
-                            let y = midY - (normalizedSample * midY * 0.8)
-                            path.addLine(to: CGPoint(x: x, y: y))
-                        }
+            Canvas { context, size in
+                let midY = size.height / 2
+
+                // Background
+                context.fill(Path(roundedRect: CGRect(origin: .zero, size: size), cornerRadius: 4),
+                             with: .color(Color.gray.opacity(0.1)))
+
+                // Center line
+                var center = Path()
+                center.move(to: CGPoint(x: 0, y: midY))
+                center.addLine(to: CGPoint(x: size.width, y: midY))
+                context.stroke(center, with: .color(Color.gray.opacity(0.3)), lineWidth: 0.5)
+
+                // Envelope: along the maxima, back along the minima
+                let count = MeterChannel.points
+                let stepX = size.width / CGFloat(count - 1)
+                func y(_ sample: Float) -> CGFloat {
+                    let normalizedSample = CGFloat(sample) * 3 // Scale for visibility
+                    return midY - (normalizedSample * midY * 0.8)
+                }
 
-                        path.addLine(to: CGPoint(x: width, y: midY))
-                        path.closeSubpath()
-                    }
-                    .fill(color.opacity(0.2))
+                var envelope = Path()
+                envelope.move(to: CGPoint(x: 0, y: y(channel.maximum[0])))
+                for index in 1..<count {
+                    envelope.addLine(to: CGPoint(x: CGFloat(index) * stepX, y: y(channel.maximum[index])))
                 }
+                for index in stride(from: count - 1, through: 0, by: -1) {
+                    envelope.addLine(to: CGPoint(x: CGFloat(index) * stepX, y: y(channel.minimum[index])))
+                }
+                envelope.closeSubpath()
+                context.fill(envelope, with: .color(color.opacity(0.6)))
             }
             .frame(height: 40)
         }
     }
 }
 
+// RMS bars, turning red when the block's peak reaches full scale
 struct LevelMeterView: View {
-    let inputLevel: Float
-    let outputLevel: Float
+    let input: MeterChannel
+    let output: MeterChannel
+    let frame: Date  // Display frame being drawn; a new one redraws
 
     var body: some View {
         VStack(spacing: 8) {
@@ -98,8 +110,8 @@ struct LevelMeterView: View {
                             .fill(Color.gray.opacity(0.2))
 
                         RoundedRectangle(cornerRadius: 2)
-                            .fill(levelColor(inputLevel))
-                            .frame(width: geometry.size.width * CGFloat(inputLevel))
+                            .fill(levelColor(input))
+                            .frame(width: geometry.size.width * CGFloat(input.level))
                     }
                 }
                 .frame(height: 8)
@@ -117,8 +129,8 @@ struct LevelMeterView: View {
                             .fill(Color.gray.opacity(0.2))
 
                         RoundedRectangle(cornerRadius: 2)
-                            .fill(Color.green)
-                            .frame(width: geometry.size.width * CGFloat(outputLevel))
+                            .fill(output.peak >= kClipLevel ? Color.red : Color.green)
+                            .frame(width: geometry.size.width * CGFloat(output.level))
                     }
                 }
                 .frame(height: 8)
@@ -126,8 +138,14 @@ struct LevelMeterView: View {
         }
     }
 
-    private func levelColor(_ level: Float) -> Color {
-        if level < 0.5 {
+    // Peak treated as clipping
+    private let kClipLevel: Float = 0.99
+
+    private func levelColor(_ channel: MeterChannel) -> Color {
+        let level = channel.level
+        if channel.peak >= kClipLevel {
+            return .red
+        } else if level < 0.5 {
             return .green
         } else if level < 0.8 {
             return .yellow